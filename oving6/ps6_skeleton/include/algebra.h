@@ -0,0 +1,20 @@
+#ifndef ALGEBRA_H
+#define ALGEBRA_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "tree.h"
+
+/*
+ * Algebraic simplification of one expression node whose children are
+ * simplified already: returns what should take its place in the tree.
+ * simplify_expressions does this for every expression of a program, and
+ * is to be run after bind_names, since the rules look at what names are.
+ * algebra_rewrites returns the number of rewrites made so far, and with
+ * verbosity above 1, reports the count for each rule on stderr.
+ */
+node_index_t algebra_simplify(node_index_t expression);
+void simplify_expressions(node_index_t root);
+uint32_t algebra_rewrites(int32_t verbosity);
+#endif
@@ -0,0 +1,21 @@
+#ifndef CSOURCE_H
+#define CSOURCE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "tree.h"
+
+/* Levels of nesting the C is indented for, at most */
+#define CSOURCE_INDENT_MAX 16
+
+/*
+ * Write a program whose names are bound as C99 source, which a C compiler
+ * can make a program of that prints and exits the way the native one
+ * does. Parts of the program which C has no way to put (a variable which
+ * holds both numbers and arrays, a CONTINUE into another function) are
+ * reported on stderr, and stop the compiler.
+ */
+void csource_write(FILE *stream, node_index_t root);
+#endif
@@ -0,0 +1,23 @@
+#ifndef EMIT_H
+#define EMIT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "ir.h"
+
+/*
+ * Buffered output of the assembly text, written to a file descriptor in
+ * large chunks. Nothing here goes through stdio's format strings: text is
+ * copied from fixed tables and integers are converted by hand.
+ */
+void emit_open(int fd);
+void emit_close(void);
+void emit_bytes(const char *text, size_t length);
+void emit_str(const char *text);
+void emit_char(char c);
+void emit_int(int32_t value);
+void ir_emit(void);
+#endif
@@ -0,0 +1,36 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "ir.h"
+
+/* Bytes in the longest instruction made */
+#define ENCODE_MAX 16
+
+/*
+ * The part of an encoded instruction which refers to a label, to be filled
+ * in once it is known where the label ends up: 'size' bytes (0 if there is
+ * no such part), 'at' bytes into the instruction. A relative field holds
+ * the distance to the label from the end of the instruction, which is how
+ * jumps and calls go, and memory at a label on x86-64.
+ */
+typedef struct {
+	uint8_t at, size;
+	bool relative;
+	bool branch;            /* The target of a jump or call */
+	int32_t label;
+} field_t;
+
+/*
+ * Machine code for an instruction, as an assembler would encode it, for
+ * x86 or x86-64 (see ir.h). A jump has a 1-byte distance, or 4 bytes if
+ * 'near' is set. The field referring to a label is left as zeros, and
+ * described in 'field'. Returns the length of the code.
+ */
+uint8_t instruction_encode(instruction_t *instr, bool near, uint8_t *code,
+                           field_t *field);
+#endif
@@ -0,0 +1,24 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "tree.h"
+
+/* Steps an evaluation may take, and all of them together */
+#define FOLD_FUEL (1 << 16)
+#define FOLD_FUEL_TOTAL (1 << 24)
+
+/* Words of frames an evaluation may use, which limits its recursion */
+#define FOLD_MEMORY (1 << 16)
+
+/*
+ * Evaluate calls to side effect free functions with constant arguments
+ * at compile time, in a program whose names are bound, and put their
+ * results in their place. Returns the number of calls evaluated, and with
+ * verbosity above 0, reports each one on stderr.
+ */
+uint32_t fold_calls(node_index_t root, int32_t verbosity);
+#endif
@@ -1,5 +1,16 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "tree.h"
-extern bool peephole;
-void generate(FILE *stream, node_t *);
+#include "ir.h"
+#include "emit.h"
+#include "peephole.h"
+#include "regalloc.h"
+#include "stackcheck.h"
+#include "object.h"
+extern bool peephole, stdio_emitter, registers, object_file, jit;
+extern int32_t verbosity;
+
+/* The arguments of the program run with -j, from its name */
+extern int jit_argc;
+extern char **jit_argv;
+void generate(FILE *stream, node_index_t);
@@ -0,0 +1,19 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "tree.h"
+
+/* Largest function body (in nodes) to inline, unless told otherwise */
+#define INLINE_BUDGET 32
+
+/*
+ * Inline calls to small functions with at most 'budget' nodes in their
+ * bodies, in a program whose names are bound. Returns the number of calls
+ * inlined, and with verbosity above 0, reports each one on stderr.
+ */
+uint32_t inline_calls(node_index_t root, int32_t budget, int32_t verbosity);
+#endif
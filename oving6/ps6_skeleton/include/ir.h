@@ -0,0 +1,117 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+/*
+ * Intermediate representation of the generated code: one instruction per
+ * line of assembly, with typed operands instead of text, so that passes
+ * over the code can look at what an instruction does without parsing it.
+ * It is only turned into text when it is printed.
+ */
+typedef enum {
+    NIL, CDQ, LEAVE, RET,                                // 0-operand
+    LABEL,                                               // Placeholder
+    PUSH, POP, MUL, DIV, DEC, NEG, CMPZERO,              // 1-operand arithmetic
+    CALL, JUMP, JUMPLESS, JUMPZERO, JUMPNONZ,            // 1-operand ctrlflow
+    MOVE, ADD, SUB, CMP, LSHIFT, RSHIFT, URSHIFT,        // 2-operand
+    IMUL, TEST, LEA, AND, EXTEND
+} opcode_t;
+
+typedef enum {
+    EAX, EBX, ECX, EDX, ESI, EDI, EBP, ESP
+} reg_t;
+
+/*
+ * An operand is a register, an immediate value, a memory location at an
+ * offset from a register, a label (a jump or call target, or a memory
+ * location at a symbol), or the address of a label as an immediate value.
+ * The value field holds the immediate, the offset or the label number.
+ * A scaled operand is the address (%r,%r,value), only found in leal, which
+ * makes r times 1+value without touching memory.
+ * Before register allocation, the register of a register, memory or scaled
+ * operand can also be a virtual one, numbered from 0 within the function.
+ */
+typedef enum {
+    O_NONE, O_REGISTER, O_IMMEDIATE, O_MEMORY, O_LABEL, O_ADDRESS,
+    O_SCALED, O_VIRTUAL, O_VMEMORY, O_VSCALED
+} operand_kind_t;
+
+typedef struct {
+	uint32_t kind : 8;
+	uint32_t reg : 24;
+	int32_t value;
+} operand_t;
+
+typedef struct {
+	uint8_t op;
+	bool wide;
+	operand_t operands[2];
+} instruction_t;
+
+/*
+ * Code for x86-64 (the -m64 flag) keeps VSL's values in the low halves of
+ * the registers, and most instructions work on those, but moves, pushes
+ * and pops carry whole registers, so that the addresses of arrays survive
+ * them. So does anything done to %esp and %ebp, which are printed as %rsp
+ * and %rbp, as are the registers of memory operands. An instruction made
+ * with WIDE added to its opcode, like one which computes an address, works
+ * on whole registers too. EXTEND sign-extends the low half of a register
+ * into a whole one (movslq), and is only found in x86-64 code. Memory at
+ * a label is reached relative to %rip there.
+ */
+#define WIDE 0x80
+#define WORD_SIZE (x86_64 ? 8 : 4)
+extern bool x86_64;
+
+/*
+ * Labels are numbered in the order they are made, and printed as their
+ * name followed by their number (unless it is negative). Global labels are
+ * printed as they are, the ones belonging to the VSL program get a leading
+ * underscore to keep them apart from the C library.
+ */
+typedef struct {
+	const char *name;
+	int32_t number;
+	bool global;
+} label_t;
+
+/*
+ * The instructions sit side by side in one growing vector, in program
+ * order. Removing an instruction is done by turning it into a NIL.
+ */
+extern instruction_t *instructions;
+extern uint32_t instructions_count;
+extern label_t *labels;
+extern uint32_t labels_count;
+
+extern const char *register_names[], *register_names64[];
+extern const uint8_t opcode_operands[];
+
+void ir_init(void);
+void ir_finalize(void);
+void instruction_add(opcode_t op, ...);
+void instruction_append(instruction_t instr);
+int32_t label_new(const char *name, int32_t number, bool global);
+int label_format(char *buffer, size_t size, int32_t label);
+bool instruction_wide(instruction_t *instr);
+const char *operand_register(instruction_t *instr, operand_t *o);
+bool label_relative(instruction_t *instr, operand_t *o);
+void ir_print(FILE *stream);
+
+/*
+ * What instructions do to the physical registers, as bit masks with bit r
+ * set for register r. Implied uses count, like %eax and %edx in idivl, or
+ * the registers a call may clobber.
+ */
+#define REG(r) (1u << (r))
+operand_t *instruction_destination(instruction_t *instr);
+uint32_t operand_registers(operand_t *o);
+uint32_t registers_read(instruction_t *instr);
+uint32_t registers_written(instruction_t *instr);
+uint32_t registers_used(instruction_t *instr);
+#endif
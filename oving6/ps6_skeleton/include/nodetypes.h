@@ -16,34 +16,20 @@ typedef enum {
 
 
 /*
- * Structure for pairing integer and string encodings of node types.
- * Integers make readable code, strings make readable trees - this way, we
- * can pun freely back and forth between the two.
+ * Enumerated type for the operation an EXPRESSION node stands for.
+ * Expressions without an operator (parentheses, lone variables and
+ * integers) are OP_NONE until simplification replaces them by their child.
  */
-typedef struct {
-	nt_number index;
-	char *text;
-} nodetype_t;
-
-
-/* Root node: program */
-extern const nodetype_t program_n;
-
-/* Node types for the lists */
-extern const nodetype_t
-function_list_n, statement_list_n, print_list_n, expression_list_n,
-                 variable_list_n, argument_list_n, parameter_list_n, declaration_list_n;
-
-/* Function declarations */
-extern const nodetype_t function_n;
+typedef enum {
+    OP_NONE, OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW, OP_NEG, OP_CALL, OP_INDEX
+} operator_t;
 
-/* Statements and blocks */
-extern const nodetype_t
-statement_n, block_n, assignment_statement_n, return_statement_n,
-             print_statement_n, null_statement_n, if_statement_n, while_statement_n;
 
-/* Expressions and terminals */
-extern const nodetype_t
-print_item_n, expression_n, declaration_n, variable_n, integer_n, text_n;
+/*
+ * Names of node types and operators, indexed by the enums above.
+ * Integers make readable code, strings make readable trees.
+ */
+extern const char *nodetype_names[];
+extern const char *operator_names[];
 
 #endif
@@ -0,0 +1,32 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "ir.h"
+#include "encode.h"
+#include "emit.h"
+
+/*
+ * Output of an ELF relocatable object file, for the linker to take
+ * without going through an assembler: the instruction vector is encoded
+ * in .text, strings go in .rodata, and space for tables in .bss. Labels
+ * are told apart by the names they print with, as they would be in the
+ * assembly. Those defined nowhere, like the functions of the C library,
+ * are left for the linker to find, through relocations.
+ *
+ * The data is given after object_begin, labelled by labels from the IR,
+ * and object_write encodes the instructions and writes the whole file.
+ * Instead, object_run puts it all in memory and runs it right away, for
+ * the machine the compiler runs on.
+ */
+void object_begin(void);
+void object_string(int32_t label, const char *text);
+void object_reserve(int32_t label, uint32_t size);
+void object_global(int32_t label);
+void object_write(int fd);
+void object_run(int32_t entry, int argc, char **argv);
+#endif
@@ -0,0 +1,15 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "ir.h"
+
+/*
+ * Rewrite the instruction vector in place, and return how many
+ * instructions were removed. With verbosity above 1, the count for each
+ * rule goes to stderr.
+ */
+uint32_t peephole_optimize(int32_t verbosity);
+#endif
@@ -0,0 +1,16 @@
+#ifndef PRUNE_H
+#define PRUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "tree.h"
+
+/*
+ * Drop the functions which can't be reached from the first one through
+ * the call graph, and the strings only they print. Returns the number of
+ * functions dropped, and with verbosity above 0, names each on stderr.
+ */
+uint32_t prune_functions(node_index_t root, int32_t verbosity);
+#endif
@@ -0,0 +1,25 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "ir.h"
+
+/*
+ * Register allocation for one function at a time, by linear scan over the
+ * instruction vector. The function is generated with virtual registers
+ * from vreg_new, and has to be the last thing in the vector; it is
+ * expected to start with
+ *     LABEL, PUSH %ebp, MOVE %esp,%ebp, SUB $0,%esp, NIL, NIL, NIL
+ * and to have three NILs before the LEAVE of every RET. The allocator
+ * fills in the frame size and saves the callee-saved registers it uses in
+ * these places.
+ */
+void regalloc_begin(void);
+int32_t vreg_new(void);
+int32_t regalloc_function(uint32_t first, int32_t frame_words,
+                          int32_t verbosity);
+#endif
@@ -0,0 +1,17 @@
+#ifndef STACKCHECK_H
+#define STACKCHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "ir.h"
+
+/*
+ * Check that the machine stack is balanced in every function of the
+ * instruction vector: the stack height has to be the same along every
+ * path into a label, and back where the prologue left it at each leave.
+ * Every violation is reported on stderr, and the number of them returned.
+ */
+uint32_t stack_check(void);
+#endif
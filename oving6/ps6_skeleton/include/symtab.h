@@ -2,15 +2,18 @@
 #define SYMTAB_H
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
-#include <ght_hash_table.h>
-
-#define HASH_BUCKETS 8
-typedef ght_hash_table_t hash_t;
 
 typedef struct {
 	int32_t stack_offset, depth, n_args;
+	int32_t frame_size;     /* Bytes of locals, for functions */
+	int32_t vreg;           /* Virtual register, when allocating registers */
+	int32_t index;          /* Position in the list of functions */
+	bool memoized;          /* Results kept in a table, for functions */
+	int32_t ident;
 	char *label;
 } symbol_t;
 
@@ -19,11 +22,22 @@ void symtab_init(void);
 void symtab_finalize(void);
 
 int32_t strings_add(char *str);
+char *strings_get(int32_t index);
+uint32_t strings_decode(const char *text, char *bytes);
+int32_t strings_count(void);
+void strings_drop(int32_t index);
 void strings_output(FILE *stream);
+void strings_emit(void);
+void strings_object(void);
+
+int32_t ident_add(const char *name);
+char *ident_text(int32_t ident);
+uint32_t ident_hash(int32_t ident);
 
 void scope_add(void);
 void scope_remove(void);
 
-void symbol_insert(char *key, symbol_t *value);
-void symbol_get(symbol_t **value, char *key);
+void symbol_insert(int32_t ident, symbol_t *value);
+void symbol_keep(symbol_t *value);
+void symbol_get(symbol_t **value, int32_t ident);
 #endif
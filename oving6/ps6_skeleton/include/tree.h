@@ -16,31 +16,97 @@
 
 /*
  * Basic data structure for syntax tree nodes.
- * Both the label data and the list of children are consistently allocated
- * in a dynamic fashion, even if data is just a single character, integer,
- * etc., because it simplifies using a recursive traversal of the tree, both
- * for decoration, printing and destruction.
+ * All nodes live side by side in one growing vector (see node_new), and
+ * refer to each other by their 32-bit position in it: index 0 is never
+ * handed out, so NO_NODE can stand in for the optional parts of the
+ * syntax that are missing. Node type and operator are small enums, and the
+ * one piece of label data a node can have (the value of an INTEGER, the
+ * identifier number of a VARIABLE, the string number of a TEXT, the
+ * number of a call) is stored in place. Child index arrays come from the
+ * tree arena (see tree_alloc), so nothing is freed one node at a time: the
+ * whole tree goes away at once in destroy_tree.
+ *
+ * Since the vector moves when it grows, a node_t pointer (as obtained from
+ * NODE) is only good until the next call to node_new.
  */
-typedef struct n {
-	nodetype_t type;        /* Type of this node */
-	void *data;             /* Data label for terminals and expressions */
-	symbol_t *entry;        /* Pointer to symtab entry */
+typedef uint32_t node_index_t;
+
+typedef struct {
+	uint8_t type;           /* Type of this node (nt_number) */
+	uint8_t op;             /* Operator of expressions (operator_t) */
+	uint8_t pure;           /* Expression can't have side effects or trap */
 	uint32_t n_children;    /* Number of children */
-	struct n **children;    /* Pointers to child nodes */
+	int32_t value;          /* Integer value / identifier / string number */
+	symbol_t *entry;        /* Pointer to symtab entry */
+	node_index_t *children; /* Indices of child nodes */
 } node_t;
 
+#define NO_NODE ((node_index_t) 0)
+
+extern node_t *nodes;
+#define NODE(i) (&nodes[(i)])
+
+
+/*
+ * Explicit stack for tree traversals. None of the passes recur over the
+ * tree, since machine-generated programs can nest far deeper than the C
+ * stack would allow: each keeps its own stack of visits, where a visit
+ * records a node, how many steps of its treatment are done (typically,
+ * which child is next), and a word of scratch space for the pass.
+ * Only the topmost visit is ever worked on, so the visit of a node's
+ * parent is always the one right below it.
+ */
+typedef struct {
+	node_index_t node;
+	uint32_t step;
+	int32_t aux;
+} visit_t;
+
+typedef struct {
+	visit_t *visits;
+	uint32_t size, height;
+} walk_t;
+
+#define WALK_TOP(w) (&(w)->visits[(w)->height - 1])
+
+
+/*
+ * The call graph: bind_names records every call in the program as an
+ * edge from the function it is made in, and numbers the calls in the
+ * value of their EXPRESSION nodes to find the edges by. The callee is the
+ * function the call names. Passes that drop a call set its edge's call to
+ * NO_NODE, and passes that copy one add an edge for the copy.
+ */
+typedef struct {
+	symbol_t *caller;
+	node_index_t call;
+} call_t;
+
+extern call_t *calls;
+extern uint32_t calls_count;
+
 
 /*
  *  Function prototypes: implementations are found in tree.c
  */
-void node_init(
-    node_t *n, nodetype_t type, void *data, uint32_t n_children, ...
+void *tree_alloc(size_t size);
+void *tree_realloc(void *old, size_t old_size, size_t new_size);
+char *tree_strdup(const char *s);
+void destroy_tree(void);
+
+node_index_t node_new(
+    nt_number type, operator_t op, int32_t value, uint32_t n_children, ...
 );
-void node_print(FILE *output, node_t *root, uint32_t nesting);
-void node_finalize(node_t *discard);
+void node_append(node_index_t list, node_index_t child);
+
+void walk_push(walk_t *walk, node_index_t node);
+void walk_finalize(walk_t *walk);
+void node_print(FILE *output, node_index_t root, uint32_t nesting);
 
-void destroy_subtree(node_t *discard);
-void simplify_tree(node_t **simplified, node_t *root);
-void bind_names(node_t *root);
+void simplify_tree(node_index_t *simplified, node_index_t root);
+void bind_names(node_index_t root, char **memoized, uint32_t n_memoized);
+void call_add(symbol_t *caller, node_index_t call);
+symbol_t *call_callee(node_index_t call);
+void call_lists(uint32_t functions_count, uint32_t **first, uint32_t **callees);
 
 #endif
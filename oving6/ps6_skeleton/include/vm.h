@@ -0,0 +1,20 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "tree.h"
+
+/* Words the VM stack may grow to, which limits the depth of recursion */
+#define VM_STACK_LIMIT (1 << 26)
+
+/*
+ * Compile a program whose names are bound to bytecode, and run it right
+ * away on the arguments in argv[1] to argv[argc - 1], printing what the
+ * native program would. Exits with the status the program gives. With
+ * verbosity above 0, reports the size of the bytecode on stderr.
+ */
+void vm_run(node_index_t root, int argc, char **argv, int32_t verbosity);
+#endif
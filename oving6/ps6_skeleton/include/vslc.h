@@ -4,13 +4,19 @@
 
 #include "nodetypes.h"
 #include "tree.h"
+#include "algebra.h"
+#include "fold.h"
+#include "inline.h"
+#include "prune.h"
 #include "generator.h"
+#include "vm.h"
+#include "csource.h"
 
 /*
  * Root node of the program syntax tree, and parsing function generated by
  * bison - both of these live in 'parser.o'
  */
-extern node_t *root;
+extern node_index_t root;
 extern int yyparse(void);
 
 /* This is the main program, its only visible interface is the entry point. */
@@ -0,0 +1,392 @@
+#include <algebra.h>
+
+
+/*
+ * Algebraic simplification of expressions, on top of the folding of
+ * constant operands in simplify_tree. Each rule looks at one expression
+ * node and the children right below it, and rewrites them in place (or
+ * hands back one of them to take the node's place) if it can. The rules
+ * are tried over and over on a node until none applies.
+ *
+ * Constants are gathered on the right: c + x becomes x + c, x - c becomes
+ * x + (-c), and constants further down are pulled up past the other
+ * operand, so that a chain of them meets and is folded into one. All of
+ * this holds for arithmetic modulo 2^32, which is what the machine does.
+ *
+ * Dropping an operand (as in x * 0) is only done when it is pure, which
+ * means it calls nothing, divides by nothing and reads no array, so the
+ * program can't tell the difference. Divisions are never folded away,
+ * since dividing by 0 (or the smallest integer by -1) has to trap. The
+ * rules run once names are bound, so a name which is dropped has been
+ * found to be a variable (and an unknown one reported) first.
+ */
+
+/* How many nodes same_expression compares before giving up */
+#define COMPARE_LIMIT 32
+
+static bool
+is_constant(node_index_t n, int32_t value) {
+	return NODE(n)->type == INTEGER && NODE(n)->value == value;
+}
+
+
+static bool
+is_integer(node_index_t n) {
+	return NODE(n)->type == INTEGER;
+}
+
+
+static bool
+is_expression(node_index_t n, operator_t op) {
+	return NODE(n)->type == EXPRESSION && NODE(n)->op == op;
+}
+
+
+static bool
+pure(node_index_t n) {
+	return NODE(n)->type == INTEGER ||
+	       (NODE(n)->type == VARIABLE && NODE(n)->entry->label == NULL) ||
+	       (NODE(n)->type == EXPRESSION && NODE(n)->pure);
+}
+
+
+/* Wrapping arithmetic on constants */
+static int32_t
+wrap_add(int32_t a, int32_t b) {
+	return (int32_t) ((uint32_t) a + (uint32_t) b);
+}
+
+
+static int32_t
+wrap_mul(int32_t a, int32_t b) {
+	return (int32_t) ((uint32_t) a * (uint32_t) b);
+}
+
+
+static int32_t
+wrap_neg(int32_t a) {
+	return (int32_t) (0u - (uint32_t) a);
+}
+
+
+/* Are two pure expressions the same, as far as a few nodes go? */
+static bool
+same_expression(node_index_t a, node_index_t b) {
+	node_index_t left[COMPARE_LIMIT], right[COMPARE_LIMIT];
+	uint32_t height = 0, compared = 0;
+	left[height] = a, right[height++] = b;
+	while (height > 0) {
+		height -= 1;
+		node_t *x = NODE(left[height]), *y = NODE(right[height]);
+		if (++compared > COMPARE_LIMIT || x->type != y->type ||
+		        x->op != y->op || x->n_children != y->n_children)
+			return false;
+		if ((x->type == INTEGER || x->type == VARIABLE) &&
+		        x->value != y->value)
+			return false;
+		for (uint32_t i = 0; i < x->n_children; i++) {
+			if (height == COMPARE_LIMIT)
+				return false;
+			left[height] = x->children[i], right[height++] = y->children[i];
+		}
+	}
+	return true;
+}
+
+
+static void
+set_children(node_t *n, node_index_t a, node_index_t b) {
+	n->children[0] = a;
+	n->children[1] = b;
+}
+
+
+/* -(-x) is x */
+static node_index_t
+double_negation(node_index_t e) {
+	node_t *n = NODE(e);
+	if (n->op != OP_NEG || !is_expression(n->children[0], OP_NEG))
+		return NO_NODE;
+	return NODE(n->children[0])->children[0];
+}
+
+
+/* c + x and c * x become x + c and x * c */
+static node_index_t
+constant_right(node_index_t e) {
+	node_t *n = NODE(e);
+	if ((n->op != OP_ADD && n->op != OP_MUL) || !is_integer(n->children[0]) ||
+	        is_integer(n->children[1]))
+		return NO_NODE;
+	set_children(n, n->children[1], n->children[0]);
+	return e;
+}
+
+
+/* x + 0, x - 0, x * 1, x / 1 and x ** 1 are x */
+static node_index_t
+identity(node_index_t e) {
+	node_t *n = NODE(e);
+	if (n->n_children != 2)
+		return NO_NODE;
+	node_index_t b = n->children[1];
+	switch (n->op) {
+	case OP_ADD:
+	case OP_SUB:
+		return is_constant(b, 0) ? n->children[0] : NO_NODE;
+	case OP_MUL:
+	case OP_DIV:
+	case OP_POW:
+		return is_constant(b, 1) ? n->children[0] : NO_NODE;
+	default:
+		return NO_NODE;
+	}
+}
+
+
+/* x - c is x + (-c) */
+static node_index_t
+subtract_constant(node_index_t e) {
+	node_t *n = NODE(e);
+	if (n->op != OP_SUB || !is_integer(n->children[1]))
+		return NO_NODE;
+	NODE(n->children[1])->value = wrap_neg(NODE(n->children[1])->value);
+	n->op = OP_ADD;
+	return e;
+}
+
+
+/*
+ * 0 - x and x * -1 are -x, x + (-y) is x - y, x - (-y) is x + y, and
+ * -(x * c) is x * (-c). (Not x / -1, which traps for the smallest integer.)
+ */
+static node_index_t
+negation(node_index_t e) {
+	node_t *n = NODE(e);
+	if (n->op == OP_NEG) {
+		node_index_t x = n->children[0];
+		if (!is_expression(x, OP_MUL) || !is_integer(NODE(x)->children[1]))
+			return NO_NODE;
+		node_index_t c = NODE(x)->children[1];
+		NODE(c)->value = wrap_neg(NODE(c)->value);
+		return x;
+	}
+	if (n->n_children != 2)
+		return NO_NODE;
+	node_index_t a = n->children[0], b = n->children[1];
+	if ((n->op == OP_SUB && is_constant(a, 0)) ||
+	        (n->op == OP_MUL && is_constant(b, -1))) {
+		n->op = OP_NEG;
+		n->n_children = 1;
+		n->children[0] = is_integer(a) ? b : a;
+		return e;
+	}
+	if ((n->op == OP_ADD || n->op == OP_SUB) && is_expression(b, OP_NEG)) {
+		n->op = (n->op == OP_ADD) ? OP_SUB : OP_ADD;
+		n->children[1] = NODE(b)->children[0];
+		return e;
+	}
+	return NO_NODE;
+}
+
+
+/* x * 0 is 0, and x ** 0 and 1 ** x are 1, as long as x is pure */
+static node_index_t
+annihilator(node_index_t e) {
+	node_t *n = NODE(e);
+	if (n->n_children != 2)
+		return NO_NODE;
+	node_index_t a = n->children[0], b = n->children[1];
+	if (n->op == OP_MUL && is_constant(b, 0) && pure(a))
+		return b;
+	if (n->op == OP_POW && is_constant(b, 0) && pure(a)) {
+		NODE(b)->value = 1;
+		return b;
+	}
+	if (n->op == OP_POW && is_constant(a, 1) && pure(b))
+		return a;
+	return NO_NODE;
+}
+
+
+/* x - x is 0, for pure x */
+static node_index_t
+self_cancel(node_index_t e) {
+	node_t *n = NODE(e);
+	if (n->op != OP_SUB || !pure(n->children[0]) ||
+	        !same_expression(n->children[0], n->children[1]))
+		return NO_NODE;
+	n->type = INTEGER;
+	n->op = OP_NONE;
+	n->value = 0;
+	n->n_children = 0;
+	return e;
+}
+
+
+/*
+ * Constants move up through sums and products, so they can be folded:
+ *     (x + c) + d  ->  x + (c + d)        (x * c) * d  ->  x * (c * d)
+ *     (x + c) + y  ->  (x + y) + c        (x * c) * y  ->  (x * y) * c
+ *     x + (y + c)  ->  (x + y) + c        x * (y * c)  ->  (x * y) * c
+ *     (x + c) - y  ->  (x - y) + c
+ *     x - (y + c)  ->  (x - y) + (-c)
+ * The operands stay in the same order, so they are evaluated as before.
+ * The inner node is reused for the new inner operation, which is
+ * simplified in turn.
+ */
+static node_index_t
+reassociate(node_index_t e) {
+	node_t *n = NODE(e);
+	if (n->n_children != 2 ||
+	        (n->op != OP_ADD && n->op != OP_SUB && n->op != OP_MUL))
+		return NO_NODE;
+	operator_t op = (n->op == OP_MUL) ? OP_MUL : OP_ADD;
+	node_index_t a = n->children[0], b = n->children[1];
+
+	if (is_expression(a, op) && is_integer(NODE(a)->children[1])) {
+		node_index_t x = NODE(a)->children[0], c = NODE(a)->children[1];
+		if (n->op != OP_SUB && is_integer(b)) {
+			NODE(b)->value = (op == OP_MUL) ?
+			                 wrap_mul(NODE(c)->value, NODE(b)->value) :
+			                 wrap_add(NODE(c)->value, NODE(b)->value);
+			set_children(n, x, b);
+			return e;
+		}
+		if (!is_integer(b)) {
+			NODE(a)->op = n->op;
+			set_children(NODE(a), x, b);
+			n->op = op;
+			set_children(n, algebra_simplify(a), c);
+			return e;
+		}
+	}
+	if (is_expression(b, op) && is_integer(NODE(b)->children[1]) &&
+	        !is_integer(a)) {
+		node_index_t y = NODE(b)->children[0], c = NODE(b)->children[1];
+		if (n->op == OP_SUB)
+			NODE(c)->value = wrap_neg(NODE(c)->value);
+		NODE(b)->op = n->op;
+		set_children(NODE(b), a, y);
+		n->op = op;
+		set_children(n, algebra_simplify(b), c);
+		return e;
+	}
+	return NO_NODE;
+}
+
+
+static const struct {
+	const char *name;
+	node_index_t (*apply)(node_index_t e);
+} rules[] = {
+	{ "double negation", double_negation },
+	{ "constant to the right", constant_right },
+	{ "identity", identity },
+	{ "subtracted constant", subtract_constant },
+	{ "negation", negation },
+	{ "annihilator", annihilator },
+	{ "self cancellation", self_cancel },
+	{ "reassociation", reassociate }
+};
+
+#define N_RULES (sizeof(rules) / sizeof(rules[0]))
+
+static uint32_t rewrites[N_RULES];
+
+
+/* Fold an operation on two constants into the first one, if it is safe */
+static node_index_t
+fold(node_index_t e) {
+	node_t *n = NODE(e);
+	if (n->op != OP_ADD && n->op != OP_MUL)
+		return NO_NODE;
+	node_index_t a = n->children[0], b = n->children[1];
+	if (!is_integer(a) || !is_integer(b))
+		return NO_NODE;
+	int32_t x = NODE(a)->value, y = NODE(b)->value;
+	switch (n->op) {
+	case OP_ADD:
+		NODE(a)->value = wrap_add(x, y);
+		return a;
+	case OP_MUL:
+		NODE(a)->value = wrap_mul(x, y);
+		return a;
+	default:
+		return NO_NODE;
+	}
+}
+
+
+node_index_t
+algebra_simplify(node_index_t e) {
+	bool changed = true;
+	while (changed && NODE(e)->type == EXPRESSION) {
+		changed = false;
+		for (uint32_t r = 0; r < N_RULES; r++) {
+			node_index_t result = rules[r].apply(e);
+			if (result != NO_NODE) {
+				rewrites[r] += 1;
+				e = result;
+				changed = true;
+				break;
+			}
+		}
+		node_index_t folded;
+		if (NODE(e)->type == EXPRESSION && (folded = fold(e)) != NO_NODE)
+			e = folded, changed = true;
+	}
+
+	node_t *n = NODE(e);
+	if (n->type == EXPRESSION) {
+		n->pure = n->op == OP_ADD || n->op == OP_SUB || n->op == OP_MUL ||
+		          n->op == OP_NEG || n->op == OP_POW;
+		for (uint32_t i = 0; i < n->n_children; i++)
+			n->pure = n->pure && pure(n->children[i]);
+	}
+	return e;
+}
+
+
+void
+simplify_expressions(node_index_t root) {
+	/*
+	 * Depth-first traversal as in simplify_tree: each expression is
+	 * simplified once its children are, and takes its place in its parent.
+	 */
+	walk_t walk = { NULL, 0, 0 };
+	if (root != NO_NODE)
+		walk_push(&walk, root);
+	while (walk.height > 0) {
+		visit_t *v = WALK_TOP(&walk);
+		node_t *n = NODE(v->node);
+		if (v->step < n->n_children) {
+			node_index_t child = n->children[v->step++];
+			if (child != NO_NODE)
+				walk_push(&walk, child);
+		} else {
+			node_index_t result = v->node;
+			if (n->type == EXPRESSION)
+				result = algebra_simplify(result);
+			walk.height -= 1;
+			if (walk.height > 0) {
+				visit_t *parent = WALK_TOP(&walk);
+				NODE(parent->node)->children[parent->step - 1] = result;
+			}
+		}
+	}
+	walk_finalize(&walk);
+}
+
+
+uint32_t
+algebra_rewrites(int32_t verbosity) {
+	uint32_t total = 0;
+	for (uint32_t r = 0; r < N_RULES; r++) {
+		if (verbosity > 1)
+			fprintf(stderr, "simplify: %s rewrote %u\n",
+			        rules[r].name, rewrites[r]);
+		total += rewrites[r];
+	}
+	return total;
+}
@@ -0,0 +1,855 @@
+#include <csource.h>
+
+
+/*
+ * Translation to C99. Functions become C functions, named f_ and their
+ * name, and variables C locals, named v_, their name and a number which
+ * tells apart the ones inlining may have made with the same name. Blocks
+ * are blocks of C, with their declarations at the top, and arrays are
+ * arrays of int32_t the size they were declared. The arithmetic goes
+ * through small inline functions which do what the native code does:
+ * wrap around, trap on division by 0, and take powers like its loop.
+ * PRINT goes through the same calls to stdio as well.
+ *
+ * VSL has no types, but C does: a variable, parameter or function holds
+ * either numbers or arrays, and which is worked out by unification over
+ * classes of them. Arrays are what is declared as one or indexed, numbers
+ * what is computed with or printed, and assignments, arguments and
+ * RETURN make their two sides the same. Whatever is left open is a
+ * number.
+ *
+ * C leaves the order operands are evaluated in open, where the native
+ * code goes from left to right. That only shows when more than one
+ * operand has side effects (or traps, or reads an array), so all of those
+ * but the last are computed into temporaries first, with the comma
+ * operator, as in (t_9_0 = f(x), add(t_9_0, g(y))).
+ *
+ * What a function which runs off its end returns is the result, which
+ * stands for what the native code has in %eax at the end of a statement:
+ * the value last assigned or tested, or what putchar returned for the end
+ * of a line. Only functions which can get there keep it.
+ *
+ * CONTINUE goes back to the loop started last in the code, as in the
+ * generated code. That is a plain continue when it is the loop the
+ * CONTINUE is in, and a goto to a label before it when it isn't.
+ */
+
+enum { KIND_UNKNOWN, KIND_INTEGER, KIND_ARRAY };
+
+/*
+ * The kinds of variables and functions, as classes which are merged as
+ * they are found to be the same. The first ones are the functions, by
+ * index, and variables get theirs in the vreg of their symbol (there are
+ * no registers to allocate here). The kind of an expression is the class
+ * it shares, or minus its kind if it has one of its own.
+ */
+typedef struct {
+	int32_t parent;
+	uint8_t kind;
+	bool fixed;             /* Declared as an array, which C can't assign to */
+	const char *name;
+} class_t;
+
+static class_t *classes = NULL;
+static uint32_t classes_count = 0, classes_size = 0;
+
+/* Loops by number, from 1, and those CONTINUE goes to from outside */
+static bool *labelled = NULL;
+static uint32_t loops_count = 0, loops_size = 0;
+
+/* FUNCTION nodes, in the order of their symbols' index */
+static node_index_t *functions = NULL;
+
+/* The function being worked on, and whether it keeps its result */
+static symbol_t *function = NULL;
+static bool keeps_result = false;
+
+/* Levels of blocks the statement being written is in */
+static int32_t level = 0;
+
+#define VISIT_DONE UINT32_MAX
+
+
+static void *
+grow(void *vector, uint32_t *size, uint32_t count, size_t element) {
+	if (count < *size)
+		return vector;
+	*size = (*size == 0) ? 256 : 2 * *size;
+	vector = realloc(vector, *size * element);
+	if (vector == NULL) {
+		fprintf(stderr, "Out of memory for writing C\n");
+		exit(EXIT_FAILURE);
+	}
+	return vector;
+}
+
+
+static int32_t
+class_new(const char *name, uint8_t kind, bool fixed) {
+	classes = grow(classes, &classes_size, classes_count, sizeof(class_t));
+	classes[classes_count] = (class_t) {
+		.parent = classes_count, .kind = kind, .fixed = fixed, .name = name
+	};
+	return classes_count++;
+}
+
+
+static int32_t
+class_find(int32_t c) {
+	while (classes[c].parent != c) {
+		classes[c].parent = classes[classes[c].parent].parent;
+		c = classes[c].parent;
+	}
+	return c;
+}
+
+
+static void
+kind_conflict(const char *name) {
+	fprintf(stderr, "Error: '%s' holds both numbers and arrays, which "
+	        "C can't do\n", name);
+	exit(EXIT_FAILURE);
+}
+
+
+/* Make two kinds of expressions the same */
+static void
+unify(int32_t a, int32_t b) {
+	if (a < 0 && b < 0) {
+		if (a != b)
+			kind_conflict("an expression");
+		return;
+	}
+	if (a < 0) {
+		int32_t t = a;
+		a = b, b = t;
+	}
+	a = class_find(a);
+	if (b < 0) {
+		if (classes[a].kind == KIND_UNKNOWN)
+			classes[a].kind = -b;
+		else if (classes[a].kind != -b)
+			kind_conflict(classes[a].name);
+		return;
+	}
+	b = class_find(b);
+	if (a == b)
+		return;
+	if (classes[a].kind != KIND_UNKNOWN && classes[b].kind != KIND_UNKNOWN &&
+	        classes[a].kind != classes[b].kind)
+		kind_conflict(classes[a].name);
+	if (classes[a].kind == KIND_UNKNOWN)
+		classes[a].kind = classes[b].kind;
+	classes[b].parent = a;
+}
+
+
+static symbol_t *
+variable(node_index_t v) {
+	symbol_t *entry = NODE(v)->entry;
+	if (entry->label != NULL) {
+		fprintf(stderr, "Error: function '%s' is used as a variable\n",
+		        entry->label);
+		exit(EXIT_FAILURE);
+	}
+	return entry;
+}
+
+
+static symbol_t *
+callee(node_index_t call) {
+	node_t *n = NODE(call);
+	symbol_t *entry = NODE(n->children[0])->entry;
+	int32_t args = (n->children[1] == NO_NODE) ?
+	               0 : NODE(n->children[1])->n_children;
+	if (entry->label == NULL) {
+		fprintf(stderr, "Error: '%s' is not a function\n",
+		        ident_text(NODE(n->children[0])->value));
+		exit(EXIT_FAILURE);
+	}
+	if (entry->n_args != args) {
+		fprintf(stderr,
+		        "Error: function '%s' expects %d arguments, "
+		        "but is called with %d.\n",
+		        entry->label, entry->n_args, args);
+		exit(EXIT_FAILURE);
+	}
+	return entry;
+}
+
+
+static int32_t
+kind_of(node_index_t e) {
+	node_t *n = NODE(e);
+	if (n->type == VARIABLE)
+		return variable(e)->vreg;
+	if (n->type == EXPRESSION && n->op == OP_CALL)
+		return callee(e)->index;
+	return -KIND_INTEGER;
+}
+
+
+/* The kind of a class or an expression, once they are all worked out */
+static uint8_t
+resolved(int32_t k) {
+	if (k < 0)
+		return -k;
+	k = class_find(k);
+	return (classes[k].kind == KIND_UNKNOWN) ? KIND_INTEGER : classes[k].kind;
+}
+
+
+static uint8_t
+kind(node_index_t e) {
+	return resolved(kind_of(e));
+}
+
+
+/* Could the function run off its end, without a RETURN? */
+static bool
+runs_off(node_index_t f) {
+	node_index_t body = NODE(f)->children[2];
+	if (NODE(body)->type == BLOCK) {
+		node_t *list = NODE(NODE(body)->children[1]);
+		body = list->children[list->n_children - 1];
+	}
+	return NODE(body)->type != RETURN_STATEMENT;
+}
+
+
+static void
+analyse_enter(visit_t *v, uint32_t *innermost, uint32_t *latest,
+              symbol_t **latest_in) {
+	node_t *n = NODE(v->node);
+	switch (n->type) {
+	case FUNCTION:
+		function = NODE(n->children[0])->entry;
+		if (runs_off(v->node))
+			unify(function->index, -KIND_INTEGER);
+		break;
+
+	case DECLARATION: {
+		node_t *names = NODE(n->children[0]);
+		for (uint32_t i = 0; i < names->n_children; i++) {
+			node_t *var = NODE(names->children[i]);
+			bool array = (var->n_children > 0);
+			var->entry->vreg = class_new(ident_text(var->value),
+			                             array ? KIND_ARRAY : KIND_UNKNOWN, array);
+		}
+		break;
+	}
+
+	case WHILE_STATEMENT:
+		labelled = grow(labelled, &loops_size, loops_count + 1, sizeof(bool));
+		n->value = ++loops_count;
+		labelled[n->value] = false;
+		v->aux = *innermost;
+		*innermost = *latest = n->value;
+		*latest_in = function;
+		unify(kind_of(n->children[0]), -KIND_INTEGER);
+		break;
+
+	case NULL_STATEMENT:
+		if (*latest == 0 || *latest_in != function) {
+			fprintf(stderr, "Error: CONTINUE outside of a loop in '%s', "
+			        "which C can't do\n", function->label);
+			exit(EXIT_FAILURE);
+		}
+		n->value = (*latest == *innermost) ? 0 : *latest;
+		if (n->value != 0)
+			labelled[n->value] = true;
+		break;
+
+	case IF_STATEMENT:
+		unify(kind_of(n->children[0]), -KIND_INTEGER);
+		break;
+
+	case PRINT_STATEMENT:
+		for (uint32_t i = 0; i < n->n_children; i++)
+			if (NODE(n->children[i])->type != TEXT)
+				unify(kind_of(n->children[i]), -KIND_INTEGER);
+		break;
+
+	case RETURN_STATEMENT:
+		unify(function->index, kind_of(n->children[0]));
+		break;
+
+	case ASSIGNMENT_STATEMENT: {
+		symbol_t *target = variable(n->children[0]);
+		if (n->n_children == 3) {
+			unify(target->vreg, -KIND_ARRAY);
+			unify(kind_of(n->children[1]), -KIND_INTEGER);
+			unify(kind_of(n->children[2]), -KIND_INTEGER);
+		} else {
+			unify(target->vreg, kind_of(n->children[1]));
+			if (classes[target->vreg].fixed) {
+				fprintf(stderr, "Error: array '%s' is assigned to, which "
+				        "C can't do\n", ident_text(NODE(n->children[0])->value));
+				exit(EXIT_FAILURE);
+			}
+		}
+		break;
+	}
+
+	case EXPRESSION:
+		if (n->op == OP_CALL) {
+			symbol_t *f = callee(v->node);
+			node_index_t params = NODE(functions[f->index])->children[1];
+			for (int32_t i = 0; i < f->n_args; i++)
+				unify(kind_of(NODE(n->children[1])->children[i]),
+				      NODE(NODE(params)->children[i])->entry->vreg);
+			break;
+		}
+		if (n->op == OP_INDEX) {
+			unify(kind_of(n->children[0]), -KIND_ARRAY);
+			unify(kind_of(n->children[1]), -KIND_INTEGER);
+		} else {
+			for (uint32_t i = 0; i < n->n_children; i++)
+				unify(kind_of(n->children[i]), -KIND_INTEGER);
+		}
+		break;
+	}
+}
+
+
+/*
+ * Work out the kinds, number the variables and the loops, and find where
+ * CONTINUE goes, in a pre-order traversal like that of bind_names. The
+ * first function gets its arguments from the command line, and exits
+ * with what it returns, so those are numbers.
+ */
+static void
+analyse(node_index_t root) {
+	node_t *list = NODE(NODE(root)->children[0]);
+	for (uint32_t f = 0; f < list->n_children; f++)
+		class_new(NODE(NODE(functions[f])->children[0])->entry->label,
+		          KIND_UNKNOWN, false);
+	for (uint32_t f = 0; f < list->n_children; f++) {
+		node_index_t params = NODE(functions[f])->children[1];
+		for (uint32_t i = 0; params != NO_NODE && i < NODE(params)->n_children; i++) {
+			node_t *param = NODE(NODE(params)->children[i]);
+			param->entry->vreg = class_new(ident_text(param->value),
+			                               f == 0 ? KIND_INTEGER : KIND_UNKNOWN,
+			                               false);
+		}
+	}
+	unify(0, -KIND_INTEGER);
+
+	uint32_t innermost = 0, latest = 0;
+	symbol_t *latest_in = NULL;
+	walk_t walk = { NULL, 0, 0 };
+	walk_push(&walk, root);
+	while (walk.height > 0) {
+		visit_t *v = WALK_TOP(&walk);
+		node_t *n = NODE(v->node);
+		if (v->step == 0)
+			analyse_enter(v, &innermost, &latest, &latest_in);
+		uint32_t first = (n->type == FUNCTION) ? 2 : 0;
+		if (first + v->step < n->n_children) {
+			node_index_t child = n->children[first + v->step++];
+			if (child != NO_NODE)
+				walk_push(&walk, child);
+		} else {
+			if (n->type == WHILE_STATEMENT)
+				innermost = v->aux;
+			walk.height -= 1;
+		}
+	}
+	walk_finalize(&walk);
+}
+
+
+static bool
+pure(node_index_t e) {
+	node_t *n = NODE(e);
+	return n->type == INTEGER || n->type == VARIABLE ||
+	       (n->type == EXPRESSION && n->pure);
+}
+
+
+/* The operands of what is written as one C expression, in order */
+static node_index_t *
+operands(node_t *n, uint32_t *count) {
+	if (n->type == ASSIGNMENT_STATEMENT) {
+		*count = 2;
+		return n->children + 1;
+	}
+	if (n->op == OP_CALL) {
+		node_index_t args = n->children[1];
+		*count = (args == NO_NODE) ? 0 : NODE(args)->n_children;
+		return (args == NO_NODE) ? NULL : NODE(args)->children;
+	}
+	*count = n->n_children;
+	return n->children;
+}
+
+
+/* Is an operand computed into a temporary before the rest (see above)? */
+static bool
+hoisted(node_index_t *ops, uint32_t count, uint32_t j) {
+	if (pure(ops[j]))
+		return false;
+	for (uint32_t k = j + 1; k < count; k++)
+		if (!pure(ops[k]))
+			return true;
+	return false;
+}
+
+
+static void
+indent(FILE *out) {
+	for (int32_t i = 0; i < level && i < CSOURCE_INDENT_MAX; i++)
+		fputc('\t', out);
+}
+
+
+static void
+write_name(FILE *out, node_index_t v) {
+	fprintf(out, "v_%s_%d", ident_text(NODE(v)->value), NODE(v)->entry->vreg);
+}
+
+
+/* The type a declaration starts with, for each kind */
+static const char *types[] = {
+	[KIND_INTEGER] = "int32_t ", [KIND_ARRAY] = "int32_t *"
+};
+
+
+/* A string as a C literal, up to its first 0 as fputs sees it */
+static void
+write_string(FILE *out, int32_t index) {
+	char *text = strings_get(index);
+	char *bytes = malloc(strlen(text));
+	strings_decode(text, bytes);
+	fputc('"', out);
+	for (uint8_t *c = (uint8_t *) bytes; *c != '\0'; c++) {
+		if (*c == '\\' || *c == '"' || *c == '?')
+			fprintf(out, "\\%c", *c);
+		else if (*c >= 0x20 && *c < 0x7F)
+			fputc(*c, out);
+		else
+			fprintf(out, "\\%03o", *c);
+	}
+	fputc('"', out);
+	free(bytes);
+}
+
+
+/* Temporaries the body of the function needs, at the top of it */
+static void
+write_temporaries(FILE *out, node_index_t body) {
+	walk_t walk = { NULL, 0, 0 };
+	walk_push(&walk, body);
+	while (walk.height > 0) {
+		node_index_t node = WALK_TOP(&walk)->node;
+		node_t *n = NODE(node);
+		walk.height -= 1;
+		if (n->type == EXPRESSION ||
+		        (n->type == ASSIGNMENT_STATEMENT && n->n_children == 3)) {
+			uint32_t count;
+			node_index_t *ops = operands(n, &count);
+			for (uint32_t j = 0; j < count; j++)
+				if (hoisted(ops, count, j))
+					fprintf(out, "\t%st_%u_%u;\n", types[kind(ops[j])], node, j);
+		}
+		for (uint32_t i = 0; i < n->n_children; i++)
+			if (n->children[i] != NO_NODE)
+				walk_push(&walk, n->children[i]);
+	}
+	walk_finalize(&walk);
+}
+
+
+/* What goes before operand j of an operation, or after the last */
+static void
+write_piece(FILE *out, node_t *n, uint32_t j, uint32_t count) {
+	static const char *helpers[] = {
+		[OP_ADD] = "add", [OP_SUB] = "subtract", [OP_MUL] = "multiply",
+		[OP_DIV] = "divide", [OP_POW] = "power", [OP_NEG] = "negate"
+	};
+	bool assignment = (n->type == ASSIGNMENT_STATEMENT);
+	if (j == 0) {
+		if (assignment) {
+			write_name(out, n->children[0]);
+			fputc('[', out);
+		} else if (n->op == OP_CALL) {
+			fprintf(out, "f_%s(", NODE(n->children[0])->entry->label);
+		} else if (n->op != OP_INDEX && n->op != OP_NONE) {
+			fprintf(out, "%s(", helpers[n->op]);
+		}
+	}
+	if (j > 0 && j < count)
+		fputs(assignment ? "] = " : (n->op == OP_INDEX) ? "[" : ", ", out);
+	if (j == count && !assignment && n->op != OP_NONE)
+		fputc((n->op == OP_INDEX) ? ']' : ')', out);
+}
+
+
+/*
+ * The next step of writing an operation, which is an expression or an
+ * assignment to an array element: first the operands which go into
+ * temporaries (steps up to the number of operands), then the operation.
+ */
+static node_index_t
+write_operation(FILE *out, visit_t *v, uint32_t step) {
+	node_t *n = NODE(v->node);
+	uint32_t count;
+	node_index_t *ops = operands(n, &count);
+	if (step == 0 && n->type == ASSIGNMENT_STATEMENT) {
+		indent(out);
+		if (keeps_result)
+			fputs("result = ", out);
+	}
+	if (step < count) {
+		if (step > 0 && hoisted(ops, count, step - 1))
+			fputs(", ", out);
+		if (!hoisted(ops, count, step))
+			return NO_NODE;
+		fprintf(out, "(t_%u_%u = ", v->node, step);
+		return ops[step];
+	}
+
+	uint32_t j = step - count;
+	write_piece(out, n, j, count);
+	if (j < count) {
+		if (!hoisted(ops, count, j))
+			return ops[j];
+		fprintf(out, "t_%u_%u", v->node, j);
+		return NO_NODE;
+	}
+	for (uint32_t k = 0; k < count; k++)
+		if (hoisted(ops, count, k))
+			fputc(')', out);
+	if (n->type == ASSIGNMENT_STATEMENT)
+		fputs(";\n", out);
+	v->step = VISIT_DONE;
+	return NO_NODE;
+}
+
+
+/*
+ * Write the next step of a visit to a node of a function body, and return
+ * the child to write before the step after that (if any). A block which
+ * is the body of a function, IF or WHILE shares its braces.
+ */
+static node_index_t
+write_node(FILE *out, visit_t *v, visit_t *parent) {
+	node_t *n = NODE(v->node);
+	uint32_t step = v->step++;
+	switch (n->type) {
+	case BLOCK: {
+		bool braced = (parent == NULL) ||
+		              NODE(parent->node)->type == IF_STATEMENT ||
+		              NODE(parent->node)->type == WHILE_STATEMENT;
+		if (step == 0 && !braced) {
+			indent(out);
+			fputs("{\n", out);
+			level += 1;
+		}
+		if (step < 2)
+			return n->children[step];
+		if (!braced) {
+			level -= 1;
+			indent(out);
+			fputs("}\n", out);
+		}
+		break;
+	}
+
+	case DECLARATION: {
+		node_t *names = NODE(n->children[0]);
+		for (uint32_t i = 0; i < names->n_children; i++) {
+			node_t *var = NODE(names->children[i]);
+			indent(out);
+			if (var->n_children > 0) {
+				int32_t size = NODE(var->children[0])->value;
+				fputs("int32_t ", out);
+				write_name(out, names->children[i]);
+				fprintf(out, "[%d] = { 0 };\n", (size > 0) ? size : 1);
+			} else {
+				fputs(types[resolved(var->entry->vreg)], out);
+				write_name(out, names->children[i]);
+				fputs(" = 0;\n", out);
+			}
+		}
+		break;
+	}
+
+	case ASSIGNMENT_STATEMENT:
+		if (n->n_children == 3)
+			return write_operation(out, v, step);
+		if (step == 0) {
+			indent(out);
+			if (keeps_result && kind(n->children[0]) == KIND_INTEGER)
+				fputs("result = ", out);
+			write_name(out, n->children[0]);
+			fputs(" = ", out);
+			return n->children[1];
+		}
+		fputs(";\n", out);
+		break;
+
+	case RETURN_STATEMENT:
+		if (step == 0) {
+			indent(out);
+			fputs("return ", out);
+			return n->children[0];
+		}
+		fputs(";\n", out);
+		break;
+
+	case PRINT_STATEMENT:
+		/* Two steps per item: write it, then finish the call */
+		if (step / 2 < n->n_children) {
+			node_index_t item = n->children[step / 2];
+			if (NODE(item)->type == TEXT) {
+				indent(out);
+				fputs("print_text(", out);
+				write_string(out, NODE(item)->value);
+				fputs(");\n", out);
+				v->step += 1;
+			} else if (step % 2 == 0) {
+				indent(out);
+				fputs("print_integer(", out);
+				return item;
+			} else {
+				fputs(");\n", out);
+			}
+			return NO_NODE;
+		}
+		indent(out);
+		fputs(keeps_result ? "result = putchar('\\n');\n" : "putchar('\\n');\n",
+		      out);
+		break;
+
+	case IF_STATEMENT:
+		switch (step) {
+		case 0:
+			indent(out);
+			fputs(keeps_result ? "if ((result = " : "if (", out);
+			return n->children[0];
+		case 1:
+			fputs(keeps_result ? ")) {\n" : ") {\n", out);
+			level += 1;
+			return n->children[1];
+		case 2:
+			level -= 1;
+			indent(out);
+			if (n->n_children == 3) {
+				fputs("} else {\n", out);
+				level += 1;
+				return n->children[2];
+			}
+			fputs("}\n", out);
+			break;
+		default:
+			level -= 1;
+			indent(out);
+			fputs("}\n", out);
+			break;
+		}
+		break;
+
+	case WHILE_STATEMENT:
+		switch (step) {
+		case 0:
+			if (labelled[n->value])
+				fprintf(out, "loop_%d:\n", n->value);
+			indent(out);
+			fputs(keeps_result ? "while ((result = " : "while (", out);
+			return n->children[0];
+		case 1:
+			fputs(keeps_result ? ")) {\n" : ") {\n", out);
+			level += 1;
+			return n->children[1];
+		default:
+			level -= 1;
+			indent(out);
+			fputs("}\n", out);
+			break;
+		}
+		break;
+
+	case NULL_STATEMENT:
+		indent(out);
+		if (n->value != 0)
+			fprintf(out, "goto loop_%d;\n", n->value);
+		else
+			fputs("continue;\n", out);
+		break;
+
+	case EXPRESSION:
+		return write_operation(out, v, step);
+
+	case VARIABLE:
+		write_name(out, v->node);
+		break;
+
+	case INTEGER:
+		if (n->value == INT32_MIN)
+			fputs("INT32_MIN", out);
+		else
+			fprintf(out, "%d", n->value);
+		break;
+
+	default:
+		if (step < n->n_children)
+			return n->children[step];
+		break;
+	}
+	v->step = VISIT_DONE;
+	return NO_NODE;
+}
+
+
+/* The head of a function, up to where its body starts */
+static void
+write_head(FILE *out, node_index_t f, bool definition) {
+	symbol_t *entry = NODE(NODE(f)->children[0])->entry;
+	node_index_t params = NODE(f)->children[1];
+	fprintf(out, "static int32_t%s%sf_%s(",
+	        (resolved(entry->index) == KIND_ARRAY) ? " *" : "",
+	        definition ? "\n" : " ", entry->label);
+	if (entry->n_args == 0)
+		fputs("void", out);
+	for (int32_t i = 0; i < entry->n_args; i++) {
+		node_index_t param = NODE(params)->children[i];
+		if (i > 0)
+			fputs(", ", out);
+		fputs(types[resolved(NODE(param)->entry->vreg)], out);
+		write_name(out, param);
+	}
+	fputs(definition ? ") {\n" : ");\n", out);
+}
+
+
+/* What the code of every program starts with */
+static const char *prelude =
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <stdint.h>\n"
+    "#include <signal.h>\n"
+    "\n"
+    "static inline int32_t\n"
+    "add(int32_t a, int32_t b) {\n"
+    "\treturn (int32_t) ((uint32_t) a + (uint32_t) b);\n"
+    "}\n"
+    "\n"
+    "static inline int32_t\n"
+    "subtract(int32_t a, int32_t b) {\n"
+    "\treturn (int32_t) ((uint32_t) a - (uint32_t) b);\n"
+    "}\n"
+    "\n"
+    "static inline int32_t\n"
+    "multiply(int32_t a, int32_t b) {\n"
+    "\treturn (int32_t) ((uint32_t) a * (uint32_t) b);\n"
+    "}\n"
+    "\n"
+    "static inline int32_t\n"
+    "negate(int32_t a) {\n"
+    "\treturn (int32_t) (0u - (uint32_t) a);\n"
+    "}\n"
+    "\n"
+    "/* Dividing by 0 or overflowing traps, as idiv does */\n"
+    "static inline int32_t\n"
+    "divide(int32_t a, int32_t b) {\n"
+    "\tif (b == 0 || (a == INT32_MIN && b == -1)) {\n"
+    "\t\traise(SIGFPE);\n"
+    "\t\texit(EXIT_FAILURE);\n"
+    "\t}\n"
+    "\treturn a / b;\n"
+    "}\n"
+    "\n"
+    "static inline int32_t\n"
+    "power(int32_t base, int32_t exponent) {\n"
+    "\tif (base == 1)\n"
+    "\t\treturn 1;\n"
+    "\tif (exponent < 0)\n"
+    "\t\treturn 0;\n"
+    "\tuint32_t result = 1, square = (uint32_t) base;\n"
+    "\tfor (uint32_t e = (uint32_t) exponent; e > 0; e >>= 1) {\n"
+    "\t\tif (e & 1)\n"
+    "\t\t\tresult *= square;\n"
+    "\t\tsquare *= square;\n"
+    "\t}\n"
+    "\treturn (int32_t) result;\n"
+    "}\n"
+    "\n"
+    "static inline void\n"
+    "print_text(const char *text) {\n"
+    "\tfputs(text, stdout);\n"
+    "\tputchar(' ');\n"
+    "}\n"
+    "\n"
+    "static inline void\n"
+    "print_integer(int32_t value) {\n"
+    "\tprintf(\"%d \", (int) value);\n"
+    "}\n"
+    "\n"
+    "/* The parameters of the first function are the last arguments */\n"
+    "static inline int32_t\n"
+    "argument(int argc, char **argv, int from_end) {\n"
+    "\tif (argc - from_end < 1)\n"
+    "\t\treturn 0;\n"
+    "\treturn (int32_t) strtol(argv[argc - from_end], NULL, 10);\n"
+    "}\n"
+    "\n";
+
+
+void
+csource_write(FILE *stream, node_index_t root) {
+	if (root == NO_NODE)
+		return;
+	node_t *list = NODE(NODE(root)->children[0]);
+	functions = list->children;
+	analyse(root);
+
+	fputs(prelude, stream);
+	for (uint32_t f = 0; f < list->n_children; f++)
+		write_head(stream, functions[f], false);
+
+	walk_t walk = { NULL, 0, 0 };
+	for (uint32_t f = 0; f < list->n_children; f++) {
+		node_index_t body = NODE(functions[f])->children[2];
+		function = NODE(NODE(functions[f])->children[0])->entry;
+		keeps_result = runs_off(functions[f]);
+		fputc('\n', stream);
+		fputc('\n', stream);
+		write_head(stream, functions[f], true);
+		write_temporaries(stream, body);
+		if (keeps_result)
+			fputs("\tint32_t result = 0;\n", stream);
+
+		level = 1;
+		walk_push(&walk, body);
+		while (walk.height > 0) {
+			visit_t *v = WALK_TOP(&walk);
+			if (v->step == VISIT_DONE) {
+				walk.height -= 1;
+				continue;
+			}
+			visit_t *parent = (walk.height > 1) ? v - 1 : NULL;
+			node_index_t next = write_node(stream, v, parent);
+			if (next != NO_NODE)
+				walk_push(&walk, next);
+		}
+		if (keeps_result)
+			fputs("\treturn result;\n", stream);
+		fputs("}\n", stream);
+	}
+	walk_finalize(&walk);
+
+	/* The program runs the first function, and exits with its value */
+	symbol_t *first = NODE(NODE(functions[0])->children[0])->entry;
+	fprintf(stream, "\n\nint\nmain(int argc, char **argv) {\n\texit(f_%s(",
+	        first->label);
+	for (int32_t i = 0; i < first->n_args; i++)
+		fprintf(stream, "%sargument(argc, argv, %d)", (i > 0) ? ", " : "",
+		        first->n_args - i);
+	fputs("));\n}\n", stream);
+
+	free(classes);
+	free(labelled);
+	classes = NULL, classes_count = classes_size = 0;
+	labelled = NULL, loops_count = loops_size = 0;
+}
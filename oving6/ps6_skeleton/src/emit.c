@@ -0,0 +1,238 @@
+#include <emit.h>
+#include <errno.h>
+
+
+#define EMIT_BUFFER (1 << 20)
+
+static char buffer[EMIT_BUFFER];
+static size_t fill = 0;
+static int output = -1;
+
+
+/* Write out a run of text, however many calls it takes */
+static void
+write_all(const char *text, size_t length) {
+	while (length > 0) {
+		ssize_t n = write(output, text, length);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Could not write output");
+			exit(EXIT_FAILURE);
+		}
+		text += n, length -= n;
+	}
+}
+
+
+static void
+emit_flush(void) {
+	write_all(buffer, fill);
+	fill = 0;
+}
+
+
+void
+emit_open(int fd) {
+	output = fd;
+	fill = 0;
+}
+
+
+void
+emit_close(void) {
+	emit_flush();
+	output = -1;
+}
+
+
+void
+emit_bytes(const char *text, size_t length) {
+	if (fill + length > EMIT_BUFFER) {
+		emit_flush();
+		/* Anything bigger than the buffer goes straight out */
+		if (length > EMIT_BUFFER) {
+			write_all(text, length);
+			return;
+		}
+	}
+	memcpy(buffer + fill, text, length);
+	fill += length;
+}
+
+
+void
+emit_str(const char *text) {
+	emit_bytes(text, strlen(text));
+}
+
+
+void
+emit_char(char c) {
+	if (fill == EMIT_BUFFER)
+		emit_flush();
+	buffer[fill++] = c;
+}
+
+
+/*
+ * Decimal digits are produced back to front in a small scratch buffer.
+ * The magnitude is taken as unsigned, so that INT32_MIN comes out right.
+ */
+void
+emit_int(int32_t value) {
+	char digits[11];
+	char *d = digits + sizeof(digits);
+	uint32_t magnitude = (value < 0) ? -(uint32_t)value : (uint32_t)value;
+	do {
+		*--d = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude > 0);
+	if (value < 0)
+		emit_char('-');
+	emit_bytes(d, digits + sizeof(digits) - d);
+}
+
+
+/*
+ * Mnemonics with the surrounding whitespace: everything that goes on a
+ * line before the first operand.
+ */
+#define MNEMONIC(m) { m, sizeof(m) - 1 }
+static const struct {
+	const char *text;
+	size_t length;
+} mnemonics[] = {
+	[CDQ] = MNEMONIC("\tcdq"), [LEAVE] = MNEMONIC("\tleave"),
+	[RET] = MNEMONIC("\tret"),
+	[PUSH] = MNEMONIC("\tpushl\t"), [POP] = MNEMONIC("\tpopl\t"),
+	[MUL] = MNEMONIC("\timull\t"), [DIV] = MNEMONIC("\tidivl\t"),
+	[DEC] = MNEMONIC("\tdecl\t"), [NEG] = MNEMONIC("\tnegl\t"),
+	[CMPZERO] = MNEMONIC("\tcmpl\t$0,"),
+	[CALL] = MNEMONIC("\tcall\t"), [JUMP] = MNEMONIC("\tjmp\t"),
+	[JUMPLESS] = MNEMONIC("\tjl\t"), [JUMPZERO] = MNEMONIC("\tjz\t"),
+	[JUMPNONZ] = MNEMONIC("\tjnz\t"),
+	[MOVE] = MNEMONIC("\tmovl\t"), [ADD] = MNEMONIC("\taddl\t"),
+	[SUB] = MNEMONIC("\tsubl\t"), [CMP] = MNEMONIC("\tcmpl\t"),
+	[LSHIFT] = MNEMONIC("\tshl\t"), [RSHIFT] = MNEMONIC("\tsarl\t"),
+	[URSHIFT] = MNEMONIC("\tshrl\t"), [IMUL] = MNEMONIC("\timull\t"),
+	[TEST] = MNEMONIC("\ttestl\t"), [LEA] = MNEMONIC("\tleal\t"),
+	[AND] = MNEMONIC("\tandl\t"), [EXTEND] = MNEMONIC("\tmovslq\t")
+}, mnemonics64[] = {
+	[CDQ] = MNEMONIC("\tcqto"), [LEAVE] = MNEMONIC("\tleave"),
+	[RET] = MNEMONIC("\tret"),
+	[PUSH] = MNEMONIC("\tpushq\t"), [POP] = MNEMONIC("\tpopq\t"),
+	[MUL] = MNEMONIC("\timulq\t"), [DIV] = MNEMONIC("\tidivq\t"),
+	[DEC] = MNEMONIC("\tdecq\t"), [NEG] = MNEMONIC("\tnegq\t"),
+	[CMPZERO] = MNEMONIC("\tcmpq\t$0,"),
+	[CALL] = MNEMONIC("\tcall\t"), [JUMP] = MNEMONIC("\tjmp\t"),
+	[JUMPLESS] = MNEMONIC("\tjl\t"), [JUMPZERO] = MNEMONIC("\tjz\t"),
+	[JUMPNONZ] = MNEMONIC("\tjnz\t"),
+	[MOVE] = MNEMONIC("\tmovq\t"), [ADD] = MNEMONIC("\taddq\t"),
+	[SUB] = MNEMONIC("\tsubq\t"), [CMP] = MNEMONIC("\tcmpq\t"),
+	[LSHIFT] = MNEMONIC("\tshlq\t"), [RSHIFT] = MNEMONIC("\tsarq\t"),
+	[URSHIFT] = MNEMONIC("\tshrq\t"), [IMUL] = MNEMONIC("\timulq\t"),
+	[TEST] = MNEMONIC("\ttestq\t"), [LEA] = MNEMONIC("\tleaq\t"),
+	[AND] = MNEMONIC("\tandq\t"), [EXTEND] = MNEMONIC("\tmovslq\t")
+};
+
+
+static void
+label_emit(int32_t label) {
+	label_t *l = &labels[label];
+	if (!l->global)
+		emit_char('_');
+	emit_str(l->name);
+	if (l->number >= 0)
+		emit_int(l->number);
+}
+
+
+static void
+operand_emit(instruction_t *instr, operand_t *o) {
+	const char *name = operand_register(instr, o);
+	switch (o->kind) {
+	case O_REGISTER:
+		emit_bytes(name, 4);
+		break;
+	case O_IMMEDIATE:
+		emit_char('$');
+		emit_int(o->value);
+		break;
+	case O_MEMORY:
+		if (o->value != 0)
+			emit_int(o->value);
+		emit_char('(');
+		emit_bytes(name, 4);
+		emit_char(')');
+		break;
+	case O_VIRTUAL:
+		emit_bytes("%v", 2);
+		emit_int(o->reg);
+		break;
+	case O_VMEMORY:
+		if (o->value != 0)
+			emit_int(o->value);
+		emit_bytes("(%v", 3);
+		emit_int(o->reg);
+		emit_char(')');
+		break;
+	case O_SCALED:
+		emit_char('(');
+		emit_bytes(name, 4);
+		emit_char(',');
+		emit_bytes(name, 4);
+		emit_char(',');
+		emit_int(o->value);
+		emit_char(')');
+		break;
+	case O_VSCALED:
+		emit_bytes("(%v", 3);
+		emit_int(o->reg);
+		emit_bytes(",%v", 3);
+		emit_int(o->reg);
+		emit_char(',');
+		emit_int(o->value);
+		emit_char(')');
+		break;
+	case O_ADDRESS:
+		emit_char('$');
+		/* Fall through */
+	case O_LABEL:
+		label_emit(o->value);
+		if (label_relative(instr, o))
+			emit_bytes("(%rip)", 6);
+		break;
+	}
+}
+
+
+/* Same text as ir_print, without going through stdio */
+void
+ir_emit(void) {
+	for (uint32_t i = 0; i < instructions_count; i++) {
+		instruction_t *instr = &instructions[i];
+		switch (instr->op) {
+		case NIL:
+			break;
+		case LABEL:
+			label_emit(instr->operands[0].value);
+			emit_bytes(":\n", 2);
+			break;
+		default:
+			if (instruction_wide(instr))
+				emit_bytes(mnemonics64[instr->op].text,
+				           mnemonics64[instr->op].length);
+			else
+				emit_bytes(mnemonics[instr->op].text,
+				           mnemonics[instr->op].length);
+			for (uint8_t o = 0; o < opcode_operands[instr->op]; o++) {
+				if (o > 0)
+					emit_char(',');
+				operand_emit(instr, &instr->operands[o]);
+			}
+			emit_char('\n');
+			break;
+		}
+	}
+}
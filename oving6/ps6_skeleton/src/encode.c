@@ -0,0 +1,364 @@
+#include <encode.h>
+
+
+/* The instruction being encoded, and where its label field goes */
+static instruction_t *current = NULL;
+static field_t *field = NULL;
+
+/* The numbers of the registers in machine code */
+static const uint8_t numbers[] = {
+	[EAX] = 0, [ECX] = 1, [EDX] = 2, [EBX] = 3,
+	[ESP] = 4, [EBP] = 5, [ESI] = 6, [EDI] = 7
+};
+
+/* The /digit which picks the operation of a group of opcodes */
+static const uint8_t digits[] = {
+	[ADD] = 0, [AND] = 4, [SUB] = 5, [CMP] = 7,
+	[NEG] = 3, [MUL] = 5, [DIV] = 7,
+	[LSHIFT] = 4, [URSHIFT] = 5, [RSHIFT] = 7
+};
+
+/* Condition codes of the conditional jumps */
+static const uint8_t conditions[] = {
+	[JUMPLESS] = 0xC, [JUMPZERO] = 0x4, [JUMPNONZ] = 0x5
+};
+
+
+static void
+unencodable(void) {
+	fprintf(stderr, "Error: no machine code for opcode %u with operands "
+	        "of kinds %u and %u\n", current->op,
+	        current->operands[0].kind, current->operands[1].kind);
+	exit(EXIT_FAILURE);
+}
+
+
+static bool
+fits_byte(int32_t value) {
+	return value >= -128 && value <= 127;
+}
+
+
+static uint8_t *
+put32(uint8_t *p, int32_t value) {
+	for (int32_t i = 0; i < 32; i += 8)
+		*p++ = (uint32_t) value >> i;
+	return p;
+}
+
+
+/* Room for a reference to a label, 'size' bytes at p */
+static uint8_t *
+label_field(uint8_t *code, uint8_t *p, int32_t label, uint8_t size,
+            bool relative, bool branch) {
+	if (field->size != 0)
+		unencodable();
+	*field = (field_t) {
+		.at = p - code, .size = size, .relative = relative,
+		.branch = branch, .label = label
+	};
+	memset(p, 0, size);
+	return p + size;
+}
+
+
+/*
+ * The ModRM byte naming 'rm' as the register or memory operand, with
+ * 'reg' as the other register (or the digit of a group of opcodes), and
+ * whatever follows it to complete the address.
+ */
+static uint8_t *
+modrm(uint8_t *code, uint8_t *p, uint8_t reg, operand_t *rm) {
+	static const int8_t scales[] = {
+		[1] = 0, [2] = 1, [3] = -1, [4] = 2, [5] = -1, [6] = -1, [7] = -1,
+		[8] = 3
+	};
+	reg <<= 3;
+	switch (rm->kind) {
+	case O_REGISTER:
+		*p++ = 0xC0 | reg | numbers[rm->reg];
+		return p;
+
+	case O_LABEL:
+		/* An absolute address, which on x86-64 means relative to %rip */
+		*p++ = 0x05 | reg;
+		return label_field(code, p, rm->value, 4, x86_64, false);
+
+	case O_SCALED:
+		if (rm->value < 1 || rm->value > 8 || scales[rm->value] < 0 ||
+		        rm->reg == ESP)
+			unencodable();
+		/* %ebp as a base always takes a displacement, here 0 */
+		*p++ = (rm->reg == EBP ? 0x40 : 0x00) | reg | 0x04;
+		*p++ = scales[rm->value] << 6 | numbers[rm->reg] << 3 |
+		         numbers[rm->reg];
+		if (rm->reg == EBP)
+			*p++ = 0;
+		return p;
+
+	case O_MEMORY: {
+		int32_t offset = rm->value;
+		uint8_t mod = (offset == 0 && rm->reg != EBP) ? 0x00 :
+		              fits_byte(offset) ? 0x40 : 0x80;
+		*p++ = mod | reg | numbers[rm->reg];
+		/* %esp as a base needs a SIB byte, with no index */
+		if (rm->reg == ESP)
+			*p++ = 0x24;
+		if (mod == 0x40)
+			*p++ = offset;
+		else if (mod == 0x80)
+			p = put32(p, offset);
+		return p;
+	}
+
+	default:
+		unencodable();
+		return p;
+	}
+}
+
+
+/* A 4-byte immediate, from a constant or the address of a label */
+static uint8_t *
+immediate32(uint8_t *code, uint8_t *p, operand_t *o) {
+	if (o->kind == O_ADDRESS)
+		return label_field(code, p, o->value, 4, false, false);
+	return put32(p, o->value);
+}
+
+
+static bool
+in_memory(operand_t *o) {
+	return o->kind == O_MEMORY || o->kind == O_LABEL;
+}
+
+
+uint8_t
+instruction_encode(instruction_t *instr, bool near, uint8_t *code,
+                   field_t *f) {
+	operand_t *a = &instr->operands[0], *b = &instr->operands[1];
+	uint8_t *p = code;
+	current = instr, field = f;
+	field->size = 0;
+
+	if (instr->op == NIL || instr->op == LABEL)
+		return 0;
+
+	/* REX.W makes an operation 64 bits wide; pushes and pops are anyway */
+	bool rex = x86_64 && (instr->op == EXTEND ||
+	                      (instruction_wide(instr) && instr->op != PUSH &&
+	                       instr->op != POP));
+	if (rex)
+		*p++ = 0x48;
+
+	switch (instr->op) {
+	case CDQ:
+		*p++ = 0x99;
+		break;
+	case LEAVE:
+		*p++ = 0xC9;
+		break;
+	case RET:
+		*p++ = 0xC3;
+		break;
+
+	case PUSH:
+		if (a->kind == O_REGISTER) {
+			*p++ = 0x50 + numbers[a->reg];
+		} else if (a->kind == O_IMMEDIATE && fits_byte(a->value)) {
+			*p++ = 0x6A;
+			*p++ = a->value;
+		} else if (a->kind == O_IMMEDIATE || a->kind == O_ADDRESS) {
+			*p++ = 0x68;
+			p = immediate32(code, p, a);
+		} else {
+			*p++ = 0xFF;
+			p = modrm(code, p, 6, a);
+		}
+		break;
+
+	case POP:
+		if (a->kind == O_REGISTER) {
+			*p++ = 0x58 + numbers[a->reg];
+		} else {
+			*p++ = 0x8F;
+			p = modrm(code, p, 0, a);
+		}
+		break;
+
+	case MUL:
+	case DIV:
+	case NEG:
+		*p++ = 0xF7;
+		p = modrm(code, p, digits[instr->op], a);
+		break;
+
+	case DEC:
+		/* x86-64 took the short forms of dec for REX prefixes */
+		if (a->kind == O_REGISTER && !x86_64) {
+			*p++ = 0x48 + numbers[a->reg];
+		} else {
+			*p++ = 0xFF;
+			p = modrm(code, p, 1, a);
+		}
+		break;
+
+	case CMPZERO:
+		*p++ = 0x83;
+		p = modrm(code, p, 7, a);
+		*p++ = 0;
+		break;
+
+	case CALL:
+		if (a->kind != O_LABEL)
+			unencodable();
+		*p++ = 0xE8;
+		p = label_field(code, p, a->value, 4, true, true);
+		break;
+
+	case JUMP:
+		if (a->kind != O_LABEL)
+			unencodable();
+		*p++ = near ? 0xE9 : 0xEB;
+		p = label_field(code, p, a->value, near ? 4 : 1, true, true);
+		break;
+
+	case JUMPLESS:
+	case JUMPZERO:
+	case JUMPNONZ:
+		if (a->kind != O_LABEL)
+			unencodable();
+		if (near) {
+			*p++ = 0x0F;
+			*p++ = 0x80 | conditions[instr->op];
+		} else {
+			*p++ = 0x70 | conditions[instr->op];
+		}
+		p = label_field(code, p, a->value, near ? 4 : 1, true, true);
+		break;
+
+	case MOVE:
+		if (a->kind == O_REGISTER) {
+			*p++ = 0x89;
+			p = modrm(code, p, numbers[a->reg], b);
+		} else if (b->kind == O_REGISTER && in_memory(a)) {
+			*p++ = 0x8B;
+			p = modrm(code, p, numbers[b->reg], a);
+		} else if (a->kind != O_IMMEDIATE && a->kind != O_ADDRESS) {
+			unencodable();
+		} else if (b->kind == O_REGISTER && !rex) {
+			*p++ = 0xB8 + numbers[b->reg];
+			p = immediate32(code, p, a);
+		} else {
+			/* Sign-extended to 64 bits, when it is wide */
+			*p++ = 0xC7;
+			p = modrm(code, p, 0, b);
+			p = immediate32(code, p, a);
+		}
+		break;
+
+	case ADD:
+	case SUB:
+	case CMP:
+	case AND: {
+		uint8_t base = digits[instr->op] << 3;
+		if (a->kind == O_IMMEDIATE && fits_byte(a->value)) {
+			*p++ = 0x83;
+			p = modrm(code, p, digits[instr->op], b);
+			*p++ = a->value;
+		} else if (a->kind == O_IMMEDIATE || a->kind == O_ADDRESS) {
+			/* There is a shorter form for %eax */
+			if (b->kind == O_REGISTER && b->reg == EAX) {
+				*p++ = base | 0x05;
+			} else {
+				*p++ = 0x81;
+				p = modrm(code, p, digits[instr->op], b);
+			}
+			p = immediate32(code, p, a);
+		} else if (a->kind == O_REGISTER) {
+			*p++ = base | 0x01;
+			p = modrm(code, p, numbers[a->reg], b);
+		} else if (b->kind == O_REGISTER) {
+			*p++ = base | 0x03;
+			p = modrm(code, p, numbers[b->reg], a);
+		} else {
+			unencodable();
+		}
+		break;
+	}
+
+	case LSHIFT:
+	case RSHIFT:
+	case URSHIFT:
+		if (a->kind == O_IMMEDIATE && a->value == 1) {
+			*p++ = 0xD1;
+			p = modrm(code, p, digits[instr->op], b);
+		} else if (a->kind == O_IMMEDIATE) {
+			*p++ = 0xC1;
+			p = modrm(code, p, digits[instr->op], b);
+			*p++ = a->value;
+		} else if (a->kind == O_REGISTER && a->reg == ECX) {
+			/* The count in %cl */
+			*p++ = 0xD3;
+			p = modrm(code, p, digits[instr->op], b);
+		} else {
+			unencodable();
+		}
+		break;
+
+	case IMUL:
+		if (b->kind != O_REGISTER)
+			unencodable();
+		if (a->kind == O_IMMEDIATE) {
+			*p++ = fits_byte(a->value) ? 0x6B : 0x69;
+			p = modrm(code, p, numbers[b->reg], b);
+			if (fits_byte(a->value))
+				*p++ = a->value;
+			else
+				p = put32(p, a->value);
+		} else {
+			*p++ = 0x0F;
+			*p++ = 0xAF;
+			p = modrm(code, p, numbers[b->reg], a);
+		}
+		break;
+
+	case TEST:
+		if (a->kind == O_IMMEDIATE) {
+			if (b->kind == O_REGISTER && b->reg == EAX) {
+				*p++ = 0xA9;
+			} else {
+				*p++ = 0xF7;
+				p = modrm(code, p, 0, b);
+			}
+			p = put32(p, a->value);
+		} else if (a->kind == O_REGISTER) {
+			*p++ = 0x85;
+			p = modrm(code, p, numbers[a->reg], b);
+		} else if (b->kind == O_REGISTER) {
+			*p++ = 0x85;
+			p = modrm(code, p, numbers[b->reg], a);
+		} else {
+			unencodable();
+		}
+		break;
+
+	case LEA:
+		if (b->kind != O_REGISTER || a->kind == O_REGISTER)
+			unencodable();
+		*p++ = 0x8D;
+		p = modrm(code, p, numbers[b->reg], a);
+		break;
+
+	case EXTEND:
+		if (b->kind != O_REGISTER)
+			unencodable();
+		*p++ = 0x63;
+		p = modrm(code, p, numbers[b->reg], a);
+		break;
+
+	default:
+		unencodable();
+	}
+	return p - code;
+}
@@ -0,0 +1,496 @@
+#include <fold.h>
+
+
+/*
+ * Partial evaluation of calls. A function is free of side effects when it
+ * prints nothing, has nothing to do with arrays, and only calls functions
+ * which are free of side effects as well. (It has no CONTINUE either,
+ * since where that goes depends on how the code is laid out.) A call to
+ * such a function, with arguments which are all known, is run by the
+ * interpreter below while compiling, and replaced by the INTEGER it comes
+ * to. Arguments are known when they are integers, or variables which got
+ * an integer earlier on in the same straight line of statements.
+ *
+ * The interpreter does what the generated code would: arithmetic wraps
+ * around, and powers treat base 1 and exponents below 0 like the power
+ * loop does. Anything the program would have to do at run time to find
+ * out about (dividing by 0, falling off the end of a function) makes it
+ * give up, as does running out of fuel or memory, and the call stays.
+ */
+
+/* FUNCTION nodes, in the order of their symbols' index */
+static node_index_t *functions = NULL;
+static bool *pure = NULL;
+
+/*
+ * The interpreter: a stack of visits like the other passes, a stack of
+ * values for expressions, and frames with a word for every parameter and
+ * local at (offset + frame size) / 4, one after the other in memory. A
+ * frame remembers the height of the walk at the call, so RETURN can go
+ * back there.
+ */
+typedef struct {
+	uint32_t base, height;
+	int32_t frame_size;
+} frame_t;
+
+static int32_t *values = NULL;
+static uint32_t values_count = 0, values_size = 0;
+static frame_t *frames = NULL;
+static uint32_t frames_count = 0, frames_size = 0;
+static int32_t *memory = NULL;
+static uint32_t memory_used = 0;
+static uint32_t fuel_left = FOLD_FUEL_TOTAL;
+
+/* Variables known to hold an integer, the latest last */
+#define KNOWN_LIMIT 64
+
+static struct {
+	symbol_t *variable;
+	int32_t value;
+} known[KNOWN_LIMIT];
+static uint32_t known_count = 0;
+
+
+static void *
+grow(void *vector, uint32_t *size, uint32_t count, size_t element) {
+	if (count < *size)
+		return vector;
+	*size = (*size == 0) ? 256 : 2 * *size;
+	vector = realloc(vector, *size * element);
+	if (vector == NULL) {
+		fprintf(stderr, "Out of memory for evaluating calls\n");
+		exit(EXIT_FAILURE);
+	}
+	return vector;
+}
+
+
+static void
+value_push(int32_t value) {
+	values = grow(values, &values_size, values_count, sizeof(int32_t));
+	values[values_count++] = value;
+}
+
+
+static int32_t
+value_pop(void) {
+	return values[--values_count];
+}
+
+
+/* Does a function keep to itself, as far as its own body goes? */
+static bool
+keeps_to_itself(node_index_t function) {
+	bool result = true;
+	walk_t walk = { NULL, 0, 0 };
+	walk_push(&walk, NODE(function)->children[2]);
+	while (walk.height > 0 && result) {
+		node_index_t node = WALK_TOP(&walk)->node;
+		node_t *n = NODE(node);
+		walk.height -= 1;
+		switch (n->type) {
+		case PRINT_STATEMENT:
+		case NULL_STATEMENT:
+			result = false;
+			break;
+		case ASSIGNMENT_STATEMENT:
+			result = (n->n_children == 2);
+			break;
+		case VARIABLE:
+			result = (n->n_children == 0);
+			break;
+		case EXPRESSION:
+			result = (n->op != OP_INDEX) &&
+			         (n->op != OP_CALL || call_callee(node) != NULL);
+			break;
+		}
+		for (uint32_t i = 0; i < n->n_children; i++)
+			if (n->children[i] != NO_NODE)
+				walk_push(&walk, n->children[i]);
+	}
+	walk_finalize(&walk);
+	return result;
+}
+
+
+/* Functions free of side effects are those whose callees all are */
+static void
+find_pure(uint32_t count) {
+	uint32_t *first, *callees;
+	call_lists(count, &first, &callees);
+	for (uint32_t f = 0; f < count; f++)
+		pure[f] = keeps_to_itself(functions[f]);
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (uint32_t f = 0; f < count; f++)
+			for (uint32_t c = first[f]; pure[f] && c < first[f + 1]; c++)
+				if (!pure[callees[c]])
+					pure[f] = false, changed = true;
+	}
+	free(first);
+	free(callees);
+}
+
+
+static int32_t *
+slot(symbol_t *variable) {
+	frame_t *frame = &frames[frames_count - 1];
+	return &memory[frame->base + (variable->stack_offset + frame->frame_size) / 4];
+}
+
+
+/* Start running a function, with its arguments on top of the value stack */
+static bool
+frame_enter(node_index_t function, uint32_t height) {
+	symbol_t *entry = NODE(NODE(function)->children[0])->entry;
+	uint32_t words = (entry->frame_size + 8 + 4 * entry->n_args) / 4;
+	if (memory_used + words > FOLD_MEMORY)
+		return false;
+	frames = grow(frames, &frames_size, frames_count, sizeof(frame_t));
+	frames[frames_count++] = (frame_t) {
+		.base = memory_used, .height = height,
+		 .frame_size = entry->frame_size
+	};
+	memset(&memory[memory_used], 0, words * sizeof(int32_t));
+	memory_used += words;
+
+	node_index_t params = NODE(function)->children[1];
+	for (int32_t i = entry->n_args - 1; i >= 0; i--)
+		*slot(NODE(NODE(params)->children[i])->entry) = value_pop();
+	return true;
+}
+
+
+static int32_t
+power(int32_t base, int32_t exponent) {
+	if (base == 1)
+		return 1;
+	if (exponent < 0)
+		return 0;
+	uint32_t result = 1, square = (uint32_t) base;
+	for (uint32_t e = (uint32_t) exponent; e > 0; e >>= 1) {
+		if (e & 1)
+			result *= square;
+		square *= square;
+	}
+	return (int32_t) result;
+}
+
+
+/* Apply an operator to the values on top of the stack */
+static bool
+operate(operator_t op, uint32_t n_children) {
+	if (n_children == 1) {
+		if (op == OP_NEG)
+			values[values_count - 1] =
+			    (int32_t) (0u - (uint32_t) values[values_count - 1]);
+		return op == OP_NEG || op == OP_NONE;
+	}
+	int32_t b = value_pop(), a = value_pop();
+	switch (op) {
+	case OP_ADD:
+		value_push((int32_t) ((uint32_t) a + (uint32_t) b));
+		return true;
+	case OP_SUB:
+		value_push((int32_t) ((uint32_t) a - (uint32_t) b));
+		return true;
+	case OP_MUL:
+		value_push((int32_t) ((uint32_t) a * (uint32_t) b));
+		return true;
+	case OP_DIV:
+		if (b == 0 || (a == INT32_MIN && b == -1))
+			return false;
+		value_push(a / b);
+		return true;
+	case OP_POW:
+		value_push(power(a, b));
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+/*
+ * Run a function on the arguments on top of the value stack. Each turn
+ * of the loop takes one step of the topmost visit, and costs one unit of
+ * fuel. The body of a function being done with means it fell off the end.
+ */
+static bool
+evaluate(node_index_t function, int32_t *result) {
+	uint32_t fuel = FOLD_FUEL;
+	bool ok = true, done = false;
+	walk_t walk = { NULL, 0, 0 };
+	frames_count = memory_used = 0;
+	ok = frame_enter(function, 0);
+	walk_push(&walk, NODE(function)->children[2]);
+	while (ok && !done) {
+		if (walk.height == frames[frames_count - 1].height || fuel == 0 ||
+		        fuel_left == 0) {
+			ok = false;
+			break;
+		}
+		fuel -= 1, fuel_left -= 1;
+
+		visit_t *v = WALK_TOP(&walk);
+		node_index_t node = v->node;
+		node_t *n = NODE(node);
+		switch (n->type) {
+		case INTEGER:
+			value_push(n->value);
+			walk.height -= 1;
+			break;
+
+		case VARIABLE:
+			ok = (n->entry->label == NULL);
+			if (ok)
+				value_push(*slot(n->entry));
+			walk.height -= 1;
+			break;
+
+		case EXPRESSION:
+			if (n->op == OP_CALL && v->step == 0) {
+				v->step = 1;
+				if (n->children[1] != NO_NODE)
+					walk_push(&walk, n->children[1]);
+			} else if (n->op == OP_CALL) {
+				symbol_t *callee = call_callee(node);
+				int32_t args = (n->children[1] == NO_NODE) ?
+				               0 : NODE(n->children[1])->n_children;
+				ok = callee != NULL && args == callee->n_args &&
+				     frame_enter(functions[callee->index], walk.height);
+				if (ok)
+					walk_push(&walk, NODE(functions[callee->index])->children[2]);
+			} else if (v->step < n->n_children) {
+				walk_push(&walk, n->children[v->step++]);
+			} else {
+				ok = operate(n->op, n->n_children);
+				walk.height -= 1;
+			}
+			break;
+
+		case BLOCK:
+		case STATEMENT_LIST:
+		case DECLARATION_LIST:
+		case EXPRESSION_LIST:
+			if (v->step < n->n_children) {
+				node_index_t child = n->children[v->step++];
+				if (child != NO_NODE)
+					walk_push(&walk, child);
+			} else
+				walk.height -= 1;
+			break;
+
+		case DECLARATION:
+			for (uint32_t i = 0; i < NODE(n->children[0])->n_children; i++)
+				*slot(NODE(NODE(n->children[0])->children[i])->entry) = 0;
+			walk.height -= 1;
+			break;
+
+		case ASSIGNMENT_STATEMENT:
+			if (v->step == 0) {
+				v->step = 1;
+				walk_push(&walk, n->children[1]);
+			} else {
+				ok = (NODE(n->children[0])->entry->label == NULL);
+				if (ok)
+					*slot(NODE(n->children[0])->entry) = value_pop();
+				walk.height -= 1;
+			}
+			break;
+
+		case RETURN_STATEMENT:
+			if (v->step == 0) {
+				v->step = 1;
+				walk_push(&walk, n->children[0]);
+			} else {
+				frame_t frame = frames[--frames_count];
+				memory_used = frame.base;
+				if (frames_count == 0) {
+					*result = value_pop();
+					done = true;
+				} else
+					walk.height = frame.height - 1;
+			}
+			break;
+
+		case IF_STATEMENT:
+			if (v->step == 0) {
+				v->step = 1;
+				walk_push(&walk, n->children[0]);
+			} else if (v->step == 1) {
+				v->step = 2;
+				if (value_pop() != 0)
+					walk_push(&walk, n->children[1]);
+				else if (n->n_children == 3)
+					walk_push(&walk, n->children[2]);
+			} else
+				walk.height -= 1;
+			break;
+
+		case WHILE_STATEMENT:
+			if (v->step == 0) {
+				v->step = 1;
+				walk_push(&walk, n->children[0]);
+			} else if (value_pop() != 0) {
+				v->step = 0;
+				walk_push(&walk, n->children[1]);
+			} else
+				walk.height -= 1;
+			break;
+
+		default:
+			ok = false;
+			break;
+		}
+	}
+	walk_finalize(&walk);
+	return ok;
+}
+
+
+/* Keep track of what a variable holds, as far as is known */
+static void
+learn(symbol_t *variable, bool is_known, int32_t value) {
+	uint32_t k = 0;
+	while (k < known_count && known[k].variable != variable)
+		k += 1;
+	if (k < known_count) {
+		memmove(&known[k], &known[k + 1], (known_count - k - 1) * sizeof(known[0]));
+		known_count -= 1;
+	}
+	if (!is_known)
+		return;
+	if (known_count == KNOWN_LIMIT) {
+		memmove(&known[0], &known[1], (KNOWN_LIMIT - 1) * sizeof(known[0]));
+		known_count -= 1;
+	}
+	known[known_count].variable = variable;
+	known[known_count++].value = value;
+}
+
+
+static bool
+recall(node_index_t e, int32_t *value) {
+	node_t *n = NODE(e);
+	if (n->type == INTEGER) {
+		*value = n->value;
+		return true;
+	}
+	for (uint32_t k = 0; n->type == VARIABLE && k < known_count; k++)
+		if (known[k].variable == n->entry) {
+			*value = known[k].value;
+			return true;
+		}
+	return false;
+}
+
+
+/* Evaluate a call, if it can be, and turn it into its result */
+static bool
+fold_call(node_index_t call, symbol_t *caller, int32_t verbosity) {
+	symbol_t *callee = call_callee(call);
+	node_index_t args = NODE(call)->children[1];
+	int32_t n = (args == NO_NODE) ? 0 : NODE(args)->n_children;
+	if (callee == NULL || !pure[callee->index] || n != callee->n_args)
+		return false;
+
+	values_count = 0;
+	for (int32_t i = 0; i < n; i++) {
+		int32_t value;
+		if (!recall(NODE(args)->children[i], &value))
+			return false;
+		value_push(value);
+	}
+	int32_t result;
+	if (!evaluate(functions[callee->index], &result))
+		return false;
+
+	if (verbosity > 0)
+		fprintf(stderr, "fold: call to %s in %s is %d\n",
+		        callee->label, caller->label, result);
+	node_t *c = NODE(call);
+	calls[c->value].call = NO_NODE;
+	c->type = INTEGER;
+	c->op = OP_NONE;
+	c->value = result;
+	c->n_children = 0;
+	return true;
+}
+
+
+uint32_t
+fold_calls(node_index_t root, int32_t verbosity) {
+	if (root == NO_NODE)
+		return 0;
+	node_t *list = NODE(NODE(root)->children[0]);
+	uint32_t count = list->n_children;
+	functions = malloc(count * sizeof(node_index_t));
+	pure = malloc(count * sizeof(bool));
+	memory = malloc(FOLD_MEMORY * sizeof(int32_t));
+	if (functions == NULL || pure == NULL || memory == NULL) {
+		fprintf(stderr, "Out of memory for evaluating calls\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(functions, list->children, count * sizeof(node_index_t));
+	find_pure(count);
+
+	/*
+	 * Post-order traversal of each function, so arguments are folded
+	 * before the calls they are passed to. What is known about variables
+	 * holds from one statement to the next: it is forgotten at each part
+	 * of an IF or WHILE, which may run any number of times.
+	 */
+	uint32_t folded = 0;
+	walk_t walk = { NULL, 0, 0 };
+	for (uint32_t f = 0; f < count; f++) {
+		symbol_t *caller = NODE(NODE(functions[f])->children[0])->entry;
+		known_count = 0;
+		walk_push(&walk, NODE(functions[f])->children[2]);
+		while (walk.height > 0) {
+			visit_t *v = WALK_TOP(&walk);
+			node_index_t node = v->node;
+			node_t *n = NODE(node);
+			bool branches = (n->type == IF_STATEMENT ||
+			                 n->type == WHILE_STATEMENT);
+			if (v->step < n->n_children) {
+				node_index_t child = n->children[v->step++];
+				if (branches)
+					known_count = 0;
+				if (child != NO_NODE)
+					walk_push(&walk, child);
+				continue;
+			}
+
+			walk.height -= 1;
+			if (branches)
+				known_count = 0;
+			else if (n->type == EXPRESSION && n->op == OP_CALL)
+				folded += fold_call(node, caller, verbosity);
+			else if (n->type == ASSIGNMENT_STATEMENT && n->n_children == 2 &&
+			         NODE(n->children[0])->entry->label == NULL)
+				learn(NODE(n->children[0])->entry,
+				      NODE(n->children[1])->type == INTEGER,
+				      NODE(n->children[1])->value);
+			else if (n->type == DECLARATION) {
+				node_t *names = NODE(n->children[0]);
+				for (uint32_t i = 0; i < names->n_children; i++)
+					learn(NODE(names->children[i])->entry,
+					      NODE(names->children[i])->n_children == 0, 0);
+			}
+		}
+	}
+	walk_finalize(&walk);
+
+	free(functions);
+	free(pure);
+	free(memory);
+	free(values);
+	free(frames);
+	functions = NULL, pure = NULL, memory = NULL;
+	values = NULL, values_count = values_size = 0;
+	frames = NULL, frames_count = frames_size = 0;
+	return folded;
+}
@@ -1,128 +1,18 @@
 #include <tree.h>
 #include <generator.h>
 
-typedef enum {
-    NIL, CDQ, LEAVE, RET,                                // 0-operand
-    LABEL, SYSLABEL,                                     // Text placeholders
-    PUSH, POP, MUL, DIV, DEC, NEG, CMPZERO,              // 1-operand arithmetic
-    CALL, SYSCALL, JUMP, JUMPLESS, JUMPZERO, JUMPNONZ,   // 1-operand ctrlflow
-    MOVE, ADD, SUB, CMP, LSHIFT                          // 2-operand
-} opcode_t;
-
-
-typedef struct i {
-	opcode_t op;
-	char *operands[2];
-	struct i *prev, *next;
-} instruction_t;
-
-
-/* Prototypes for functions to manipulate the instruction list */
-static void instruction_init(instruction_t *instr, opcode_t op, ...);
-static void instruction_append(instruction_t *next);
-static void instruction_finalize(instruction_t *obsolete);
-static void print_instructions(FILE *stream);
-
-
 bool peephole = false;
-static instruction_t *head = NULL, *tail = NULL;
-static int32_t depth = 1;
+bool stdio_emitter = false;
+bool object_file = false;
+bool jit = false;
+int jit_argc = 0;
+char **jit_argv = NULL;
+bool registers = false;
+int32_t verbosity = 0;
 static int32_t power_count = 0;
 static int32_t if_count = 0;
 static int32_t while_count = 0;
-static int32_t while_depth = 0;
-
-static void instruction_init(instruction_t *instr, opcode_t op, ...) {
-	va_list va;
-	va_start(va, op);
-	memset(instr, 0, sizeof(instruction_t));
-	instr->op = op;
-	switch (op) {
-	case NIL:
-	case CDQ:
-	case LEAVE:
-	case RET:
-		break;
-	case SYSLABEL:
-	case SYSCALL:
-	case LABEL:
-	case CALL:
-	case JUMP:
-	case JUMPZERO:
-	case JUMPNONZ:
-	case PUSH:
-	case POP:
-	case MUL:
-	case DIV:
-	case DEC:
-	case NEG:
-	case CMPZERO: {
-		char *ptr = (char *) va_arg(va, char *);
-		instr->operands[0] = STRDUP(ptr);
-	}
-	break;
-	case MOVE:
-	case ADD:
-	case SUB:
-	case CMP:
-	case LSHIFT: {
-		char *ptr_a = (char *) va_arg(va, char *);
-		char *ptr_b = (char *) va_arg(va, char *);
-		instr->operands[0] = STRDUP(ptr_a),
-		                     instr->operands[1] = STRDUP(ptr_b);
-	}
-	break;
-	}
-	va_end(va);
-}
-
-
-static void instruction_append(instruction_t *instr) {
-	instr->prev = tail, instr->next = NULL;
-	tail->next = instr;
-	tail = instr;
-}
-
-
-static void instruction_finalize(instruction_t *obsolete) {
-	switch (obsolete->op) {
-	case SYSLABEL:
-	case SYSCALL:
-	case LABEL:
-	case CALL:
-	case JUMP:
-	case JUMPZERO:
-	case JUMPNONZ:
-	case PUSH:
-	case POP:
-	case MUL:
-	case DIV:
-	case DEC:
-	case NEG:
-	case CMPZERO:
-		free(obsolete->operands[0]);
-		break;
-	case MOVE:
-	case ADD:
-	case SUB:
-	case CMP:
-	case LSHIFT:
-		free(obsolete->operands[0]), free(obsolete->operands[1]);
-		break;
-	}
-	free(obsolete);
-}
-
-
-static void
-free_instructions(void) {
-	instruction_t *i = head, *j;
-	while (i != NULL) {
-		j = i->next;
-		instruction_finalize(i);
-		i = j;
-	}
-}
+static int32_t while_label = 0;
 
 
 /*
@@ -144,484 +34,1493 @@ free_instructions(void) {
 #define OUTFILE EXPAND(stdout)
 
 
-#define INSTR(o,...) do { \
-		instruction_t *i;  \
-		instruction_init ( \
-		                   i = (instruction_t *)malloc(sizeof(instruction_t)), o,##__VA_ARGS__ \
-		                 );\
-		instruction_append ( i ); \
-	} while ( false )
+#define INSTR(o,...) instruction_add ( o,##__VA_ARGS__ )
 
+#define C(n) ((operand_t) { .kind = O_IMMEDIATE, .value = (n) })
+#define R(r) ((operand_t) { .kind = O_REGISTER, .reg = (r) })
+#define RI(r) RO(0,r)
+#define RO(o,r) ((operand_t) { .kind = O_MEMORY, .reg = (r), .value = (o) })
+#define L(l) ((operand_t) { .kind = O_LABEL, .value = (l) })
+#define A(l) ((operand_t) { .kind = O_ADDRESS, .value = (l) })
+#define V(n) ((operand_t) { .kind = O_VIRTUAL, .reg = (n) })
+#define VO(o,n) ((operand_t) { .kind = O_VMEMORY, .reg = (n), .value = (o) })
 
-#define C(r) "$"#r
-#define R(r) "%"#r
-#define RI(r) "(%" #r ")"
-#define RO(o,r) #o "(%" #r ")"
 
-#define RECUR() do {                                \
-		for ( int32_t i=0; i<root->n_children; i++ )    \
-			generate ( stream, root->children[i] );     \
-	} while ( false )
+/*
+ * Labels outside of the VSL program, made first thing by generate so that
+ * their numbers are known in advance.
+ */
+enum {
+	L_MAIN, L_PUSHARG, L_NOARGS, L_INTEGER, L_OUTFILE,
+	L_PRINTF, L_PUTCHAR, L_FPUTS, L_STRTOL, L_EXIT, N_FIXED_LABELS
+};
+
+static const char *fixed_labels[N_FIXED_LABELS] = {
+	[L_MAIN] = "main", [L_PUSHARG] = "pusharg", [L_NOARGS] = "noargs",
+	[L_INTEGER] = ".INTEGER", [L_OUTFILE] = OUTFILE,
+	[L_PRINTF] = "printf", [L_PUTCHAR] = "putchar", [L_FPUTS] = "fputs",
+	[L_STRTOL] = "strtol", [L_EXIT] = "exit"
+};
+
+
+/* Label of the function named by a VARIABLE node */
+static int32_t function_label(node_index_t name) {
+	return label_new(NODE(name)->entry->label, -1, false);
+}
+
+
+/*
+ * A slot in the frame, at an offset laid out by bind_names for words of 4
+ * bytes. Slots on x86-64 hold 8 bytes, at twice the offset.
+ */
+static operand_t frame_at(int32_t offset) {
+	return RO(offset * WORD_SIZE / 4, EBP);
+}
+
 
+/*
+ * Call into the C library. On x86-64, the stack must be aligned to 16
+ * bytes at the call, which the stack machine doesn't keep track of: two
+ * copies of %rsp are pushed, %rsp is rounded down, and the copy which then
+ * sits right above it is moved back into %rsp after the call.
+ */
+static void call_c(int32_t function) {
+	if (x86_64) {
+		INSTR(PUSH, R(ESP));
+		INSTR(PUSH, RI(ESP));
+		INSTR(AND, C(-16), R(ESP));
+	}
+	INSTR(CALL, L(function));
+	if (x86_64)
+		INSTR(MOVE, RO(WORD_SIZE, ESP), R(ESP));
+}
 
 
-void generate(FILE *stream, node_t *root) {
-	if (root == NULL)
+/* %ecx := the address of element %edx of the array at %ecx */
+static void element_address(void) {
+	if (x86_64) {
+		INSTR(EXTEND, R(EDX), R(EDX));
+		INSTR(LSHIFT | WIDE, C(3), R(EDX));
+		INSTR(SUB | WIDE, R(EDX), R(ECX));
+	} else {
+		INSTR(LSHIFT, C(2), R(EDX));
+		INSTR(SUB, R(EDX), R(ECX));
+	}
+}
+
+
+/*
+ * Powers. Constant exponents up to POW_EXPAND_LIMIT are written out as a
+ * row of multiplications, going through the bits of the exponent from the
+ * top: square for every bit, and multiply by the base for every one bit.
+ * Other exponents get a square-and-multiply loop, with the same special
+ * cases as the loop it replaces: base 1 gives 1, exponents below 0 give 0.
+ */
+#define POW_EXPAND_LIMIT 255
+
+static bool power_expands(node_index_t exponent) {
+	return NODE(exponent)->type == INTEGER &&
+	       NODE(exponent)->value >= 0 &&
+	       NODE(exponent)->value <= POW_EXPAND_LIMIT;
+}
+
+
+/* result := base ** exponent, with result a register holding the base */
+static void power_expand(operand_t base, operand_t result, int32_t exponent) {
+	if (exponent == 0) {
+		INSTR(MOVE, C(1), result);
 		return;
+	}
+	int32_t bit = 1;
+	while (bit * 2 <= exponent)
+		bit *= 2;
+	for (bit /= 2; bit > 0; bit /= 2) {
+		INSTR(IMUL, result, result);
+		if (exponent & bit)
+			INSTR(IMUL, base, result);
+	}
+}
+
+
+/*
+ * Multiplication and division by constants. Multiplying turns into leal,
+ * shifts and adds where one or two of them will do, and into imull by the
+ * constant otherwise. Dividing by a power of 2 is an arithmetic shift,
+ * after adding 2^k-1 to negative numbers so the quotient is rounded
+ * towards 0 like idivl does. Other divisors are multiplied by a magic
+ * number (see Hacker's Delight, chapter 10); 0 and -1 are left to idivl,
+ * which traps on them the way it should.
+ */
+static int32_t reducible_constant(node_t *expression) {
+	node_t *a = NODE(expression->children[0]);
+	node_t *b = NODE(expression->children[1]);
+	if (expression->op == OP_DIV)
+		return (b->type == INTEGER && b->value != 0 && b->value != -1) ?
+		       1 : -1;
+	if (expression->op == OP_MUL)
+		return (b->type == INTEGER) ? 1 : (a->type == INTEGER) ? 0 : -1;
+	return -1;
+}
+
+
+/* Position of the highest bit set */
+static int32_t highest_bit(uint32_t m) {
+	int32_t k = 0;
+	while (m > 1)
+		m >>= 1, k += 1;
+	return k;
+}
+
+
+/* x := x * c, with t to spare */
+static void multiply_constant(operand_t x, operand_t t, int32_t c) {
+	uint32_t m = (c < 0) ? -(uint32_t) c : (uint32_t) c, shift = 0;
+	if (m == 0) {
+		INSTR(MOVE, C(0), x);
+		return;
+	}
+	while ((m & 1) == 0)
+		m >>= 1, shift += 1;
+
+	if (m == 1) {
+		/* Just a power of 2 */
+	} else if (m == 3 || m == 5 || m == 9) {
+		operand_t scaled = {
+			.kind = (x.kind == O_VIRTUAL) ? O_VSCALED : O_SCALED,
+			.reg = x.reg, .value = m - 1
+		};
+		INSTR(LEA, scaled, x);
+	} else if (((m - 1) & (m - 2)) == 0) {
+		INSTR(MOVE, x, t);
+		INSTR(LSHIFT, C(highest_bit(m - 1)), t);
+		INSTR(ADD, t, x);
+	} else if (((m + 1) & m) == 0) {
+		INSTR(MOVE, x, t);
+		INSTR(LSHIFT, C(highest_bit(m + 1)), t);
+		INSTR(SUB, x, t);
+		INSTR(MOVE, t, x);
+	} else {
+		INSTR(IMUL, C(c), x);
+		return;
+	}
+	if (shift > 0)
+		INSTR(LSHIFT, C(shift), x);
+	if (c < 0)
+		INSTR(NEG, x);
+}
+
+
+/* The magic number and shift for dividing by d, where |d| > 1 */
+static void divide_magic(int32_t d, int32_t *magic, int32_t *shift) {
+	const uint32_t two31 = 0x80000000u;
+	uint32_t ad = (d < 0) ? -(uint32_t) d : (uint32_t) d;
+	uint32_t t = two31 + ((uint32_t) d >> 31);
+	uint32_t anc = t - 1 - t % ad;
+	uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+	uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad, delta;
+	int32_t p = 31;
+	do {
+		p += 1;
+		q1 *= 2, r1 *= 2;
+		if (r1 >= anc)
+			q1 += 1, r1 -= anc;
+		q2 *= 2, r2 *= 2;
+		if (r2 >= ad)
+			q2 += 1, r2 -= ad;
+		delta = ad - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+	*magic = (int32_t) ((d < 0) ? -(q2 + 1) : q2 + 1);
+	*shift = p - 32;
+}
+
+
+/*
+ * q := x / d, with t to spare, for d other than 0 and -1. The magic
+ * multiplication goes through %eax and %edx, so x can't be in them.
+ */
+static void divide_constant(operand_t x, operand_t q, operand_t t, int32_t d) {
+	uint32_t m = (d < 0) ? -(uint32_t) d : (uint32_t) d;
+	int32_t k = highest_bit(m);
+	if (d == 1) {
+		INSTR(MOVE, x, q);
+	} else if ((m & (m - 1)) == 0) {
+		INSTR(MOVE, x, t);
+		if (k > 1)
+			INSTR(RSHIFT, C(31), t);
+		INSTR(URSHIFT, C(32 - k), t);
+		INSTR(MOVE, x, q);
+		INSTR(ADD, t, q);
+		INSTR(RSHIFT, C(k), q);
+		if (d < 0)
+			INSTR(NEG, q);
+	} else {
+		int32_t magic, shift;
+		divide_magic(d, &magic, &shift);
+		INSTR(MOVE, C(magic), R(EAX));
+		INSTR(MUL, x);
+		INSTR(MOVE, R(EDX), q);
+		if (d > 0 && magic < 0)
+			INSTR(ADD, x, q);
+		else if (d < 0 && magic > 0)
+			INSTR(SUB, x, q);
+		if (shift > 0)
+			INSTR(RSHIFT, C(shift), q);
+		INSTR(MOVE, q, t);
+		INSTR(URSHIFT, C(31), t);
+		INSTR(ADD, t, q);
+	}
+}
+
+
+/* result := base ** exponent, overwriting base and exponent */
+static void power_loop(operand_t base, operand_t exponent, operand_t result) {
+	int32_t
+	startlabel = label_new("power", ++power_count, false),
+	skiplabel = label_new("powerbit", power_count, false),
+	endlabel = label_new("endpower", power_count, false);
+
+	/* Check for base == 1 */
+	INSTR(MOVE, base, result);
+	INSTR(CMP, C(1), base);
+	INSTR(JUMPZERO, L(endlabel));
+
+	/* Check for exponent < 0 */
+	INSTR(MOVE, C(0), result);
+	INSTR(CMPZERO, exponent);
+	INSTR(JUMPLESS, L(endlabel));
+
+	/* Normal case, one bit of the exponent per round */
+	INSTR(MOVE, C(1), result);
+	INSTR(LABEL, L(startlabel));
+	INSTR(TEST, C(1), exponent);
+	INSTR(JUMPZERO, L(skiplabel));
+	INSTR(IMUL, base, result);
+	INSTR(LABEL, L(skiplabel));
+	INSTR(RSHIFT, C(1), exponent);
+	INSTR(JUMPZERO, L(endlabel));
+	INSTR(IMUL, base, base);
+	INSTR(JUMP, L(startlabel));
+	INSTR(LABEL, L(endlabel));
+}
+
+
+/*
+ * Self tail calls. RETURN f(...) inside f itself needs no new frame: the
+ * arguments overwrite the parameters, and the body starts over. Simple
+ * linear recursion, RETURN x + f(...) or RETURN f(...) * x, is turned into
+ * a tail call by accumulator introduction: the function keeps a running
+ * sum (product) of the x's in its frame, starting at 0 (1), and every
+ * other RETURN adds it to (multiplies it into) the value it returns. This
+ * holds because + and * wrap around, so the order the x's are combined in
+ * makes no difference. Only one of the two operators gets an accumulator
+ * per function, and x is only moved ahead of the call in f(...) + x when
+ * it is pure. Functions with arrays are left alone, since the address of
+ * one could be passed on to the next round, which starts by clearing it.
+ */
+typedef enum {
+	TAIL_NONE,  /* No self tail call */
+	TAIL_CALL,  /* RETURN f(...) */
+	TAIL_LEFT,  /* RETURN x + f(...) */
+	TAIL_RIGHT  /* RETURN f(...) + x, with x pure */
+} tail_t;
+
+static node_index_t tail_function = NO_NODE;
+static bool tail_calls = false;
+static operator_t accumulator = OP_NONE;
+static operand_t accumulator_at;
+static uint32_t tail_position = 0;
+static int32_t tail_label = -1, tail_count = 0;
+
+
+static bool self_call(node_index_t e) {
+	node_t *n = NODE(e);
+	if (n->type != EXPRESSION || n->op != OP_CALL)
+		return false;
+	symbol_t *function = NODE(NODE(tail_function)->children[0])->entry;
+	int32_t args = (n->children[1] == NO_NODE) ?
+	               0 : NODE(n->children[1])->n_children;
+	return NODE(n->children[0])->entry == function && args == function->n_args;
+}
+
+
+static bool pure_value(node_index_t e) {
+	return NODE(e)->type == INTEGER || NODE(e)->type == VARIABLE ||
+	       (NODE(e)->type == EXPRESSION && NODE(e)->pure);
+}
+
+
+/* The kind of self tail call a RETURN makes, and the call itself */
+static tail_t tail_kind(node_index_t ret, node_index_t *call) {
+	node_t *e = NODE(NODE(ret)->children[0]);
+	if (!tail_calls)
+		return TAIL_NONE;
+	if (self_call(NODE(ret)->children[0])) {
+		*call = NODE(ret)->children[0];
+		return TAIL_CALL;
+	}
+	if (e->type != EXPRESSION || accumulator == OP_NONE ||
+	        e->op != accumulator)
+		return TAIL_NONE;
+	if (self_call(e->children[1])) {
+		*call = e->children[1];
+		return TAIL_LEFT;
+	}
+	if (self_call(e->children[0]) && pure_value(e->children[1])) {
+		*call = e->children[0];
+		return TAIL_RIGHT;
+	}
+	return TAIL_NONE;
+}
+
+
+/*
+ * Look through a function for arrays and recursion worth an accumulator,
+ * before generating it.
+ */
+static void tail_begin(node_index_t function) {
+	tail_function = function;
+	tail_calls = !NODE(NODE(function)->children[0])->entry->memoized;
+	accumulator = OP_NONE;
+	tail_label = -1;
+
+	walk_t walk = { NULL, 0, 0 };
+	walk_push(&walk, NODE(function)->children[2]);
+	while (walk.height > 0) {
+		node_t *n = NODE(WALK_TOP(&walk)->node);
+		walk.height -= 1;
+		if (n->type == DECLARATION) {
+			node_t *names = NODE(n->children[0]);
+			for (uint32_t i = 0; i < names->n_children; i++)
+				if (NODE(names->children[i])->n_children > 0)
+					tail_calls = false;
+		}
+		if (n->type == RETURN_STATEMENT && accumulator == OP_NONE) {
+			node_t *e = NODE(n->children[0]);
+			if (e->type == EXPRESSION && (e->op == OP_ADD || e->op == OP_MUL) &&
+			        (self_call(e->children[1]) || self_call(e->children[0])))
+				accumulator = e->op;
+		}
+		for (uint32_t i = 0; i < n->n_children; i++)
+			if (n->children[i] != NO_NODE)
+				walk_push(&walk, n->children[i]);
+	}
+	walk_finalize(&walk);
+	if (!tail_calls)
+		accumulator = OP_NONE;
+}
+
+
+/* Where the body starts over, which is made a label by the first jump */
+static void tail_start(void) {
+	tail_position = instructions_count;
+	INSTR(NIL);
+}
+
+
+/* Jump back to the start of the body, once the parameters are set */
+static void tail_jump(void) {
+	if (tail_label < 0) {
+		tail_label = label_new("tail", ++tail_count, false);
+		instructions[tail_position] = (instruction_t) {
+			.op = LABEL, .operands = { L(tail_label) }
+		};
+	}
+	INSTR(JUMP, L(tail_label));
+}
+
+
+/* accumulator := accumulator op x */
+static void accumulate(operand_t x) {
+	if (accumulator == OP_ADD) {
+		INSTR(ADD, x, accumulator_at);
+	} else if (accumulator_at.kind == O_VIRTUAL) {
+		INSTR(IMUL, x, accumulator_at);
+	} else {
+		INSTR(IMUL, accumulator_at, x);
+		INSTR(MOVE, x, accumulator_at);
+	}
+}
+
+
+/* The value about to be returned in %eax gets the accumulator applied */
+static void accumulated_return(void) {
+	if (accumulator != OP_NONE)
+		INSTR(accumulator == OP_ADD ? ADD : IMUL, accumulator_at, R(EAX));
+}
+
+/* Placeholders for restoring callee-saved registers, and the return */
+static void function_return(void) {
+	INSTR(NIL);
+	INSTR(NIL);
+	INSTR(NIL);
+	INSTR(LEAVE);
+	INSTR(RET);
+}
+
+
+/*
+ * Memoized functions (see bind_names) get a table in the bss segment with
+ * 2^MEMO_BITS entries, each holding the arguments of a call, its result,
+ * and a word which is 1 once the entry is filled in. A call hashes its
+ * arguments to pick an entry, and returns the result kept there if the
+ * arguments match. Otherwise the body runs, and each RETURN fills in the
+ * entry, over whatever calls in the meantime put there. The arguments are
+ * copied when the body starts, since it may assign to its parameters.
+ * Memoized functions make no tail calls, which would change the arguments.
+ */
+#define MEMO_BITS 12
+#define MEMO_HASH (-1640531535) /* 2^32 / golden ratio, as a multiplier */
+
+static symbol_t *memo_function = NULL;
+static operand_t memo_entry;    /* Where the address of the entry is kept */
+static int32_t memo_keys;       /* First copy of the arguments */
+static int32_t memo_count = 0;
+
+
+/* Bytes in an entry, as a power of 2 */
+static int32_t memo_shift(int32_t n_args) {
+	int32_t shift = 2;
+	while ((1 << shift) < WORD_SIZE * (n_args + 2))
+		shift += 1;
+	return shift;
+}
+
+
+/* Room for the tables, see memo_lookup */
+static void memo_tables(FILE *stream, node_index_t functions) {
+	node_t *list = NODE(functions);
+	for (uint32_t f = 0; f < list->n_children; f++) {
+		symbol_t *entry = NODE(NODE(list->children[f])->children[0])->entry;
+		if (!entry->memoized)
+			continue;
+		int32_t size = 1 << (MEMO_BITS + memo_shift(entry->n_args));
+		if (object_file || jit) {
+			object_reserve(label_new(".MEMO", entry->index, true), size);
+		} else if (stdio_emitter) {
+			fprintf(stream, ".lcomm .MEMO%d, %d\n", entry->index, size);
+		} else {
+			emit_str(".lcomm .MEMO");
+			emit_int(entry->index);
+			emit_str(", ");
+			emit_int(size);
+			emit_char('\n');
+		}
+	}
+}
+
+
+/* Parameter i of a function, where it is at the start of the body */
+static operand_t param_at(node_index_t function, int32_t i) {
+	symbol_t *entry = NODE(NODE(NODE(function)->children[1])->children[i])->entry;
+	return registers ? V(entry->vreg) : frame_at(entry->stack_offset);
+}
+
+
+/* Copy i of the arguments */
+static operand_t memo_key(int32_t i) {
+	return registers ? V(memo_keys + i) : frame_at(memo_keys - 4 * i);
+}
+
+
+/*
+ * Frame space for looking up the arguments of a function, if it is
+ * memoized: the address of the entry and the copies of the arguments.
+ */
+static int32_t memo_begin(node_index_t function, int32_t frame_size) {
+	memo_function = NODE(NODE(function)->children[0])->entry;
+	if (!memo_function->memoized) {
+		memo_function = NULL;
+		return 0;
+	}
+	int32_t n = memo_function->n_args;
+	if (registers) {
+		memo_entry = V(vreg_new());
+		memo_keys = vreg_new();
+		for (int32_t i = 1; i < n; i++)
+			vreg_new();
+		return 0;
+	}
+	memo_entry = frame_at(-(frame_size + 4));
+	memo_keys = -(frame_size + 8);
+	return 4 * (n + 1);
+}
+
+
+/* An operand at an offset into the entry, with its address in 'entry' */
+static operand_t memo_at(operand_t entry, int32_t offset) {
+	return registers ? VO(offset, entry.reg) : RO(offset, entry.reg);
+}
+
+
+/* Return the result kept for the arguments, or copy them and go on */
+static void memo_lookup(node_index_t function) {
+	if (memo_function == NULL)
+		return;
+	int32_t n = memo_function->n_args;
+	int32_t miss = label_new("memomiss", ++memo_count, false);
+	operand_t entry = registers ? V(vreg_new()) : R(EAX);
+	operand_t scratch = R(ECX);
+
+	INSTR(MOVE, C(0), entry);
+	for (int32_t i = 0; i < n; i++) {
+		INSTR(ADD, param_at(function, i), entry);
+		INSTR(IMUL, C(MEMO_HASH), entry);
+	}
+	INSTR(URSHIFT, C(32 - MEMO_BITS), entry);
+	INSTR(LSHIFT | WIDE, C(memo_shift(n)), entry);
+	int32_t table = label_new(".MEMO", memo_function->index, true);
+	if (x86_64) {
+		INSTR(LEA | WIDE, L(table), scratch);
+		INSTR(ADD | WIDE, scratch, entry);
+	} else {
+		INSTR(ADD, A(table), entry);
+	}
+	INSTR(MOVE, entry, memo_entry);
+
+	INSTR(CMPZERO, memo_at(entry, WORD_SIZE * (n + 1)));
+	INSTR(JUMPZERO, L(miss));
+	for (int32_t i = 0; i < n; i++) {
+		operand_t param = param_at(function, i);
+		if (!registers) {
+			INSTR(MOVE, param, scratch);
+			param = scratch;
+		}
+		INSTR(CMP, param, memo_at(entry, WORD_SIZE * i));
+		INSTR(JUMPNONZ, L(miss));
+	}
+	INSTR(MOVE, memo_at(entry, WORD_SIZE * n), R(EAX));
+	if (registers) {
+		function_return();
+	} else {
+		INSTR(LEAVE);
+		INSTR(RET);
+	}
+
+	INSTR(LABEL, L(miss));
+	for (int32_t i = 0; i < n; i++) {
+		operand_t param = param_at(function, i);
+		if (!registers) {
+			INSTR(MOVE, param, scratch);
+			param = scratch;
+		}
+		INSTR(MOVE, param, memo_key(i));
+	}
+}
+
+
+/* Fill in the entry with the arguments and the value about to be returned */
+static void memo_store(operand_t value) {
+	if (memo_function == NULL)
+		return;
+	int32_t n = memo_function->n_args;
+	operand_t entry = memo_entry, scratch = R(EDX);
+	if (!registers) {
+		entry = R(ECX);
+		INSTR(MOVE, memo_entry, entry);
+	}
+	for (int32_t i = 0; i < n; i++) {
+		operand_t key = memo_key(i);
+		if (!registers) {
+			INSTR(MOVE, key, scratch);
+			key = scratch;
+		}
+		INSTR(MOVE, key, memo_at(entry, WORD_SIZE * i));
+	}
+	INSTR(MOVE, value, memo_at(entry, WORD_SIZE * n));
+	INSTR(MOVE, C(1), memo_at(entry, WORD_SIZE * (n + 1)));
+}
+
+/*
+ * Steps of generate_node, see generate below:
+ * NEXT(c) moves the visit on to its next step, handing child c over to be
+ * generated in the meantime (NO_NODE is fine, and just moves on).
+ * RECUR(s) hands out all the children in order, one per step, starting at
+ * step s, and falls through once they have all been generated (steps
+ * before s wrap around to large numbers, and fall through as well).
+ * DONE() ends the visit of the node.
+ */
+#define VISIT_DONE UINT32_MAX
+
+#define NEXT(c) do {                                \
+		node_index_t next = (c);                    \
+		v->step += 1;                               \
+		return next;                                \
+	} while ( false )
+
+#define RECUR(s) do {                                       \
+		if ( (uint32_t) (v->step - (s)) < root->n_children ) \
+			NEXT ( root->children[v->step - (s)] );         \
+	} while ( false )
+
+#define DONE() do {                                 \
+		v->step = VISIT_DONE;                       \
+		return NO_NODE;                             \
+	} while ( false )
 
-	switch (root->type.index) {
+
+/*
+ * Generate the code for the next step of a visit to a node, and return the
+ * child to generate before the step after that (if any).
+ */
+static node_index_t
+generate_node(FILE *stream, visit_t *v) {
+	node_t *root = NODE(v->node);
+	switch (root->type) {
 	case PROGRAM:
-		/* Output the data segment, start the text segment */
-		strings_output(stream);
-		fprintf(stream, ".text\n");
+		if (v->step == 0) {
+			/* Start from an empty program, with the fixed labels */
+			ir_init();
+			for (int32_t l = 0; l < N_FIXED_LABELS; l++)
+				label_new(fixed_labels[l], -1, true);
 
-		/* Create the root of the main program list */
-		instruction_init(
-		    tail = head = (instruction_t *)malloc(sizeof(instruction_t)),
-		    NIL
-		);
+			/* Output the data segment, start the text segment */
+			if (object_file || jit) {
+				object_begin();
+				strings_object();
+				memo_tables(stream, root->children[0]);
+			} else if (stdio_emitter) {
+				strings_output(stream);
+				memo_tables(stream, root->children[0]);
+				fprintf(stream, ".text\n");
+			} else {
+				fflush(stream);
+				emit_open(fileno(stream));
+				strings_emit();
+				memo_tables(stream, root->children[0]);
+				emit_str(".text\n");
+			}
+		}
 
 		/* Generate code for all children */
-		RECUR();
+		RECUR(0);
 
 		/* Parse arguments from command line */
-		INSTR(SYSLABEL, "main");
-		INSTR(PUSH, R(ebp));
-		INSTR(MOVE, R(esp), R(ebp));
-		INSTR(MOVE, RO(8, esp), R(esi));
-		INSTR(DEC, R(esi));
-		INSTR(JUMPZERO, "noargs");
-		INSTR(MOVE, RO(12, ebp), R(ebx));
-		INSTR(SYSLABEL, "pusharg");
-		INSTR(ADD, C(4), R(ebx));
-		INSTR(PUSH, C(10));
-		INSTR(PUSH, C(0));
-		INSTR(PUSH, RI(ebx));
-		INSTR(SYSCALL, "strtol");
-		INSTR(ADD, C(12), R(esp));
-		INSTR(PUSH, R(eax));
-		INSTR(DEC, R(esi));
-		INSTR(JUMPNONZ, "pusharg");
-		INSTR(SYSLABEL, "noargs");
+		INSTR(LABEL, L(L_MAIN));
+		INSTR(PUSH, R(EBP));
+		INSTR(MOVE, R(ESP), R(EBP));
+		if (x86_64) {
+			/*
+			 * argc and argv come in %edi and %rsi, and strtol may
+			 * change both, so the count goes in the frame
+			 */
+			INSTR(PUSH, R(EDI));
+			INSTR(MOVE, R(ESI), R(EBX));
+			INSTR(DEC, RO(-8, EBP));
+			INSTR(JUMPZERO, L(L_NOARGS));
+			INSTR(LABEL, L(L_PUSHARG));
+			INSTR(ADD | WIDE, C(8), R(EBX));
+			INSTR(MOVE, RI(EBX), R(EDI));
+			INSTR(MOVE, C(0), R(ESI));
+			INSTR(MOVE, C(10), R(EDX));
+			call_c(L_STRTOL);
+			INSTR(PUSH, R(EAX));
+			INSTR(DEC, RO(-8, EBP));
+			INSTR(JUMPNONZ, L(L_PUSHARG));
+		} else {
+			INSTR(MOVE, RO(8, ESP), R(ESI));
+			INSTR(DEC, R(ESI));
+			INSTR(JUMPZERO, L(L_NOARGS));
+			INSTR(MOVE, RO(12, EBP), R(EBX));
+			INSTR(LABEL, L(L_PUSHARG));
+			INSTR(ADD, C(4), R(EBX));
+			INSTR(PUSH, C(10));
+			INSTR(PUSH, C(0));
+			INSTR(PUSH, RI(EBX));
+			INSTR(CALL, L(L_STRTOL));
+			INSTR(ADD, C(12), R(ESP));
+			INSTR(PUSH, R(EAX));
+			INSTR(DEC, R(ESI));
+			INSTR(JUMPNONZ, L(L_PUSHARG));
+		}
+		INSTR(LABEL, L(L_NOARGS));
 
 		/* Call 1st function in VSL program, and exit w. returned value */
-		INSTR(CALL, root->children[0]->children[0]->children[0]->data);
+		INSTR(CALL, L(function_label(
+		                  NODE(NODE(root->children[0])->children[0])->children[0]
+		              )));
 
 		INSTR(LEAVE);
-		INSTR(PUSH, R(eax));
-		INSTR(SYSCALL, "exit");
-
-		print_instructions(stream);
-		free_instructions();
-		break;
+		if (x86_64) {
+			INSTR(MOVE, R(EAX), R(EDI));
+			call_c(L_EXIT);
+		} else {
+			INSTR(PUSH, R(EAX));
+			INSTR(CALL, L(L_EXIT));
+		}
 
-	case FUNCTION:
-		INSTR(LABEL, root->children[0]->data);
-		INSTR(PUSH, R(ebp));
-		INSTR(MOVE, R(esp), R(ebp));
+		/* Code that leaks stack must not get any further */
+		uint32_t unbalanced = stack_check();
+		if (unbalanced > 0) {
+			fprintf(stderr, "Error: %u stack imbalances in generated code\n",
+			        unbalanced);
+			exit(EXIT_FAILURE);
+		}
 
-		depth += 1;
-		generate(stream, root->children[2]);
-		INSTR(LEAVE);
-		depth -= 1;
+		if (peephole) {
+			uint32_t total = instructions_count;
+			uint32_t removed = peephole_optimize(verbosity);
+			if (verbosity > 0)
+				fprintf(stderr, "peephole: removed %u of %u instructions\n",
+				        removed, total);
+		}
 
-		INSTR(RET);
-		break;
+		if (jit) {
+			fflush(stream);
+			object_run(L_MAIN, jit_argc, jit_argv);
+		} else if (object_file) {
+			fflush(stream);
+			object_write(fileno(stream));
+		} else if (stdio_emitter) {
+			ir_print(stream);
+		} else {
+			ir_emit();
+			emit_close();
+		}
+		ir_finalize();
+		DONE();
 
-	case BLOCK:
-		INSTR(PUSH, R(ebp));
-		INSTR(PUSH, R(ebp));
-		INSTR(MOVE, R(esp), R(ebp));
+	case FUNCTION:
+		if (v->step == 0) {
+			INSTR(LABEL, L(function_label(root->children[0])));
+			INSTR(PUSH, R(EBP));
+			INSTR(MOVE, R(ESP), R(EBP));
 
-		depth += 1;
-		RECUR();
+			/* Room for the locals of all the blocks in the function */
+			int32_t frame_size = NODE(root->children[0])->entry->frame_size;
+			tail_begin(v->node);
+			if (accumulator != OP_NONE)
+				frame_size += 4;
+			frame_size += memo_begin(v->node, frame_size);
+			if (frame_size > 0)
+				INSTR(SUB, C(frame_size * WORD_SIZE / 4), R(ESP));
+			if (accumulator != OP_NONE) {
+				accumulator_at = frame_at(-frame_size);
+				INSTR(MOVE, C(accumulator == OP_ADD ? 0 : 1), accumulator_at);
+			}
+			memo_lookup(v->node);
+			tail_start();
+			NEXT(root->children[2]);
+		}
 		INSTR(LEAVE);
-		depth -= 1;
-		break;
+		INSTR(RET);
+		DONE();
 
 	case PRINT_STATEMENT:
-		for (int32_t i = 0; i < root->n_children; i++) {
-			node_t *item = root->children[i];
-			if (item->type.index == TEXT) {
-				char constant[19]; // $.STRING%d, minus, 10 digits
-				sprintf(constant, "$.STRING%d", *((int32_t *)item->data));
-				INSTR(PUSH, OUTFILE);
-				INSTR(PUSH, constant);
-				INSTR(SYSCALL, "fputs");
-				INSTR(PUSH, C(0x20));
-				INSTR(SYSCALL, "putchar");
-				INSTR(ADD, C(8), R(esp));
+		/*
+		 * Two steps per item: generate it, then print it. Arguments
+		 * go on the stack, or in registers on x86-64, where printf
+		 * also wants the number of vector registers it gets in %eax.
+		 */
+		if (v->step / 2 < root->n_children) {
+			node_index_t item = root->children[v->step / 2];
+			if (NODE(item)->type == TEXT) {
+				int32_t string = label_new(".STRING", NODE(item)->value, true);
+				if (x86_64) {
+					INSTR(MOVE, L(L_OUTFILE), R(ESI));
+					INSTR(LEA | WIDE, L(string), R(EDI));
+					call_c(L_FPUTS);
+					INSTR(MOVE, C(0x20), R(EDI));
+					call_c(L_PUTCHAR);
+				} else {
+					INSTR(PUSH, L(L_OUTFILE));
+					INSTR(PUSH, A(string));
+					INSTR(CALL, L(L_FPUTS));
+					INSTR(PUSH, C(0x20));
+					INSTR(CALL, L(L_PUTCHAR));
+					INSTR(ADD, C(12), R(ESP));
+				}
+				v->step += 2;
+				return NO_NODE;
+			} else if (v->step % 2 == 0) {
+				NEXT(item);
+			} else if (x86_64) {
+				INSTR(POP, R(ESI));
+				INSTR(LEA | WIDE, L(L_INTEGER), R(EDI));
+				INSTR(MOVE, C(0), R(EAX));
+				call_c(L_PRINTF);
+				NEXT(NO_NODE);
 			} else {
-				generate(stream, item);
-				INSTR(PUSH, C(.INTEGER));
-				INSTR(SYSCALL, "printf");
-				INSTR(ADD, C(4), R(esp));
+				INSTR(PUSH, A(L_INTEGER));
+				INSTR(CALL, L(L_PRINTF));
+				INSTR(ADD, C(8), R(ESP));
+				NEXT(NO_NODE);
 			}
 		}
-		INSTR(PUSH, C(0x0A));
-		INSTR(SYSCALL, "putchar");
-		INSTR(ADD, C(4), R(esp));
-		break;
+		if (x86_64) {
+			INSTR(MOVE, C(0x0A), R(EDI));
+			call_c(L_PUTCHAR);
+		} else {
+			INSTR(PUSH, C(0x0A));
+			INSTR(CALL, L(L_PUTCHAR));
+			INSTR(ADD, C(4), R(ESP));
+		}
+		DONE();
 
 	case DECLARATION:
-		for (int32_t i = 0; i < root->children[0]->n_children; i++) {
-			if (root->children[0]->children[i]->n_children == 0) {
-				INSTR(PUSH, C(0));
+		for (uint32_t i = 0; i < NODE(root->children[0])->n_children; i++) {
+			node_t *var = NODE(NODE(root->children[0])->children[i]);
+			int32_t offset = var->entry->stack_offset;
+			if (var->n_children == 0) {
+				INSTR(MOVE, C(0), frame_at(offset));
 			} else { // We have an array, thus we need to:
 				// Get the length of it
-				int arraySize = (*(int *)root->children[0]->children[i]->children[0]->data);
-				// Create a pointer to the first element
-				INSTR(MOVE, R(esp), R(ecx));
-				// ESP is where the pointer will be stored, increment it.
-				INSTR(SUB, C(8), R(ecx));
-				// Push that to the stack
-				INSTR(PUSH, R(ecx));
-				// Move the stack-pointer, this was mostly done this way out of convenience (counting visually in the dark hours,
-				// instead of relying on my math to work fine will fighting jetlag)
-				for (int i = 0; i < arraySize; i++) {
-					INSTR(PUSH, C(0));  // Could have just moved ESP too, but this way we ensure 0's in all elements.
-				}
+				int arraySize = NODE(var->children[0])->value;
+				// Store a pointer to the first element, right below it
+				INSTR(MOVE, R(EBP), R(ECX));
+				INSTR(ADD | WIDE, C(frame_at(offset - 4).value), R(ECX));
+				INSTR(MOVE, R(ECX), frame_at(offset));
+				// Ensure 0's in all elements
+				for (int i = 0; i < arraySize; i++)
+					INSTR(MOVE, C(0), frame_at(offset - 4 - 4 * i));
 			}
 		}
-		break;
+		DONE();
 
 	case EXPRESSION:
-		if (root->n_children == 1 && root->data != NULL) {
-			RECUR();
-			INSTR(POP, R(eax));
-			INSTR(NEG, R(eax));
-			INSTR(PUSH, R(eax));
+		if (root->n_children == 1 && root->op == OP_NEG) {
+			RECUR(0);
+			INSTR(POP, R(EAX));
+			INSTR(NEG, R(EAX));
+			INSTR(PUSH, R(EAX));
 		} else if (root->n_children == 2) {
-			if (*((char *)(root->data)) == 'F') {
-				RECUR();
+			int32_t constant = reducible_constant(root);
+			if (root->op == OP_CALL) {
+				RECUR(0);
 				int32_t
-				expected_args = root->children[0]->entry->n_args,
-				actual_args = (root->children[1] == NULL) ?
-				              0 : root->children[1]->n_children;
+				expected_args = NODE(root->children[0])->entry->n_args,
+				actual_args = (root->children[1] == NO_NODE) ?
+				              0 : NODE(root->children[1])->n_children;
 				if (expected_args != actual_args) {
 					fprintf(stderr,
 					        "Error: function '%s' expects %d arguments, "
 					        "but is called with %d.\n",
-					        (char *)root->children[0]->data,
+					        ident_text(NODE(root->children[0])->value),
 					        expected_args, actual_args
 					       );
 					exit(EXIT_FAILURE);
 				}
 				/* Call function */
-				INSTR(CALL, root->children[0]->data);
+				INSTR(CALL, L(function_label(root->children[0])));
 
 				/* Remove parameters, if they exist */
-				if (root->children[1] != NULL) {
-					char constant[12];
-					sprintf(constant,
-					        "$%d", 4 * root->children[1]->n_children
-					       );
-					INSTR(ADD, constant, R(esp));
-				}
+				if (root->children[1] != NO_NODE)
+					INSTR(ADD, C(WORD_SIZE * NODE(root->children[1])->n_children),
+					      R(ESP));
 				/* Push returned value */
-				INSTR(PUSH, R(eax));
+				INSTR(PUSH, R(EAX));
+			}
+			else if (constant >= 0) {
+				/* Only the other operand is needed on the stack */
+				if (v->step == 0)
+					NEXT(root->children[1 - constant]);
+				int32_t c = NODE(root->children[constant])->value;
+				if (root->op == OP_MUL) {
+					INSTR(POP, R(EAX));
+					multiply_constant(R(EAX), R(ECX), c);
+				} else {
+					INSTR(POP, R(ECX));
+					divide_constant(R(ECX), R(EAX), R(EDX), c);
+				}
+				INSTR(PUSH, R(EAX));
+			}
+			else if (root->op == OP_POW && power_expands(root->children[1])) {
+				/* Only the base is needed on the stack */
+				if (v->step == 0)
+					NEXT(root->children[0]);
+				INSTR(POP, R(EAX));
+				INSTR(MOVE, R(EAX), R(ECX));
+				power_expand(R(ECX), R(EAX), NODE(root->children[1])->value);
+				INSTR(PUSH, R(EAX));
 			}
 			//Array lookup
-			else if (*((char *)(root->data)) == 'A') {
+			else if (root->op == OP_INDEX) {
 				// Put the details on the stack, in order: Pointer, Index
-				RECUR();
+				RECUR(0);
 				// Fetch index
-				INSTR(POP, R(edx));
+				INSTR(POP, R(EDX));
 				// Fetch pointer
-				INSTR(POP, R(ecx));
-				// Multiply by 4
-				INSTR(LSHIFT, C(2), R(edx));
-				// Combine index and pointer
-				INSTR(SUB, R(edx), R(ecx));
+				INSTR(POP, R(ECX));
+				// Scale the index to words, and combine it with the pointer
+				element_address();
 				// Deref and push
-				INSTR(PUSH, RI(ecx));
+				INSTR(PUSH, RI(ECX));
 
 			} else {
-				RECUR();
-				INSTR(POP, R(ebx));
-				INSTR(POP, R(eax));
-				switch (*((char *)root->data)) {
-				case '+':
-					INSTR(ADD, R(ebx), R(eax));
+				RECUR(0);
+				INSTR(POP, R(EBX));
+				INSTR(POP, R(EAX));
+				switch (root->op) {
+				case OP_ADD:
+					INSTR(ADD, R(EBX), R(EAX));
 					break;
-				case '-':
-					INSTR(SUB, R(ebx), R(eax));
+				case OP_SUB:
+					INSTR(SUB, R(EBX), R(EAX));
 					break;
-				case '*':
-					INSTR(CDQ);
-					INSTR(MUL, R(ebx));
+				case OP_MUL:
+					INSTR(IMUL, R(EBX), R(EAX));
 					break;
-				case '/':
+				case OP_DIV:
 					INSTR(CDQ);
-					INSTR(DIV, R(ebx));
+					INSTR(DIV, R(EBX));
 					break;
-				case '^': {
-					/* Power */
-					char startlabel[15], endlabel[15];
-					sprintf(startlabel, "_power%d", ++power_count);
-					sprintf(endlabel, "_endpower%d", power_count);
-
-					/* Check for base == 1 */
-					INSTR(CMP, C(1), R(eax));
-					INSTR(JUMPZERO, endlabel);
-
-					/* Check for exponent < 0 */
-					INSTR(MOVE, R(eax), R(ecx));
-					INSTR(MOVE, C(0), R(eax));
-					INSTR(CMPZERO, R(ebx));
-					INSTR(JUMPLESS, endlabel);
-
-					/* Normal case */
-					INSTR(MOVE, C(1), R(eax));
-					INSTR(CDQ);
-					INSTR(LABEL, startlabel + 1);
-					INSTR(CMPZERO, R(ebx));
-					INSTR(JUMPZERO, endlabel);
-					INSTR(MUL, R(ecx));
-					INSTR(SUB, C(1), R(ebx));
-					INSTR(JUMP, startlabel);
-					INSTR(LABEL, endlabel + 1);
+				case OP_POW:
+					INSTR(MOVE, R(EAX), R(ECX));
+					power_loop(R(ECX), R(EBX), R(EAX));
 					break;
 				}
-				}
-				INSTR(PUSH, R(eax));
+				INSTR(PUSH, R(EAX));
 			}
 		}
-		break;
+		DONE();
 
 	case VARIABLE:
-		if (root->entry->label == NULL) {
-			/* Find the variable on stack */
-			char var_offset[19];
-			sprintf(var_offset, "%d(%%ecx)", root->entry->stack_offset);
+		/* Everything in the function is in the one frame */
+		if (root->entry->label == NULL)
+			INSTR(PUSH, frame_at(root->entry->stack_offset));
+		DONE();
 
-			/* Start from record's ebp */
-			INSTR(MOVE, R(ebp), R(ecx));
-
-			/* If var. was defined at other nesting level, unwind
-			 * the records (here, using ecx for temps)
-			 */
-			for (int u = 0; u < (depth - (root->entry->depth)); u++)
-				INSTR(MOVE, RO(4, ecx), R(ecx));
-
-			/* Once we have the right record, look up the variable */
-			INSTR(PUSH, var_offset);
-		}
-		break;
-
-	case INTEGER: {
-		char constant[13]; /* At most $, minus sign and 10 digits */
-		sprintf(constant, "$%d\0", *((int32_t *)root->data));
-		INSTR(PUSH, constant);
-	}
-	break;
+	case INTEGER:
+		INSTR(PUSH, C(root->value));
+		DONE();
 
 	case ASSIGNMENT_STATEMENT:
-		generate(stream, root->children[1]);
-		INSTR(POP, R(eax));
+		if (v->step == 0)
+			NEXT(root->children[1]);
+		if (v->step == 1) {
+			INSTR(POP, R(EAX));
+			v->step += 1;
+		}
 
 		if (root->n_children == 3) { // Only case with 3 children is the one with indexed
 			// First, get our data, in order: Pointer, Index, Assignment-value
-			RECUR();
+			RECUR(2);
 			// Fetch Assignment-value
-			INSTR(POP, R(ebx));
+			INSTR(POP, R(EBX));
 			// Fetch index
-			INSTR(POP, R(edx));
-			// Multiply index by 4
-			INSTR(LSHIFT, C(2), R(edx));
+			INSTR(POP, R(EDX));
 			// Fetch pointer
-			INSTR(POP, R(ecx));
-			// Combine pointer and index
-			INSTR(SUB, R(edx), R(ecx));
+			INSTR(POP, R(ECX));
+			// Scale the index to words, and combine it with the pointer
+			element_address();
 			// Store assignment value at the location pointed at.
-			INSTR(MOVE, R(ebx), RI(ecx));
+			INSTR(MOVE, R(EBX), RI(ECX));
 			// We are done
-			break;
-		} else {
-			INSTR(MOVE, C(0), R(edx));
+			DONE();
 		}
 
-		/* Unwind stack if appropriate */
-		node_t *target = root->children[0];
-		INSTR(MOVE, R(ebp), R(ecx));
-		for (int u = 0; u < (depth - (target->entry->depth)); u++) {
-			INSTR(MOVE, RO(4, ecx), R(ecx));
-		}
-		/* Offset the base-pointer for the correct stack-frame down by the index-amount
-		 * thus a[3] becomes a[0], and we don't need to do anything about the stack-offset
-		 * (well, we already did anyway, by skewing the stack-top in ecx).
-		 */
-		if (root->n_children == 3) {
-			INSTR(ADD, R(edx), R(ecx));
-		}
-		{
-			char offsz[19];
-			sprintf(offsz, "%d(%%ecx)", target->entry->stack_offset);
-			INSTR(MOVE, R(eax), offsz);
+		INSTR(MOVE, R(EAX), frame_at(NODE(root->children[0])->entry->stack_offset));
+		DONE();
+
+	case RETURN_STATEMENT: {
+		node_index_t call = NO_NODE;
+		tail_t kind = tail_kind(v->node, &call);
+		if (kind == TAIL_NONE) {
+			RECUR(0);
+			INSTR(POP, R(EAX));
+			accumulated_return();
+			memo_store(R(EAX));
+			INSTR(LEAVE);
+			INSTR(RET);
+			DONE();
 		}
 
-		break;
+		/* x and the arguments, in the order they were written in */
+		node_t *e = NODE(root->children[0]);
+		node_index_t args = NODE(call)->children[1];
+		node_index_t x = (kind == TAIL_LEFT) ? e->children[0] :
+		                 (kind == TAIL_RIGHT) ? e->children[1] : NO_NODE;
+		if (v->step == 0)
+			NEXT(kind == TAIL_LEFT ? x : args);
+		if (v->step == 1)
+			NEXT(kind == TAIL_LEFT ? args : x);
 
-	case RETURN_STATEMENT:
-		RECUR();
-		INSTR(POP, R(eax));
-		for (int32_t u = 0; u < depth - 1; u++)
-			INSTR(LEAVE);
-		INSTR(RET);
-		break;
+		if (kind == TAIL_RIGHT) {
+			INSTR(POP, R(EAX));
+			accumulate(R(EAX));
+		}
+		node_t *params = NODE(NODE(tail_function)->children[1]);
+		int32_t n = (args == NO_NODE) ? 0 : NODE(args)->n_children;
+		for (int32_t i = n - 1; i >= 0; i--)
+			INSTR(POP, frame_at(NODE(params->children[i])->entry->stack_offset));
+		if (kind == TAIL_LEFT) {
+			INSTR(POP, R(EAX));
+			accumulate(R(EAX));
+		}
+		tail_jump();
+		DONE();
+	}
 
 		/* TODO: implement conditionals, loops and continues */
 	case IF_STATEMENT: {
-		char elseLabel[16];
-		char endifLabel[16];
-		// Generate labels
-		sprintf(elseLabel, "_elseLabel%d", if_count);
-		sprintf(endifLabel, "_endifLabel%d", if_count++);
-		// Generate the expression, putting the result on stack
-		generate(stream, root->children[0]);
-		// Compare the result to 0
-		INSTR(MOVE, RI(esp), R(eax));
-		INSTR(MOVE, C(0), R(ebx));
-		INSTR(CMP, R(eax), R(ebx));
-		// If (0) goto elseLabel
-		INSTR(JUMPZERO, elseLabel);
-		// Generate the if-block (falling through from the above)
-		generate(stream, root->children[1]);
-		// Two cases, either we have an else, or we don't
-		if (root->n_children == 3) {
-			// Skip over the else-block if we did the if-part
-			INSTR(JUMP, endifLabel);
-			INSTR(LABEL, elseLabel + 1);
-			generate(stream, root->children[2]);
-			INSTR(LABEL, endifLabel + 1);
-		} else {
+		// Generate labels (the visit keeps them between steps)
+		if (v->step == 0) {
+			v->aux = label_new("elseLabel", if_count, false);
+			label_new("endifLabel", if_count++, false);
+		}
+		operand_t elseLabel = L(v->aux), endifLabel = L(v->aux + 1);
+		switch (v->step) {
+		case 0:
+			// Generate the expression, putting the result on stack
+			NEXT(root->children[0]);
+		case 1:
+			// Take the result off the stack, and compare it to 0
+			INSTR(POP, R(EAX));
+			INSTR(CMPZERO, R(EAX));
+			// If (0) goto elseLabel
+			INSTR(JUMPZERO, elseLabel);
+			// Generate the if-block (falling through from the above)
+			NEXT(root->children[1]);
+		case 2:
+			// Two cases, either we have an else, or we don't
+			if (root->n_children == 3) {
+				// Skip over the else-block if we did the if-part
+				INSTR(JUMP, endifLabel);
+				INSTR(LABEL, elseLabel);
+				NEXT(root->children[2]);
+			}
 			// Yes, we do use the elseLabel for if's without
 			// else's, mainly since it doesn't harm, and makes
 			// the code a bit shorter.
-			INSTR(LABEL, elseLabel + 1);
+			INSTR(LABEL, elseLabel);
+			DONE();
+		default:
+			INSTR(LABEL, endifLabel);
+			DONE();
 		}
 	}
-	break;
 
 	case WHILE_STATEMENT: {
-		char endLabel[16];
-		char expLabel[16];
-		// While-depth is necessary to know how many scopes to unroll when Continuing
-		while_depth = depth;
-		while_count++; // Necessary to avoid duplicate labels (and for continue)
-		// Generate labels
-		sprintf(endLabel, "_endWhile%d", while_count);
-		sprintf(expLabel, "_startWhile%d", while_count);
-		INSTR(LABEL, expLabel + 1);
-		// Generate expression (AFTER label, since it needs to be done every iteration)
-		generate(stream, root->children[0]);
-		INSTR(MOVE, RI(esp), R(eax));
-		INSTR(MOVE, C(0), R(ebx));
-		INSTR(CMP, R(eax), R(ebx));
-		// end the while if it fails.
-		INSTR(JUMPZERO, endLabel);
-		generate(stream, root->children[1]);
-		// Hard-jump to top, to verify conditional, if it fails, we'll jump to the endLabel anyhow.
-		INSTR(JUMP, expLabel);
-		INSTR(LABEL, endLabel + 1);
-	}
-	break;
+		if (v->step == 0) {
+			while_count++; // Necessary to avoid duplicate labels (and for continue)
+			// Generate labels (the visit keeps them between steps)
+			v->aux = while_label = label_new("startWhile", while_count, false);
+			label_new("endWhile", while_count, false);
+		}
+		operand_t expLabel = L(v->aux), endLabel = L(v->aux + 1);
+		switch (v->step) {
+		case 0:
+			INSTR(LABEL, expLabel);
+			// Generate expression (AFTER label, since it needs to be done every iteration)
+			NEXT(root->children[0]);
+		case 1:
+			// Take the result off the stack, so the loop doesn't grow it
+			INSTR(POP, R(EAX));
+			INSTR(CMPZERO, R(EAX));
+			// end the while if it fails.
+			INSTR(JUMPZERO, endLabel);
+			NEXT(root->children[1]);
+		default:
+			// Hard-jump to top, to verify conditional, if it fails, we'll jump to the endLabel anyhow.
+			INSTR(JUMP, expLabel);
+			INSTR(LABEL, endLabel);
+			DONE();
+		}
+	}
 
 	case NULL_STATEMENT: {
 		// Solved by simply knowing that any Continue will be inside a WHILE
 		// Thus the last set while_count will be the label to jump to.
-		char whileLabel[16];
-		sprintf(whileLabel, "_startWhile%d", while_count);
-		// Unroll to the last set while_depth (or to be specific, the diff from current-depth)
-		for (int i = 0; i < (depth - while_depth); i++) {
-			INSTR(LEAVE);
+		if (while_count == 0)
+			while_label = label_new("startWhile", while_count, false);
+		// Blocks share the frame of the function, so there is nothing
+		// to unroll. Just do as Van Halen told you.
+		INSTR(JUMP, L(while_label));
+	}
+	DONE();
+
+
+	default:
+		RECUR(0);
+		DONE();
+	}
+}
+
+
+/*
+ * Code generation with register allocation (the -r flag).
+ * Instead of going through the machine stack, the values of expressions
+ * are kept on a stack of operands here in the compiler, and every result
+ * is computed into a fresh virtual register. Variables live in virtual
+ * registers of their own; arrays get their elements in the stack frame of
+ * the function, which holds everything, so blocks don't make frames. Each
+ * function is handed to the register allocator as soon as it is generated.
+ */
+static operand_t *values = NULL;
+static uint32_t values_size = 0, values_height = 0;
+static uint32_t function_start = 0;
+static int32_t frame_words = 0;
+
+
+static void value_push(operand_t value) {
+	if (values_height == values_size) {
+		values_size = (values_size == 0) ? 256 : 2 * values_size;
+		values = realloc(values, values_size * sizeof(operand_t));
+		if (values == NULL) {
+			fprintf(stderr, "Out of memory for code generation\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	values[values_height++] = value;
+}
+
+
+static operand_t value_pop(void) {
+	return values[--values_height];
+}
+
+
+/* A fresh virtual register holding a copy of the value */
+static operand_t value_copy(operand_t value) {
+	operand_t copy = V(vreg_new());
+	INSTR(MOVE, value, copy);
+	return copy;
+}
+
+
+/* The value itself, unless it is an immediate, which needs a register */
+static operand_t value_in_register(operand_t value) {
+	return (value.kind == O_IMMEDIATE) ? value_copy(value) : value;
+}
+
+
+static node_index_t
+generate_node_registers(FILE *stream, visit_t *v) {
+	node_t *root = NODE(v->node);
+	switch (root->type) {
+	case FUNCTION:
+		if (v->step == 0) {
+			regalloc_begin();
+			function_start = instructions_count;
+			frame_words = 0;
+			INSTR(LABEL, L(function_label(root->children[0])));
+			INSTR(PUSH, R(EBP));
+			INSTR(MOVE, R(ESP), R(EBP));
+			INSTR(SUB, C(0), R(ESP));
+			INSTR(NIL);
+			INSTR(NIL);
+			INSTR(NIL);
+
+			/* Load the parameters from where the caller put them */
+			node_index_t params = root->children[1];
+			for (uint32_t i = 0; params != NO_NODE &&
+			        i < NODE(params)->n_children; i++) {
+				symbol_t *entry = NODE(NODE(params)->children[i])->entry;
+				entry->vreg = vreg_new();
+				INSTR(MOVE, RO(entry->stack_offset, EBP), V(entry->vreg));
+			}
+			tail_begin(v->node);
+			if (accumulator != OP_NONE) {
+				accumulator_at = V(vreg_new());
+				INSTR(MOVE, C(accumulator == OP_ADD ? 0 : 1), accumulator_at);
+			}
+			memo_begin(v->node, 0);
+			memo_lookup(v->node);
+			tail_start();
+			NEXT(root->children[2]);
+		}
+		function_return();
+		regalloc_function(function_start, frame_words, verbosity);
+		DONE();
+
+	case BLOCK:
+		RECUR(0);
+		DONE();
+
+	case PRINT_STATEMENT:
+		if (v->step / 2 < root->n_children) {
+			node_index_t item = root->children[v->step / 2];
+			if (NODE(item)->type == TEXT) {
+				int32_t string = label_new(".STRING", NODE(item)->value, true);
+				INSTR(PUSH, L(L_OUTFILE));
+				INSTR(PUSH, A(string));
+				INSTR(CALL, L(L_FPUTS));
+				INSTR(PUSH, C(0x20));
+				INSTR(CALL, L(L_PUTCHAR));
+				INSTR(ADD, C(12), R(ESP));
+				v->step += 2;
+				return NO_NODE;
+			} else if (v->step % 2 == 0) {
+				NEXT(item);
+			} else {
+				INSTR(PUSH, value_pop());
+				INSTR(PUSH, A(L_INTEGER));
+				INSTR(CALL, L(L_PRINTF));
+				INSTR(ADD, C(8), R(ESP));
+				NEXT(NO_NODE);
+			}
+		}
+		INSTR(PUSH, C(0x0A));
+		INSTR(CALL, L(L_PUTCHAR));
+		INSTR(ADD, C(4), R(ESP));
+		DONE();
+
+	case DECLARATION:
+		for (uint32_t i = 0; i < NODE(root->children[0])->n_children; i++) {
+			node_t *var = NODE(NODE(root->children[0])->children[i]);
+			var->entry->vreg = vreg_new();
+			if (var->n_children == 0) {
+				INSTR(MOVE, C(0), V(var->entry->vreg));
+			} else {
+				/* Element i is 4*i bytes below the first one */
+				int32_t size = NODE(var->children[0])->value;
+				int32_t top = -4 * (frame_words + 1);
+				frame_words += size;
+				INSTR(MOVE, R(EBP), V(var->entry->vreg));
+				INSTR(ADD, C(top), V(var->entry->vreg));
+				for (int32_t e = 0; e < size; e++)
+					INSTR(MOVE, C(0), RO(top - 4 * e, EBP));
+			}
+		}
+		DONE();
+
+	case EXPRESSION:
+		RECUR(0);
+		if (root->n_children == 1 && root->op == OP_NEG) {
+			operand_t result = value_copy(value_pop());
+			INSTR(NEG, result);
+			value_push(result);
+		} else if (root->n_children == 2 && root->op == OP_CALL) {
+			int32_t
+			expected_args = NODE(root->children[0])->entry->n_args,
+			actual_args = (root->children[1] == NO_NODE) ?
+			              0 : NODE(root->children[1])->n_children;
+			if (expected_args != actual_args) {
+				fprintf(stderr,
+				        "Error: function '%s' expects %d arguments, "
+				        "but is called with %d.\n",
+				        ident_text(NODE(root->children[0])->value),
+				        expected_args, actual_args
+				       );
+				exit(EXIT_FAILURE);
+			}
+			/* The arguments are on top of the value stack, first one lowest */
+			values_height -= actual_args;
+			for (int32_t a = 0; a < actual_args; a++)
+				INSTR(PUSH, values[values_height + a]);
+			INSTR(CALL, L(function_label(root->children[0])));
+			if (actual_args > 0)
+				INSTR(ADD, C(4 * actual_args), R(ESP));
+			value_push(value_copy(R(EAX)));
+		} else if (root->n_children == 2 && root->op == OP_INDEX) {
+			operand_t index = value_pop(), array = value_pop();
+			if (index.kind == O_IMMEDIATE) {
+				value_push(value_copy(VO(-4 * index.value, array.reg)));
+			} else {
+				operand_t offset = value_copy(index);
+				INSTR(LSHIFT, C(2), offset);
+				operand_t address = value_copy(array);
+				INSTR(SUB, offset, address);
+				INSTR(MOVE, VO(0, address.reg), address);
+				value_push(address);
+			}
+		} else if (root->n_children == 2) {
+			operand_t b = value_pop(), a = value_pop(), result;
+			switch (root->op) {
+			case OP_ADD:
+			case OP_SUB:
+				result = value_copy(a);
+				INSTR(root->op == OP_ADD ? ADD : SUB, b, result);
+				break;
+			case OP_MUL:
+				if (b.kind == O_IMMEDIATE) {
+					result = value_copy(a);
+					multiply_constant(result, V(vreg_new()), b.value);
+				} else if (a.kind == O_IMMEDIATE) {
+					result = value_copy(b);
+					multiply_constant(result, V(vreg_new()), a.value);
+				} else {
+					result = value_copy(a);
+					INSTR(IMUL, b, result);
+				}
+				break;
+			case OP_DIV:
+				if (reducible_constant(root) >= 0) {
+					result = V(vreg_new());
+					divide_constant(value_in_register(a), result,
+					                V(vreg_new()), b.value);
+					break;
+				}
+				INSTR(MOVE, a, R(EAX));
+				b = value_in_register(b);
+				INSTR(CDQ);
+				INSTR(DIV, b);
+				result = value_copy(R(EAX));
+				break;
+			case OP_POW:
+				if (power_expands(root->children[1])) {
+					result = value_copy(a);
+					power_expand(a, result, b.value);
+				} else {
+					result = V(vreg_new());
+					power_loop(value_copy(a), value_copy(b), result);
+				}
+				break;
+			default:
+				result = C(0);
+				break;
+			}
+			value_push(result);
 		}
-		// Then do as Van Halen told you.
-		INSTR(JUMP, whileLabel);
+		DONE();
+
+	case VARIABLE:
+		if (root->entry->label == NULL)
+			value_push(V(root->entry->vreg));
+		DONE();
+
+	case INTEGER:
+		value_push(C(root->value));
+		DONE();
+
+	case ASSIGNMENT_STATEMENT:
+		if (root->n_children == 3) {
+			RECUR(0);
+			operand_t value = value_pop(), index = value_pop();
+			operand_t array = value_pop();
+			if (index.kind == O_IMMEDIATE) {
+				INSTR(MOVE, value, VO(-4 * index.value, array.reg));
+			} else {
+				operand_t offset = value_copy(index);
+				INSTR(LSHIFT, C(2), offset);
+				operand_t address = value_copy(array);
+				INSTR(SUB, offset, address);
+				INSTR(MOVE, value, VO(0, address.reg));
+			}
+			DONE();
+		}
+		if (v->step == 0)
+			NEXT(root->children[1]);
+		INSTR(MOVE, value_pop(), V(NODE(root->children[0])->entry->vreg));
+		DONE();
+
+	case RETURN_STATEMENT: {
+		node_index_t call = NO_NODE;
+		tail_t kind = tail_kind(v->node, &call);
+		if (kind == TAIL_NONE) {
+			RECUR(0);
+			memo_store(values[values_height - 1]);
+			INSTR(MOVE, value_pop(), R(EAX));
+			accumulated_return();
+			function_return();
+			DONE();
+		}
+
+		node_t *e = NODE(root->children[0]);
+		node_index_t args = NODE(call)->children[1];
+		node_index_t x = (kind == TAIL_LEFT) ? e->children[0] :
+		                 (kind == TAIL_RIGHT) ? e->children[1] : NO_NODE;
+		if (v->step == 0)
+			NEXT(kind == TAIL_LEFT ? x : args);
+		if (v->step == 1)
+			NEXT(kind == TAIL_LEFT ? args : x);
+
+		/* x may be a parameter, so it goes in before they are overwritten */
+		if (kind == TAIL_RIGHT)
+			accumulate(value_pop());
+		node_t *params = NODE(NODE(tail_function)->children[1]);
+		int32_t n = (args == NO_NODE) ? 0 : NODE(args)->n_children;
+		values_height -= n;
+		if (kind == TAIL_LEFT)
+			accumulate(value_pop());
+
+		/*
+		 * All parameters are set at once: an argument which is another
+		 * parameter is copied before that one is overwritten.
+		 */
+		operand_t *arg = &values[values_height + (kind == TAIL_LEFT)];
+		for (int32_t i = 0; i < n; i++)
+			for (int32_t j = 0; j < n; j++)
+				if (j != i && arg[i].kind == O_VIRTUAL &&
+				        arg[i].reg == NODE(params->children[j])->entry->vreg) {
+					arg[i] = value_copy(arg[i]);
+					break;
+				}
+		for (int32_t i = 0; i < n; i++) {
+			operand_t param = V(NODE(params->children[i])->entry->vreg);
+			if (arg[i].kind != O_VIRTUAL || arg[i].reg != param.reg)
+				INSTR(MOVE, arg[i], param);
+		}
+		tail_jump();
+		DONE();
 	}
-	break;
 
+	case IF_STATEMENT:
+		switch (v->step) {
+		case 0:
+			v->aux = label_new("elseLabel", if_count, false);
+			label_new("endifLabel", if_count++, false);
+			NEXT(root->children[0]);
+		case 1:
+			INSTR(CMPZERO, value_in_register(value_pop()));
+			INSTR(JUMPZERO, L(v->aux));
+			NEXT(root->children[1]);
+		case 2:
+			if (root->n_children == 3) {
+				INSTR(JUMP, L(v->aux + 1));
+				INSTR(LABEL, L(v->aux));
+				NEXT(root->children[2]);
+			}
+			INSTR(LABEL, L(v->aux));
+			DONE();
+		default:
+			INSTR(LABEL, L(v->aux + 1));
+			DONE();
+		}
+
+	case WHILE_STATEMENT:
+		switch (v->step) {
+		case 0:
+			while_count++;
+			v->aux = while_label = label_new("startWhile", while_count, false);
+			label_new("endWhile", while_count, false);
+			INSTR(LABEL, L(v->aux));
+			NEXT(root->children[0]);
+		case 1:
+			INSTR(CMPZERO, value_in_register(value_pop()));
+			INSTR(JUMPZERO, L(v->aux + 1));
+			NEXT(root->children[1]);
+		default:
+			INSTR(JUMP, L(v->aux));
+			INSTR(LABEL, L(v->aux + 1));
+			DONE();
+		}
+
+	case NULL_STATEMENT:
+		if (while_count == 0)
+			while_label = label_new("startWhile", while_count, false);
+		INSTR(JUMP, L(while_label));
+		DONE();
 
 	default:
-		RECUR();
-		break;
-	}
-}
-
-
-static void print_instructions(FILE *output) {
-#define OUT(...) fprintf ( output,##__VA_ARGS__ )
-	instruction_t *i = head;
-	while (i != NULL) {
-		switch (i->op) {
-		case CDQ:
-			OUT("\tcdq\n");
-			break;
-		case LEAVE:
-			OUT("\tleave\n");
-			break;
-		case RET:
-			OUT("\tret\n");
-			break;
-		case SYSLABEL:
-			OUT("%s:\n", i->operands[0]);
-			break;
-		case SYSCALL:
-			OUT("\tcall\t%s\n", i->operands[0]);
-			break;
-		case LABEL:
-			OUT("_%s:\n", i->operands[0]);
-			break;
-		case CALL:
-			OUT("\tcall\t_%s\n", i->operands[0]);
-			break;
-		case JUMP:
-			OUT("\tjmp\t%s\n", i->operands[0]);
-			break;
-		case JUMPZERO:
-			OUT("\tjz\t%s\n", i->operands[0]);
-			break;
-		case JUMPNONZ:
-			OUT("\tjnz\t%s\n", i->operands[0]);
-			break;
-		case PUSH:
-			OUT("\tpushl\t%s\n", i->operands[0]);
-			break;
-		case POP:
-			OUT("\tpopl\t%s\n", i->operands[0]);
-			break;
-		case MUL:
-			OUT("\timull\t%s\n", i->operands[0]);
-			break;
-		case DIV:
-			OUT("\tidivl\t%s\n", i->operands[0]);
-			break;
-		case DEC:
-			OUT("\tdecl\t%s\n", i->operands[0]);
-			break;
-		case NEG:
-			OUT("\tnegl\t%s\n", i->operands[0]);
-			break;
-		case CMPZERO:
-			OUT("\tcmpl\t$0,%s\n", i->operands[0]);
-			break;
-		case CMP:
-			OUT("\tcmpl\t%s,%s\n", i->operands[0], i->operands[1]);
-			break;
-		case MOVE:
-			OUT("\tmovl\t%s,%s\n", i->operands[0], i->operands[1]);
-			break;
-		case ADD:
-			OUT("\taddl\t%s,%s\n", i->operands[0], i->operands[1]);
-			break;
-		case SUB:
-			OUT("\tsubl\t%s,%s\n", i->operands[0], i->operands[1]);
-			break;
-		case LSHIFT:
-			OUT("\tshl\t%s,%s\n", i->operands[0], i->operands[1]);
-			break;
-		}
-		i = i->next;
-	}
-#undef OUT
+		return generate_node(stream, v);
+	}
+}
+
+
+/*
+ * Code generation is a depth-first traversal of the tree, but it keeps an
+ * explicit stack of visits rather than recurring, so the depth of the tree
+ * is only limited by memory. Each node is visited in steps (see
+ * generate_node): a step emits whatever code goes before the next child,
+ * then hands that child over, and the visit picks up where it left off
+ * when the child is done.
+ */
+void generate(FILE *stream, node_index_t root) {
+	walk_t walk = { NULL, 0, 0 };
+	if (root != NO_NODE)
+		walk_push(&walk, root);
+	while (walk.height > 0) {
+		visit_t *v = WALK_TOP(&walk);
+		if (v->step == VISIT_DONE) {
+			walk.height -= 1;
+			continue;
+		}
+		node_index_t child = registers ?
+		                     generate_node_registers(stream, v) :
+		                     generate_node(stream, v);
+		if (child != NO_NODE)
+			walk_push(&walk, child);
+	}
+	walk_finalize(&walk);
 }
+
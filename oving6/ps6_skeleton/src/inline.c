@@ -0,0 +1,343 @@
+#include <inline.h>
+
+
+/*
+ * Inlining of calls to small functions, once names are bound. A call which
+ * makes up the whole of an assignment to a variable, or of a RETURN, is
+ * replaced by a block holding a copy of the function's body,
+ *     x := f(a, b)   ->   { VAR p, q  p := a  q := b  ...  x := r }
+ * where p and q stand in for the parameters, and RETURN r was the last
+ * statement of f. Arguments are evaluated once each, in the same order as
+ * before. The copy gets symbols of its own, which are placed in the frame
+ * of the function it lands in, below the locals it had to begin with, so
+ * the names of the copy can't get mixed up with any others. One copy is
+ * done before the next one starts, so they can all use the same space.
+ *
+ * A function qualifies when that RETURN at the end is its only one, it
+ * has no loops (a CONTINUE goes to the latest loop in the code, which the
+ * copy could change), it is small enough, and it can't lead back to itself
+ * through the call graph. Calls with the wrong number of arguments stay
+ * as they are, for the code generator to report, and so do calls to
+ * memoized functions, which would skip the memo table otherwise.
+ */
+
+/* FUNCTION nodes, in the order of their symbols' index */
+static node_index_t *functions = NULL;
+static uint32_t functions_count = 0;
+
+/* The call graph as lists, see call_lists */
+static uint32_t *first = NULL, *callees = NULL;
+
+/* Whether each function can call itself: 0 when not known yet */
+enum { UNKNOWN, NOT_RECURSIVE, RECURSIVE };
+static uint8_t *recursive = NULL;
+
+/* The symbols of the function being inlined, and those of the copy */
+static symbol_t **from = NULL, **to = NULL;
+static uint32_t map_count = 0, map_size = 0;
+
+
+/* Can function f get back to itself through calls? */
+static bool
+is_recursive(uint32_t f) {
+	if (recursive[f] != UNKNOWN)
+		return recursive[f] == RECURSIVE;
+
+	bool *seen = calloc(functions_count, sizeof(bool));
+	uint32_t *stack = malloc((functions_count + 1) * sizeof(uint32_t));
+	uint32_t height = 0;
+	recursive[f] = NOT_RECURSIVE;
+	stack[height++] = f;
+	while (height > 0 && recursive[f] == NOT_RECURSIVE) {
+		uint32_t g = stack[--height];
+		for (uint32_t c = first[g]; c < first[g + 1]; c++) {
+			uint32_t h = callees[c];
+			if (h == f)
+				recursive[f] = RECURSIVE;
+			else if (!seen[h])
+				seen[h] = true, stack[height++] = h;
+		}
+	}
+	free(stack);
+	free(seen);
+	return recursive[f] == RECURSIVE;
+}
+
+
+/* The last statement of a function body */
+static node_index_t
+last_statement(node_index_t body) {
+	if (NODE(body)->type != BLOCK)
+		return body;
+	node_t *list = NODE(NODE(body)->children[1]);
+	return list->children[list->n_children - 1];
+}
+
+
+/* Does a function qualify for inlining (see above)? */
+static bool
+inlinable(node_index_t function, int32_t budget) {
+	node_index_t body = NODE(function)->children[2];
+	node_index_t last = last_statement(body);
+	if (NODE(last)->type != RETURN_STATEMENT)
+		return false;
+
+	int32_t size = 0;
+	walk_t walk = { NULL, 0, 0 };
+	walk_push(&walk, body);
+	while (walk.height > 0 && size <= budget) {
+		node_index_t node = WALK_TOP(&walk)->node;
+		node_t *n = NODE(node);
+		walk.height -= 1;
+		size += 1;
+		if ((n->type == RETURN_STATEMENT && node != last) ||
+		        n->type == WHILE_STATEMENT || n->type == NULL_STATEMENT)
+			size = budget + 1;
+		for (uint32_t i = 0; i < n->n_children; i++)
+			if (n->children[i] != NO_NODE)
+				walk_push(&walk, n->children[i]);
+	}
+	walk_finalize(&walk);
+	return size <= budget;
+}
+
+
+/* A new symbol for the copy, at the given offset from the frame pointer */
+static symbol_t *
+symbol_copy(symbol_t *old, int32_t offset) {
+	if (map_count == map_size) {
+		map_size = (map_size == 0) ? 64 : 2 * map_size;
+		from = realloc(from, map_size * sizeof(symbol_t *));
+		to = realloc(to, map_size * sizeof(symbol_t *));
+		if (from == NULL || to == NULL) {
+			fprintf(stderr, "Out of memory for inlining\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	symbol_t *new = malloc(sizeof(symbol_t));
+	*new = *old;
+	new->stack_offset = offset;
+	symbol_keep(new);
+	from[map_count] = old;
+	to[map_count++] = new;
+	return new;
+}
+
+
+/* The copy of a symbol, made on first sight by moving it 'shift' bytes */
+static symbol_t *
+symbol_map(symbol_t *old, int32_t shift) {
+	for (uint32_t s = 0; s < map_count; s++)
+		if (from[s] == old)
+			return to[s];
+	return symbol_copy(old, old->stack_offset + shift);
+}
+
+
+/*
+ * Copy a subtree, giving the copy of each variable of the inlined function
+ * its new symbol, and each call in it an edge of its own from the caller.
+ * Children are filled into the copy of their parent (kept in aux) as the
+ * visits to them finish.
+ */
+static node_index_t
+copy_tree(node_index_t root, symbol_t *caller, int32_t shift) {
+	node_index_t copy = NO_NODE;
+	walk_t walk = { NULL, 0, 0 };
+	walk_push(&walk, root);
+	while (walk.height > 0) {
+		visit_t *v = WALK_TOP(&walk);
+		if (v->step == 0) {
+			node_t original = *NODE(v->node);
+			node_index_t c = node_new(original.type, original.op,
+			                          original.value, 0);
+			node_t *n = NODE(c);
+			n->pure = original.pure;
+			n->n_children = original.n_children;
+			n->children = tree_alloc(n->n_children * sizeof(node_index_t));
+			n->entry = original.entry;
+			if (n->type == VARIABLE && n->entry != NULL &&
+			        n->entry->label == NULL)
+				n->entry = symbol_map(n->entry, shift);
+			if (n->type == EXPRESSION && n->op == OP_CALL)
+				call_add(caller, c);
+			v->aux = (int32_t) c;
+		}
+
+		node_t *n = NODE(v->node);
+		if (v->step < n->n_children) {
+			node_index_t child = n->children[v->step++];
+			if (child != NO_NODE)
+				walk_push(&walk, child);
+			else
+				NODE(v->aux)->children[v->step - 1] = NO_NODE;
+		} else {
+			node_index_t c = (node_index_t) v->aux;
+			walk.height -= 1;
+			if (walk.height > 0) {
+				visit_t *parent = WALK_TOP(&walk);
+				NODE(parent->aux)->children[parent->step - 1] = c;
+			} else
+				copy = c;
+		}
+	}
+	walk_finalize(&walk);
+	return copy;
+}
+
+
+static void
+list_add(node_index_t *list, nt_number type, node_index_t item) {
+	if (*list == NO_NODE)
+		*list = node_new(type, OP_NONE, 0, 1, item);
+	else
+		node_append(*list, item);
+}
+
+
+/* The block which takes the place of a statement making a call */
+static node_index_t
+inline_call(node_index_t statement, node_index_t call, node_index_t function,
+            symbol_t *caller, int32_t base) {
+	symbol_t *entry = NODE(NODE(function)->children[0])->entry;
+	node_index_t params = NODE(function)->children[1];
+	node_index_t args = NODE(call)->children[1];
+	int32_t n = entry->n_args;
+	map_count = 0;
+
+	/* The parameters become locals, set to the arguments in order */
+	node_index_t names = NO_NODE, statements = NO_NODE;
+	for (int32_t i = 0; i < n; i++) {
+		node_t *param = NODE(NODE(params)->children[i]);
+		int32_t ident = param->value;
+		symbol_t *local = symbol_copy(param->entry, -(base + 4 * (i + 1)));
+		node_index_t name = node_new(VARIABLE, OP_NONE, ident, 0);
+		node_index_t target = node_new(VARIABLE, OP_NONE, ident, 0);
+		NODE(name)->entry = NODE(target)->entry = local;
+		list_add(&names, VARIABLE_LIST, name);
+		list_add(&statements, STATEMENT_LIST,
+		         node_new(ASSIGNMENT_STATEMENT, OP_NONE, 0, 2,
+		                  target, NODE(args)->children[i]));
+	}
+	if (caller->frame_size < base + 4 * n + entry->frame_size)
+		caller->frame_size = base + 4 * n + entry->frame_size;
+
+	/* The body, whose RETURN at the end gives its value to the statement */
+	node_index_t body = copy_tree(NODE(function)->children[2], caller,
+	                              -(base + 4 * n));
+	if (NODE(statement)->type == ASSIGNMENT_STATEMENT) {
+		node_t *last = NODE(last_statement(body));
+		node_index_t value = last->children[0];
+		last->type = ASSIGNMENT_STATEMENT;
+		last->n_children = 2;
+		last->children = tree_alloc(2 * sizeof(node_index_t));
+		last->children[0] = NODE(statement)->children[0];
+		last->children[1] = value;
+	}
+	list_add(&statements, STATEMENT_LIST, body);
+	calls[NODE(call)->value].call = NO_NODE;
+
+	node_index_t declarations = NO_NODE;
+	if (names != NO_NODE)
+		declarations = node_new(DECLARATION_LIST, OP_NONE, 0, 1,
+		                        node_new(DECLARATION, OP_NONE, 0, 1, names));
+	return node_new(BLOCK, OP_NONE, 0, 2, declarations, statements);
+}
+
+
+/* The call a statement is made of, if it can be inlined */
+static node_index_t
+inline_site(node_index_t statement, int32_t budget) {
+	node_t *s = NODE(statement);
+	node_index_t call;
+	if (s->type == ASSIGNMENT_STATEMENT && s->n_children == 2 &&
+	        NODE(s->children[0])->entry->label == NULL)
+		call = s->children[1];
+	else if (s->type == RETURN_STATEMENT)
+		call = s->children[0];
+	else
+		return NO_NODE;
+
+	node_t *c = NODE(call);
+	if (c->type != EXPRESSION || c->op != OP_CALL)
+		return NO_NODE;
+	symbol_t *f = call_callee(call);
+	int32_t args = (c->children[1] == NO_NODE) ?
+	               0 : NODE(c->children[1])->n_children;
+	if (f == NULL || args != f->n_args || f->memoized ||
+	        is_recursive(f->index) || !inlinable(functions[f->index], budget))
+		return NO_NODE;
+	return call;
+}
+
+
+/* Function bodies are all that is looked through */
+static uint32_t
+first_child(node_t *n) {
+	return (n->type == FUNCTION) ? 2 : 0;
+}
+
+
+uint32_t
+inline_calls(node_index_t root, int32_t budget, int32_t verbosity) {
+	if (root == NO_NODE || budget <= 0)
+		return 0;
+	node_t *list = NODE(NODE(root)->children[0]);
+	functions_count = list->n_children;
+	functions = malloc(functions_count * sizeof(node_index_t));
+	recursive = calloc(functions_count, sizeof(uint8_t));
+	memcpy(functions, list->children, functions_count * sizeof(node_index_t));
+	call_lists(functions_count, &first, &callees);
+
+	/*
+	 * Pre-order traversal of each function, where a statement which is
+	 * inlined is replaced in its parent's list of children (at the child
+	 * the parent's visit handed out last), and not looked into.
+	 */
+	uint32_t inlined = 0;
+	walk_t walk = { NULL, 0, 0 };
+	for (uint32_t f = 0; f < functions_count; f++) {
+		symbol_t *caller = NODE(NODE(functions[f])->children[0])->entry;
+		int32_t base = caller->frame_size;
+		walk_push(&walk, functions[f]);
+		while (walk.height > 0) {
+			visit_t *v = WALK_TOP(&walk);
+			node_index_t call;
+			if (v->step == 0 &&
+			        (call = inline_site(v->node, budget)) != NO_NODE) {
+				symbol_t *entry = call_callee(call);
+				node_index_t block = inline_call(v->node, call,
+				                                 functions[entry->index],
+				                                 caller, base);
+				if (verbosity > 0)
+					fprintf(stderr, "inline: %s into %s\n",
+					        entry->label, caller->label);
+				inlined += 1;
+				walk.height -= 1;
+				visit_t *parent = WALK_TOP(&walk);
+				node_t *p = NODE(parent->node);
+				p->children[first_child(p) + parent->step - 1] = block;
+				continue;
+			}
+
+			node_t *n = NODE(v->node);
+			if (first_child(n) + v->step < n->n_children) {
+				node_index_t child = n->children[first_child(n) + v->step++];
+				if (child != NO_NODE)
+					walk_push(&walk, child);
+			} else
+				walk.height -= 1;
+		}
+	}
+	walk_finalize(&walk);
+
+	free(functions);
+	free(recursive);
+	free(first);
+	free(callees);
+	free(from);
+	free(to);
+	functions = NULL, recursive = NULL, first = callees = NULL;
+	from = to = NULL, map_count = map_size = 0;
+	return inlined;
+}
@@ -0,0 +1,381 @@
+#include <ir.h>
+
+
+instruction_t *instructions = NULL;
+uint32_t instructions_count = 0;
+static uint32_t instructions_size = 0;
+
+label_t *labels = NULL;
+uint32_t labels_count = 0;
+static uint32_t labels_size = 0;
+
+bool x86_64 = false;
+
+
+const char *register_names[] = {
+	[EAX] = "%eax", [EBX] = "%ebx", [ECX] = "%ecx", [EDX] = "%edx",
+	[ESI] = "%esi", [EDI] = "%edi", [EBP] = "%ebp", [ESP] = "%esp"
+};
+
+const char *register_names64[] = {
+	[EAX] = "%rax", [EBX] = "%rbx", [ECX] = "%rcx", [EDX] = "%rdx",
+	[ESI] = "%rsi", [EDI] = "%rdi", [EBP] = "%rbp", [ESP] = "%rsp"
+};
+
+const uint8_t opcode_operands[] = {
+	[NIL] = 0, [CDQ] = 0, [LEAVE] = 0, [RET] = 0,
+	[LABEL] = 1,
+	[PUSH] = 1, [POP] = 1, [MUL] = 1, [DIV] = 1, [DEC] = 1, [NEG] = 1,
+	[CMPZERO] = 1,
+	[CALL] = 1, [JUMP] = 1, [JUMPLESS] = 1, [JUMPZERO] = 1, [JUMPNONZ] = 1,
+	[MOVE] = 2, [ADD] = 2, [SUB] = 2, [CMP] = 2, [LSHIFT] = 2,
+	[RSHIFT] = 2, [URSHIFT] = 2, [IMUL] = 2, [TEST] = 2, [LEA] = 2,
+	[AND] = 2, [EXTEND] = 2
+};
+
+static const char *mnemonics[] = {
+	[CDQ] = "cdq", [LEAVE] = "leave", [RET] = "ret",
+	[PUSH] = "pushl", [POP] = "popl", [MUL] = "imull", [DIV] = "idivl",
+	[DEC] = "decl", [NEG] = "negl", [CMPZERO] = "cmpl\t$0,",
+	[CALL] = "call", [JUMP] = "jmp", [JUMPLESS] = "jl", [JUMPZERO] = "jz",
+	[JUMPNONZ] = "jnz",
+	[MOVE] = "movl", [ADD] = "addl", [SUB] = "subl", [CMP] = "cmpl",
+	[LSHIFT] = "shl", [RSHIFT] = "sarl", [URSHIFT] = "shrl",
+	[IMUL] = "imull", [TEST] = "testl", [LEA] = "leal", [AND] = "andl",
+	[EXTEND] = "movslq"
+};
+
+static const char *mnemonics64[] = {
+	[CDQ] = "cqto", [LEAVE] = "leave", [RET] = "ret",
+	[PUSH] = "pushq", [POP] = "popq", [MUL] = "imulq", [DIV] = "idivq",
+	[DEC] = "decq", [NEG] = "negq", [CMPZERO] = "cmpq\t$0,",
+	[CALL] = "call", [JUMP] = "jmp", [JUMPLESS] = "jl", [JUMPZERO] = "jz",
+	[JUMPNONZ] = "jnz",
+	[MOVE] = "movq", [ADD] = "addq", [SUB] = "subq", [CMP] = "cmpq",
+	[LSHIFT] = "shlq", [RSHIFT] = "sarq", [URSHIFT] = "shrq",
+	[IMUL] = "imulq", [TEST] = "testq", [LEA] = "leaq", [AND] = "andq",
+	[EXTEND] = "movslq"
+};
+
+
+/*
+ * Empty the instruction and label vectors, keeping their storage around.
+ */
+void
+ir_init(void) {
+	instructions_count = 0;
+	labels_count = 0;
+}
+
+
+void
+ir_finalize(void) {
+	free(instructions);
+	free(labels);
+	instructions = NULL, labels = NULL;
+	instructions_size = instructions_count = 0;
+	labels_size = labels_count = 0;
+}
+
+
+void
+instruction_append(instruction_t instr) {
+	if (instructions_count == instructions_size) {
+		instructions_size = (instructions_size == 0) ?
+		                    4096 : 2 * instructions_size;
+		instructions = realloc(instructions,
+		                       instructions_size * sizeof(instruction_t));
+		if (instructions == NULL) {
+			fprintf(stderr, "Out of memory for instructions\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	instructions[instructions_count++] = instr;
+}
+
+
+/*
+ * Append an instruction, taking as many operands (of type operand_t) as
+ * the opcode has.
+ */
+void
+instruction_add(opcode_t op, ...) {
+	instruction_t instr = {
+		.op = op & ~WIDE, .wide = (op & WIDE) != 0
+	};
+	op &= ~WIDE;
+
+	va_list va;
+	va_start(va, op);
+	for (uint8_t i = 0; i < opcode_operands[op]; i++)
+		instr.operands[i] = va_arg(va, operand_t);
+	va_end(va);
+	instruction_append(instr);
+}
+
+
+int32_t
+label_new(const char *name, int32_t number, bool global) {
+	if (labels_count == labels_size) {
+		labels_size = (labels_size == 0) ? 256 : 2 * labels_size;
+		labels = realloc(labels, labels_size * sizeof(label_t));
+		if (labels == NULL) {
+			fprintf(stderr, "Out of memory for labels\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	labels[labels_count] = (label_t) {
+		.name = name, .number = number, .global = global
+	};
+	return labels_count++;
+}
+
+
+/* Does an instruction work on whole registers (see ir.h)? */
+bool
+instruction_wide(instruction_t *instr) {
+	if (!x86_64)
+		return false;
+	if (instr->wide || instr->op == PUSH || instr->op == POP ||
+	        instr->op == MOVE)
+		return true;
+	for (uint8_t o = 0; o < opcode_operands[instr->op]; o++)
+		if (instr->operands[o].kind == O_REGISTER &&
+		        (instr->operands[o].reg == ESP || instr->operands[o].reg == EBP))
+			return true;
+	return false;
+}
+
+
+/* The name of the register of an operand, as wide as it is used */
+const char *
+operand_register(instruction_t *instr, operand_t *o) {
+	if (!x86_64)
+		return register_names[o->reg];
+	if (o->kind != O_REGISTER)
+		return register_names64[o->reg];
+	if (instr->op == EXTEND)
+		return (o == &instr->operands[0]) ?
+		       register_names[o->reg] : register_names64[o->reg];
+	return instruction_wide(instr) ?
+	       register_names64[o->reg] : register_names[o->reg];
+}
+
+
+/* Is an operand memory at a label, which x86-64 reaches through %rip? */
+bool
+label_relative(instruction_t *instr, operand_t *o) {
+	return x86_64 && o->kind == O_LABEL && instr->op != CALL &&
+	       instr->op != JUMP && instr->op != JUMPLESS &&
+	       instr->op != JUMPZERO && instr->op != JUMPNONZ;
+}
+
+
+/*
+ * The name of a label as it is printed, in a buffer of 'size' bytes.
+ * Returns the length of the whole name, like snprintf.
+ */
+int
+label_format(char *buffer, size_t size, int32_t label) {
+	label_t *l = &labels[label];
+	if (l->number >= 0)
+		return snprintf(buffer, size, "%s%s%d",
+		                l->global ? "" : "_", l->name, l->number);
+	return snprintf(buffer, size, "%s%s", l->global ? "" : "_", l->name);
+}
+
+
+static void
+label_print(FILE *stream, int32_t label) {
+	label_t *l = &labels[label];
+	fprintf(stream, "%s%s", l->global ? "" : "_", l->name);
+	if (l->number >= 0)
+		fprintf(stream, "%d", l->number);
+}
+
+
+static void
+operand_print(FILE *stream, instruction_t *instr, operand_t *o) {
+	const char *name = operand_register(instr, o);
+	switch (o->kind) {
+	case O_REGISTER:
+		fputs(name, stream);
+		break;
+	case O_IMMEDIATE:
+		fprintf(stream, "$%d", o->value);
+		break;
+	case O_MEMORY:
+		if (o->value != 0)
+			fprintf(stream, "%d", o->value);
+		fprintf(stream, "(%s)", name);
+		break;
+	case O_VIRTUAL:
+		fprintf(stream, "%%v%d", o->reg);
+		break;
+	case O_VMEMORY:
+		if (o->value != 0)
+			fprintf(stream, "%d", o->value);
+		fprintf(stream, "(%%v%d)", o->reg);
+		break;
+	case O_SCALED:
+		fprintf(stream, "(%s,%s,%d)", name, name, o->value);
+		break;
+	case O_VSCALED:
+		fprintf(stream, "(%%v%d,%%v%d,%d)", o->reg, o->reg, o->value);
+		break;
+	case O_ADDRESS:
+		fputc('$', stream);
+		/* Fall through */
+	case O_LABEL:
+		label_print(stream, o->value);
+		if (label_relative(instr, o))
+			fputs("(%rip)", stream);
+		break;
+	}
+}
+
+
+void
+ir_print(FILE *stream) {
+	for (uint32_t i = 0; i < instructions_count; i++) {
+		instruction_t *instr = &instructions[i];
+		switch (instr->op) {
+		case NIL:
+			break;
+		case LABEL:
+			label_print(stream, instr->operands[0].value);
+			fputs(":\n", stream);
+			break;
+		default:
+			fprintf(stream, "\t%s", instruction_wide(instr) ?
+			        mnemonics64[instr->op] : mnemonics[instr->op]);
+			for (uint8_t o = 0; o < opcode_operands[instr->op]; o++) {
+				if (o > 0 || instr->op != CMPZERO)
+					fputc(o == 0 ? '\t' : ',', stream);
+				operand_print(stream, instr, &instr->operands[o]);
+			}
+			fputc('\n', stream);
+			break;
+		}
+	}
+}
+
+
+/* Registers an operand reads, either as the value or as the address */
+uint32_t
+operand_registers(operand_t *o) {
+	return (o->kind == O_REGISTER || o->kind == O_MEMORY ||
+	        o->kind == O_SCALED) ? REG(o->reg) : 0;
+}
+
+
+/* The operand an instruction stores its result in, if it has one */
+operand_t *
+instruction_destination(instruction_t *instr) {
+	switch (instr->op) {
+	case POP:
+	case DEC:
+	case NEG:
+		return &instr->operands[0];
+	case MOVE:
+	case ADD:
+	case SUB:
+	case LSHIFT:
+	case RSHIFT:
+	case URSHIFT:
+	case IMUL:
+	case LEA:
+	case AND:
+	case EXTEND:
+		return &instr->operands[1];
+	default:
+		return NULL;
+	}
+}
+
+
+/* Registers written by an instruction, stated or implied */
+uint32_t
+registers_written(instruction_t *instr) {
+	uint32_t written = 0;
+	operand_t *d = instruction_destination(instr);
+	if (d != NULL && d->kind == O_REGISTER)
+		written |= REG(d->reg);
+	switch (instr->op) {
+	case CDQ:
+		written |= REG(EDX);
+		break;
+	case MUL:
+	case DIV:
+		written |= REG(EAX) | REG(EDX);
+		break;
+	case CALL:
+		written |= REG(EAX) | REG(ECX) | REG(EDX) | REG(ESP);
+		if (x86_64)
+			written |= REG(ESI) | REG(EDI);
+		break;
+	case LEAVE:
+		written |= REG(EBP) | REG(ESP);
+		break;
+	case PUSH:
+	case POP:
+	case RET:
+		written |= REG(ESP);
+		break;
+	}
+	return written;
+}
+
+
+/* Registers touched by an instruction in any way */
+uint32_t
+registers_used(instruction_t *instr) {
+	uint32_t used = registers_written(instr);
+	for (uint8_t o = 0; o < opcode_operands[instr->op]; o++)
+		used |= operand_registers(&instr->operands[o]);
+	if (instr->op == MUL || instr->op == DIV || instr->op == CDQ)
+		used |= REG(EAX) | REG(EDX);
+	if (instr->op == LEAVE)
+		used |= REG(EBP);
+	return used;
+}
+
+
+/* Registers whose value an instruction depends on */
+uint32_t
+registers_read(instruction_t *instr) {
+	uint32_t read = 0;
+	operand_t *d = instruction_destination(instr);
+	for (uint8_t o = 0; o < opcode_operands[instr->op]; o++) {
+		operand_t *operand = &instr->operands[o];
+		if (operand != d || operand->kind == O_MEMORY ||
+		        (instr->op != MOVE && instr->op != POP &&
+		         instr->op != EXTEND))
+			read |= operand_registers(operand);
+	}
+	switch (instr->op) {
+	case CDQ:
+	case MUL:
+		read |= REG(EAX);
+		break;
+	case DIV:
+		read |= REG(EAX) | REG(EDX);
+		break;
+	case LEAVE:
+		read |= REG(EBP);
+		break;
+	case RET:
+		read |= REG(EAX) | REG(ESP);
+		break;
+	case CALL:
+		/* Arguments to the C library go in registers on x86-64 */
+		if (x86_64)
+			read |= REG(EAX) | REG(EDX) | REG(ESI) | REG(EDI);
+		/* Fall through */
+	case PUSH:
+	case POP:
+		read |= REG(ESP);
+		break;
+	}
+	return read;
+}
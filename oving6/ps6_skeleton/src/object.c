@@ -0,0 +1,703 @@
+/* For MAP_ANONYMOUS, which POSIX leaves out */
+#define _DEFAULT_SOURCE
+#include <object.h>
+#include <symtab.h>
+#include <elf.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+
+
+/* The sections of the file, in the order of the section header table */
+enum {
+	SECTION_NULL, SECTION_TEXT, SECTION_DATA, SECTION_RODATA, SECTION_BSS,
+	SECTION_RELOCATIONS, SECTION_SYMTAB, SECTION_STRTAB, SECTION_SHSTRTAB,
+	SECTION_NOTE, N_SECTIONS
+};
+
+typedef struct {
+	uint8_t *bytes;
+	uint32_t size, capacity;
+} buffer_t;
+
+/*
+ * A symbol of the file. The first few are those of the sections which
+ * hold something, in order from .text, and have no name: references to
+ * labels defined here go through them, at an offset, as an assembler
+ * does it. The rest are labels, found by name through a hash table.
+ */
+typedef struct {
+	char *name;
+	uint16_t section;       /* SECTION_NULL until it is defined */
+	uint8_t type;           /* STT_NOTYPE, STT_FUNC or STT_OBJECT */
+	bool global;
+	uint32_t value;
+	uint32_t index;         /* Position in .symtab */
+	int32_t next;           /* Next symbol in the same hash bucket */
+} object_symbol_t;
+
+typedef struct {
+	uint32_t offset;
+	int32_t symbol;
+	uint32_t type;
+	int32_t addend;
+} relocation_t;
+
+#define SYMBOL_BUCKETS 4096
+
+static buffer_t text, rodata;
+static uint32_t bss_size = 0;
+
+static object_symbol_t *symbols = NULL;
+static uint32_t symbols_size = 0, symbols_count = 0;
+static int32_t buckets[SYMBOL_BUCKETS];
+
+/* The symbol of each label, once it is looked up, or -1 */
+static int32_t *label_symbols = NULL;
+static uint32_t label_symbols_size = 0;
+
+static relocation_t *relocations = NULL;
+static uint32_t relocations_size = 0, relocations_count = 0;
+
+
+static void *
+grow(void *vector, uint32_t *size, uint32_t count, size_t element) {
+	if (count < *size)
+		return vector;
+	*size = (*size == 0) ? 256 : 2 * *size;
+	vector = realloc(vector, *size * element);
+	if (vector == NULL) {
+		fprintf(stderr, "Out of memory for the object file\n");
+		exit(EXIT_FAILURE);
+	}
+	return vector;
+}
+
+
+static void
+buffer_put(buffer_t *b, const void *data, uint32_t length) {
+	if (length == 0)
+		return;
+	while (b->size + length > b->capacity)
+		b->bytes = grow(b->bytes, &b->capacity, b->capacity, 1);
+	memcpy(b->bytes + b->size, data, length);
+	b->size += length;
+}
+
+
+static void
+buffer_free(buffer_t *b) {
+	free(b->bytes);
+	*b = (buffer_t) { NULL, 0, 0 };
+}
+
+
+static uint32_t
+name_hash(const char *name) {
+	uint32_t hash = 2166136261u;
+	for (; *name != '\0'; name++)
+		hash = (hash ^ (uint8_t) *name) * 16777619u;
+	return hash % SYMBOL_BUCKETS;
+}
+
+
+static int32_t
+symbol_add(char *name, uint16_t section) {
+	symbols = grow(symbols, &symbols_size, symbols_count,
+	               sizeof(object_symbol_t));
+	symbols[symbols_count] = (object_symbol_t) {
+		.name = name, .section = section, .type = STT_NOTYPE, .next = -1
+	};
+	return symbols_count++;
+}
+
+
+/* The symbol of a label, made undefined the first time it is named */
+static int32_t
+label_symbol(int32_t label) {
+	if (label_symbols_size < labels_count) {
+		uint32_t size = label_symbols_size;
+		while (label_symbols_size < labels_count)
+			label_symbols = grow(label_symbols, &label_symbols_size,
+			                     label_symbols_size, sizeof(int32_t));
+		for (uint32_t l = size; l < label_symbols_size; l++)
+			label_symbols[l] = -1;
+	}
+	if (label_symbols[label] >= 0)
+		return label_symbols[label];
+
+	int length = label_format(NULL, 0, label);
+	char *name = malloc(length + 1);
+	label_format(name, length + 1, label);
+	uint32_t hash = name_hash(name);
+	int32_t s = buckets[hash];
+	while (s >= 0 && strcmp(symbols[s].name, name) != 0)
+		s = symbols[s].next;
+	if (s >= 0) {
+		free(name);
+	} else {
+		s = symbol_add(name, SECTION_NULL);
+		symbols[s].next = buckets[hash];
+		buckets[hash] = s;
+	}
+	return label_symbols[label] = s;
+}
+
+
+static void
+define(int32_t label, uint16_t section, uint8_t type, uint32_t value) {
+	int32_t symbol = label_symbol(label);
+	object_symbol_t *s = &symbols[symbol];
+	if (s->section != SECTION_NULL) {
+		fprintf(stderr, "Error: label %s is defined twice\n", s->name);
+		exit(EXIT_FAILURE);
+	}
+	s->section = section, s->type = type, s->value = value;
+}
+
+
+void
+object_begin(void) {
+	for (uint32_t b = 0; b < SYMBOL_BUCKETS; b++)
+		buckets[b] = -1;
+	for (uint16_t s = SECTION_TEXT; s <= SECTION_BSS; s++)
+		symbol_add(NULL, s);
+	bss_size = 0;
+}
+
+
+/* A string, given in quotes as it was written in the source */
+void
+object_string(int32_t label, const char *text) {
+	define(label, SECTION_RODATA, STT_OBJECT, rodata.size);
+	char *bytes = malloc(strlen(text));
+	uint32_t length = strings_decode(text, bytes);
+	buffer_put(&rodata, bytes, length + 1);
+	free(bytes);
+}
+
+
+/* Zeroed space, aligned for anything */
+void
+object_reserve(int32_t label, uint32_t size) {
+	bss_size = (bss_size + 15) & ~15u;
+	define(label, SECTION_BSS, STT_OBJECT, bss_size);
+	bss_size += size;
+}
+
+
+/* A label seen from outside the file, like main */
+void
+object_global(int32_t label) {
+	int32_t symbol = label_symbol(label);
+	symbols[symbol].global = true;
+}
+
+
+static bool
+is_jump(instruction_t *instr) {
+	return instr->op == JUMP || instr->op == JUMPLESS ||
+	       instr->op == JUMPZERO || instr->op == JUMPNONZ;
+}
+
+
+static void
+relocate(uint32_t offset, field_t *field, uint8_t length) {
+	int32_t s = label_symbol(field->label);
+	int32_t addend = field->relative ? -(length - field->at) : 0;
+
+	/* Labels defined here are reached from the start of their section */
+	if (symbols[s].section != SECTION_NULL && !symbols[s].global) {
+		addend += symbols[s].value;
+		s = symbols[s].section - SECTION_TEXT;
+	}
+
+	uint32_t type;
+	if (x86_64)
+		type = field->branch ? R_X86_64_PLT32 :
+		       field->relative ? R_X86_64_PC32 : R_X86_64_32;
+	else
+		type = field->relative ? R_386_PC32 : R_386_32;
+
+	relocations = grow(relocations, &relocations_size, relocations_count,
+	                   sizeof(relocation_t));
+	relocations[relocations_count++] = (relocation_t) {
+		.offset = offset, .symbol = s, .type = type, .addend = addend
+	};
+	/* x86 keeps the addend in the code (in .rel, not .rela) */
+	if (!x86_64)
+		memcpy(text.bytes + offset, &addend, 4);
+}
+
+
+/*
+ * Encode the instruction vector in .text. Jumps start out short, and the
+ * ones whose labels turn out to be out of reach of a byte are made near,
+ * which pushes the code apart and may put more labels out of reach, until
+ * nothing changes: jumps only ever grow, so it comes to an end. Then the
+ * distances to labels in the code are filled in, and every other label
+ * gets a relocation.
+ */
+static void
+text_encode(void) {
+	uint32_t n = instructions_count;
+	uint8_t *lengths = malloc(n);
+	uint32_t *starts = malloc((n + 1) * sizeof(uint32_t));
+	bool *near = calloc(n, sizeof(bool));
+	if (n > 0 && (lengths == NULL || starts == NULL || near == NULL)) {
+		fprintf(stderr, "Out of memory for the object file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	uint8_t code[ENCODE_MAX];
+	field_t field;
+	for (uint32_t i = 0; i < n; i++) {
+		instruction_t *instr = &instructions[i];
+		if (instr->op == LABEL) {
+			int32_t label = instr->operands[0].value;
+			int32_t symbol = label_symbol(label);
+			bool function = labels[label].number < 0 &&
+			                (!labels[label].global || symbols[symbol].global);
+			define(label, SECTION_TEXT, function ? STT_FUNC : STT_NOTYPE, 0);
+		}
+		lengths[i] = instruction_encode(instr, false, code, &field);
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		if (!is_jump(&instructions[i]))
+			continue;
+		int32_t target = label_symbol(instructions[i].operands[0].value);
+		if (symbols[target].section != SECTION_TEXT) {
+			fprintf(stderr, "Error: jump to %s, which is not in the code\n",
+			        symbols[target].name);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	bool changed = true;
+	while (changed) {
+		uint32_t offset = 0;
+		for (uint32_t i = 0; i < n; i++) {
+			starts[i] = offset;
+			if (instructions[i].op == LABEL)
+				symbols[label_symbols[instructions[i].operands[0].value]].value =
+				    offset;
+			offset += lengths[i];
+		}
+		starts[n] = offset;
+
+		changed = false;
+		for (uint32_t i = 0; i < n; i++) {
+			if (near[i] || !is_jump(&instructions[i]))
+				continue;
+			int32_t target = label_symbols[instructions[i].operands[0].value];
+			int32_t distance = symbols[target].value - (starts[i] + lengths[i]);
+			if (distance < -128 || distance > 127) {
+				near[i] = changed = true;
+				lengths[i] = instruction_encode(&instructions[i], true, code,
+				                                &field);
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < n; i++) {
+		uint8_t length = instruction_encode(&instructions[i], near[i], code,
+		                                    &field);
+		buffer_put(&text, code, length);
+		if (field.size == 0)
+			continue;
+		int32_t target = label_symbol(field.label);
+		if (field.branch && symbols[target].section == SECTION_TEXT) {
+			int32_t distance = symbols[target].value - (starts[i] + length);
+			memcpy(text.bytes + starts[i] + field.at, &distance, field.size);
+		} else {
+			relocate(starts[i] + field.at, &field, length);
+		}
+	}
+	free(lengths);
+	free(starts);
+	free(near);
+}
+
+
+/* Locals go before globals in .symtab, after the symbol at 0 */
+static uint32_t
+symbols_order(void) {
+	uint32_t index = 1;
+	for (uint32_t s = 0; s < symbols_count; s++)
+		if (symbols[s].section != SECTION_NULL && !symbols[s].global)
+			symbols[s].index = index++;
+	uint32_t first_global = index;
+	for (uint32_t s = 0; s < symbols_count; s++)
+		if (symbols[s].section == SECTION_NULL || symbols[s].global)
+			symbols[s].index = index++;
+	return first_global;
+}
+
+
+static void
+symtab_build(buffer_t *symtab, buffer_t *strtab) {
+	object_symbol_t **ordered = malloc((symbols_count + 1) *
+	                                   sizeof(object_symbol_t *));
+	ordered[0] = NULL;
+	for (uint32_t s = 0; s < symbols_count; s++)
+		ordered[symbols[s].index] = &symbols[s];
+
+	buffer_put(strtab, "", 1);
+	for (uint32_t i = 0; i <= symbols_count; i++) {
+		object_symbol_t *s = ordered[i];
+		uint32_t name = 0, value = 0;
+		uint16_t section = SHN_UNDEF;
+		uint8_t info = 0;
+		if (s != NULL) {
+			if (s->name != NULL) {
+				name = strtab->size;
+				buffer_put(strtab, s->name, strlen(s->name) + 1);
+			}
+			value = s->value, section = s->section;
+			info = (s->name == NULL) ?
+			       ELF32_ST_INFO(STB_LOCAL, STT_SECTION) :
+			       ELF32_ST_INFO((section == SECTION_NULL || s->global) ?
+			                     STB_GLOBAL : STB_LOCAL, s->type);
+		}
+		if (x86_64) {
+			Elf64_Sym sym = {
+				.st_name = name, .st_info = info, .st_shndx = section,
+				.st_value = value
+			};
+			buffer_put(symtab, &sym, sizeof(sym));
+		} else {
+			Elf32_Sym sym = {
+				.st_name = name, .st_info = info, .st_shndx = section,
+				.st_value = value
+			};
+			buffer_put(symtab, &sym, sizeof(sym));
+		}
+	}
+	free(ordered);
+}
+
+
+static void
+relocations_build(buffer_t *rel) {
+	for (uint32_t r = 0; r < relocations_count; r++) {
+		relocation_t *relocation = &relocations[r];
+		uint32_t index = symbols[relocation->symbol].index;
+		if (x86_64) {
+			Elf64_Rela entry = {
+				.r_offset = relocation->offset,
+				.r_info = ELF64_R_INFO(index, relocation->type),
+				.r_addend = relocation->addend
+			};
+			buffer_put(rel, &entry, sizeof(entry));
+		} else {
+			Elf32_Rel entry = {
+				.r_offset = relocation->offset,
+				.r_info = ELF32_R_INFO(index, relocation->type)
+			};
+			buffer_put(rel, &entry, sizeof(entry));
+		}
+	}
+}
+
+
+/* Zeros up to where the next thing is laid out */
+static void
+pad(uint32_t *written, uint32_t offset) {
+	static const char zeros[16] = { 0 };
+	while (*written < offset) {
+		uint32_t n = offset - *written;
+		n = (n > sizeof(zeros)) ? sizeof(zeros) : n;
+		emit_bytes(zeros, n);
+		*written += n;
+	}
+}
+
+
+static void
+object_free(void) {
+	buffer_free(&text);
+	buffer_free(&rodata);
+	for (uint32_t s = 0; s < symbols_count; s++)
+		free(symbols[s].name);
+	free(symbols);
+	free(label_symbols);
+	free(relocations);
+	symbols = NULL, label_symbols = NULL, relocations = NULL;
+	symbols_size = symbols_count = label_symbols_size = 0;
+	relocations_size = relocations_count = 0;
+}
+
+
+/*
+ * Everything is written in the byte order of the machine which runs the
+ * compiler, which is taken to be the one it compiles for.
+ */
+void
+object_write(int fd) {
+	text_encode();
+	uint32_t first_global = symbols_order();
+
+	buffer_t symtab = { NULL, 0, 0 }, strtab = { NULL, 0, 0 },
+	         rel = { NULL, 0, 0 }, shstrtab = { NULL, 0, 0 };
+	symtab_build(&symtab, &strtab);
+	relocations_build(&rel);
+
+	uint32_t word = x86_64 ? 8 : 4;
+	struct {
+		const char *name;
+		uint32_t type, flags, link, info, align, entsize;
+		buffer_t *contents;
+		uint32_t name_at, offset, size;
+	} sections[N_SECTIONS] = {
+		[SECTION_TEXT] = {
+			".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 0, 0, 16, 0,
+			&text
+		},
+		[SECTION_DATA] = {
+			".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 0, 0, 4, 0, NULL
+		},
+		[SECTION_RODATA] = {
+			".rodata", SHT_PROGBITS, SHF_ALLOC, 0, 0, 1, 0, &rodata
+		},
+		[SECTION_BSS] = {
+			".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE, 0, 0, 16, 0, NULL
+		},
+		[SECTION_RELOCATIONS] = {
+			x86_64 ? ".rela.text" : ".rel.text", x86_64 ? SHT_RELA : SHT_REL,
+			SHF_INFO_LINK, SECTION_SYMTAB, SECTION_TEXT, word,
+			x86_64 ? sizeof(Elf64_Rela) : sizeof(Elf32_Rel), &rel
+		},
+		[SECTION_SYMTAB] = {
+			".symtab", SHT_SYMTAB, 0, SECTION_STRTAB, first_global, word,
+			x86_64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym), &symtab
+		},
+		[SECTION_STRTAB] = {
+			".strtab", SHT_STRTAB, 0, 0, 0, 1, 0, &strtab
+		},
+		[SECTION_SHSTRTAB] = {
+			".shstrtab", SHT_STRTAB, 0, 0, 0, 1, 0, &shstrtab
+		},
+		/* The stack needn't be executable */
+		[SECTION_NOTE] = {
+			".note.GNU-stack", SHT_PROGBITS, 0, 0, 0, 1, 0, NULL
+		}
+	};
+
+	buffer_put(&shstrtab, "", 1);
+	for (uint32_t s = 1; s < N_SECTIONS; s++) {
+		sections[s].name_at = shstrtab.size;
+		buffer_put(&shstrtab, sections[s].name, strlen(sections[s].name) + 1);
+	}
+
+	/* Lay out the contents after the header, and the section table last */
+	uint32_t offset = x86_64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+	for (uint32_t s = 1; s < N_SECTIONS; s++) {
+		offset += (sections[s].align - offset % sections[s].align) %
+		          sections[s].align;
+		sections[s].offset = offset;
+		sections[s].size = (s == SECTION_BSS) ? bss_size :
+		                   (sections[s].contents != NULL) ?
+		                   sections[s].contents->size : 0;
+		if (sections[s].type != SHT_NOBITS)
+			offset += sections[s].size;
+	}
+	offset += (word - offset % word) % word;
+
+	emit_open(fd);
+	uint32_t written = 0;
+	if (x86_64) {
+		Elf64_Ehdr header = {
+			.e_ident = {
+				ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3,
+				ELFCLASS64, ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV
+			},
+			.e_type = ET_REL, .e_machine = EM_X86_64, .e_version = EV_CURRENT,
+			.e_shoff = offset, .e_ehsize = sizeof(Elf64_Ehdr),
+			.e_shentsize = sizeof(Elf64_Shdr), .e_shnum = N_SECTIONS,
+			.e_shstrndx = SECTION_SHSTRTAB
+		};
+		emit_bytes((const char *) &header, sizeof(header));
+		written += sizeof(header);
+	} else {
+		Elf32_Ehdr header = {
+			.e_ident = {
+				ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3,
+				ELFCLASS32, ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV
+			},
+			.e_type = ET_REL, .e_machine = EM_386, .e_version = EV_CURRENT,
+			.e_shoff = offset, .e_ehsize = sizeof(Elf32_Ehdr),
+			.e_shentsize = sizeof(Elf32_Shdr), .e_shnum = N_SECTIONS,
+			.e_shstrndx = SECTION_SHSTRTAB
+		};
+		emit_bytes((const char *) &header, sizeof(header));
+		written += sizeof(header);
+	}
+
+	for (uint32_t s = 1; s < N_SECTIONS; s++) {
+		if (sections[s].type == SHT_NOBITS || sections[s].contents == NULL)
+			continue;
+		pad(&written, sections[s].offset);
+		emit_bytes((const char *) sections[s].contents->bytes,
+		           sections[s].size);
+		written += sections[s].size;
+	}
+	pad(&written, offset);
+
+	for (uint32_t s = 0; s < N_SECTIONS; s++) {
+		if (x86_64) {
+			Elf64_Shdr header = { 0 };
+			if (s != SECTION_NULL)
+				header = (Elf64_Shdr) {
+					.sh_name = sections[s].name_at, .sh_type = sections[s].type,
+					.sh_flags = sections[s].flags,
+					.sh_offset = sections[s].offset, .sh_size = sections[s].size,
+					.sh_link = sections[s].link, .sh_info = sections[s].info,
+					.sh_addralign = sections[s].align,
+					.sh_entsize = sections[s].entsize
+				};
+			emit_bytes((const char *) &header, sizeof(header));
+		} else {
+			Elf32_Shdr header = { 0 };
+			if (s != SECTION_NULL)
+				header = (Elf32_Shdr) {
+					.sh_name = sections[s].name_at, .sh_type = sections[s].type,
+					.sh_flags = sections[s].flags,
+					.sh_offset = sections[s].offset, .sh_size = sections[s].size,
+					.sh_link = sections[s].link, .sh_info = sections[s].info,
+					.sh_addralign = sections[s].align,
+					.sh_entsize = sections[s].entsize
+				};
+			emit_bytes((const char *) &header, sizeof(header));
+		}
+	}
+	emit_close();
+
+	buffer_free(&symtab);
+	buffer_free(&strtab);
+	buffer_free(&rel);
+	buffer_free(&shstrtab);
+	object_free();
+}
+
+
+/* Bytes of a stub which jumps into the C library, on x86-64 */
+#define STUB_SIZE 16
+
+static uint32_t
+round_up(uint32_t n, uint32_t alignment) {
+	return (n + alignment - 1) / alignment * alignment;
+}
+
+
+/*
+ * Run the program in this process, instead of writing it out: code and
+ * data go in memory from mmap, and are relocated there the way the linker
+ * would, with the C library found through dlsym. The code at the label
+ * 'entry' (main) is called with the arguments, and doesn't return, since
+ * it ends by calling exit.
+ *
+ * On x86-64, the C library may be further away than 32-bit distances
+ * reach. Calls into it go through stubs after the code, which jump to a
+ * 64-bit address, and its data is read from a copy of its value next to
+ * ours, which does since stdout is the only one, and it is never written.
+ */
+void
+object_run(int32_t entry, int argc, char **argv) {
+	text_encode();
+	int32_t main_symbol = label_symbol(entry);
+
+	/* The undefined symbols are numbered, in their values */
+	uint32_t externals = 0;
+	for (uint32_t s = 0; s < symbols_count; s++)
+		if (symbols[s].section == SECTION_NULL)
+			symbols[s].value = externals++;
+	uintptr_t *addresses = malloc((externals + 1) * sizeof(uintptr_t));
+	void *library = dlopen(NULL, RTLD_NOW);
+	for (uint32_t s = 0; s < symbols_count; s++) {
+		if (symbols[s].section != SECTION_NULL)
+			continue;
+		void *address = (library != NULL) ?
+		                dlsym(library, symbols[s].name) : NULL;
+		if (address == NULL) {
+			fprintf(stderr, "Error: %s is not in the C library\n",
+			        symbols[s].name);
+			exit(EXIT_FAILURE);
+		}
+		addresses[symbols[s].value] = (uintptr_t) address;
+	}
+
+	/* The code and stubs on pages of their own, then the data */
+	uint32_t page = sysconf(_SC_PAGESIZE);
+	uint32_t stubs_at = round_up(text.size, STUB_SIZE);
+	uint32_t rodata_at =
+	    round_up(stubs_at + (x86_64 ? externals * STUB_SIZE : 0), page);
+	uint32_t copies_at = round_up(rodata_at + rodata.size, 16);
+	uint32_t bss_at = round_up(copies_at + (x86_64 ? externals * 8 : 0), 16);
+	uint32_t size = round_up(bss_at + bss_size, page);
+	uint8_t *memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		perror("Could not map memory for the program");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(memory, text.bytes, text.size);
+	memcpy(memory + rodata_at, rodata.bytes, rodata.size);
+	if (x86_64) {
+		for (uint32_t e = 0; e < externals; e++) {
+			/* jmp *0(%rip), followed by the address */
+			uint8_t *stub = memory + stubs_at + e * STUB_SIZE;
+			memcpy(stub, "\xFF\x25\0\0\0\0", 6);
+			memcpy(stub + 6, &addresses[e], 8);
+		}
+	}
+
+	uintptr_t bases[] = {
+		[SECTION_TEXT] = (uintptr_t) memory,
+		[SECTION_DATA] = (uintptr_t) memory + bss_at,
+		[SECTION_RODATA] = (uintptr_t) memory + rodata_at,
+		[SECTION_BSS] = (uintptr_t) memory + bss_at
+	};
+	for (uint32_t r = 0; r < relocations_count; r++) {
+		relocation_t *relocation = &relocations[r];
+		object_symbol_t *s = &symbols[relocation->symbol];
+		uint8_t *at = memory + relocation->offset;
+		uintptr_t target;
+		if (s->section != SECTION_NULL) {
+			target = bases[s->section] + s->value;
+		} else if (!x86_64) {
+			target = addresses[s->value];
+		} else if (relocation->type == R_X86_64_PLT32) {
+			target = (uintptr_t) memory + stubs_at + s->value * STUB_SIZE;
+		} else {
+			uint8_t *copy = memory + copies_at + s->value * 8;
+			memcpy(copy, (void *) addresses[s->value], 8);
+			target = (uintptr_t) copy;
+		}
+
+		/* x86 has the addend in the code already */
+		int32_t addend = relocation->addend;
+		if (!x86_64)
+			memcpy(&addend, at, 4);
+		bool relative = x86_64 ? relocation->type != R_X86_64_32 :
+		                relocation->type == R_386_PC32;
+		int64_t value = (int64_t) target + addend -
+		                (relative ? (int64_t) (uintptr_t) at : 0);
+		if (x86_64 && (relative ? value < INT32_MIN || value > INT32_MAX :
+		               value < 0 || value > UINT32_MAX)) {
+			fprintf(stderr, "Error: %s is out of reach of the code\n",
+			        s->name != NULL ? s->name : "a section");
+			exit(EXIT_FAILURE);
+		}
+		uint32_t field = value;
+		memcpy(at, &field, 4);
+	}
+
+	if (mprotect(memory, rodata_at, PROT_READ | PROT_EXEC) != 0) {
+		perror("Could not make the program executable");
+		exit(EXIT_FAILURE);
+	}
+	int (*run)(int, char **) =
+	    (int (*)(int, char **)) (memory + symbols[main_symbol].value);
+	free(addresses);
+	object_free();
+	exit(run(argc, argv));
+}
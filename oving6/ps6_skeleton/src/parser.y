@@ -3,30 +3,37 @@
 #include "tree.h"
 
 /* This defines the type for every $$ value in the productions. */
-#define YYSTYPE node_t *
+#define YYSTYPE node_index_t
+
+/*
+ * Nested parentheses and statements stack up on the parser stack, which
+ * bison keeps on the heap and grows on demand; the default limit of 10000
+ * entries is far too little for machine-generated programs.
+ */
+#define YYMAXDEPTH (1 << 26)
 
 /*
  * Convenience macros for repeated code. These macros are named CN for "create
  * node", number of children (3 is the most we need for a basic VSL syntax
- * tree), and with a trailing N or D for the data label (N is "NULL", D means
- * something goes in the data pointer).
+ * tree), and with a trailing letter for the label: N for none, O for an
+ * operator, and V for a value (the integer, identifier or string number).
  */
-#define CN0D(node,type,data)\
-    node_init ( node = malloc(sizeof(node_t)), type, data, 0 )
 #define CN0N(node,type)\
-    node_init ( node = malloc(sizeof(node_t)), type, NULL, 0 )
-#define CN1D(node,type,data,A) \
-    node_init ( node = malloc(sizeof(node_t)), type, data, 1, A )
+    node = node_new ( type, OP_NONE, 0, 0 )
+#define CN0V(node,type,value)\
+    node = node_new ( type, OP_NONE, value, 0 )
 #define CN1N(node,type,A) \
-    node_init ( node = malloc(sizeof(node_t)), type, NULL, 1, A )
-#define CN2D(node,type,data,A,B) \
-    node_init ( node = malloc(sizeof(node_t)), type, data, 2, A, B )
+    node = node_new ( type, OP_NONE, 0, 1, A )
+#define CN1O(node,type,op,A) \
+    node = node_new ( type, op, 0, 1, A )
+#define CN1V(node,type,value,A) \
+    node = node_new ( type, OP_NONE, value, 1, A )
 #define CN2N(node,type,A,B) \
-    node_init ( node = malloc(sizeof(node_t)), type, NULL, 2, A, B )
+    node = node_new ( type, OP_NONE, 0, 2, A, B )
+#define CN2O(node,type,op,A,B) \
+    node = node_new ( type, op, 0, 2, A, B )
 #define CN3N(node,type,A,B,C) \
-    node_init ( node = malloc(sizeof(node_t)), type, NULL, 3, A, B, C )
-#define CN3D(node,type,data,A,B,C) \
-    node_init ( node = malloc(sizeof(node_t)), type, data, 3, A, B, C )
+    node = node_new ( type, OP_NONE, 0, 3, A, B, C )
 
 /*
  * Variables connecting the parser to the state of the scanner - defs. will be
@@ -43,7 +50,7 @@ extern int yylineno;
  * variable will let us get a hold of the tree root after it has been
  * generated.
  */
-node_t *root;
+node_index_t root;
 
 
 /*
@@ -81,6 +88,9 @@ int yylex ( void );                 /* Defined in the generated scanner */
  * structure which we can traverse in subsequent phases in order to understand
  * the parsed program. (The leaf nodes at the bottom need somewhat more
  * specific rules, but these should be manageable.)
+ * Lists are the exception: rather than nesting a new list node for every
+ * element, the left-recursive list rules append to the node they already
+ * have, so lists come out of the parser flat.
  * A lot of the work to be done later could be handled here instead (reducing
  * the number of passes over the syntax tree), but sticking to a parser which
  * only generates a tree makes it easier to rule it out as an error source in
@@ -89,94 +99,96 @@ int yylex ( void );                 /* Defined in the generated scanner */
 
 %%
 program: function_list {
-    node_init ( root = malloc(sizeof(node_t)), program_n, NULL, 1, $1);
+    root = node_new ( PROGRAM, OP_NONE, 0, 1, $1 );
 };
-function_list: function      { CN1N ( $$, function_list_n, $1 ); }
-    | function_list function { CN2N ( $$, function_list_n, $1, $2 ); }
+function_list: function      { CN1N ( $$, FUNCTION_LIST, $1 ); }
+    | function_list function { node_append ( $$ = $1, $2 ); }
     ;
-statement_list: statement       { CN1N ( $$, statement_list_n, $1 ); }
-    | statement_list statement  { CN2N ( $$, statement_list_n, $1, $2 ); }
+statement_list: statement       { CN1N ( $$, STATEMENT_LIST, $1 ); }
+    | statement_list statement  { node_append ( $$ = $1, $2 ); }
     ;
-print_list: print_item          { CN1N ( $$, print_list_n, $1 ); }
-    | print_list ',' print_item { CN2N ( $$, print_list_n, $1, $3 ); }
+print_list: print_item          { CN1N ( $$, PRINT_LIST, $1 ); }
+    | print_list ',' print_item { node_append ( $$ = $1, $3 ); }
     ;
-expression_list: expression          { CN1N ( $$, expression_list_n, $1 ); }
-    | expression_list ',' expression { CN2N ( $$, expression_list_n, $1, $3); }
+expression_list: expression          { CN1N ( $$, EXPRESSION_LIST, $1 ); }
+    | expression_list ',' expression { node_append ( $$ = $1, $3 ); }
     ;
-variable_list: variable          { CN1N ( $$, variable_list_n, $1 ); }
-    | indexed_variable { CN1N ( $$, variable_list_n, $1 ); }
-    | variable_list ',' variable { CN2N ( $$, variable_list_n, $1, $3 ); }
-    | variable_list ',' indexed_variable { CN2N ( $$, variable_list_n, $1, $3 ); }
+variable_list: variable          { CN1N ( $$, VARIABLE_LIST, $1 ); }
+    | indexed_variable { CN1N ( $$, VARIABLE_LIST, $1 ); }
+    | variable_list ',' variable { node_append ( $$ = $1, $3 ); }
+    | variable_list ',' indexed_variable { node_append ( $$ = $1, $3 ); }
     ;
-argument_list: expression_list  { CN1N ( $$, argument_list_n, $1 ); }
-    | /* e */                   { $$ = NULL; }
+argument_list: expression_list  { CN1N ( $$, ARGUMENT_LIST, $1 ); }
+    | /* e */                   { $$ = NO_NODE; }
     ;
 parameter_list:
-      variable_list { CN1N ( $$, parameter_list_n, $1 ); }
-    | /* e */       { $$ = NULL; }
+      variable_list { CN1N ( $$, PARAMETER_LIST, $1 ); }
+    | /* e */       { $$ = NO_NODE; }
     ;
 declaration_list:
-      declaration_list declaration  { CN2N( $$, declaration_list_n, $1, $2); }
-    | /* e */                       { $$ = NULL; }
+      declaration_list declaration
+        {
+            if ( $1 == NO_NODE )
+                CN1N ( $$, DECLARATION_LIST, $2 );
+            else
+                node_append ( $$ = $1, $2 );
+        }
+    | /* e */                       { $$ = NO_NODE; }
     ;
 function:
       FUNC variable '(' parameter_list ')' statement
-        { CN3N ( $$, function_n, $2, $4, $6 ); }
+        { CN3N ( $$, FUNCTION, $2, $4, $6 ); }
     ;
 statement:
-      assignment_statement { CN1N ( $$, statement_n, $1 ); }
-    | return_statement     { CN1N ( $$, statement_n, $1 ); }
-    | print_statement      { CN1N ( $$, statement_n, $1 ); }
-    | null_statement       { CN1N ( $$, statement_n, $1 ); }
-    | if_statement         { CN1N ( $$, statement_n, $1 ); }
-    | while_statement      { CN1N ( $$, statement_n, $1 ); }
-    | block                { CN1N ( $$, statement_n, $1 ); }
-    ;
-block: '{' declaration_list statement_list '}' { CN2N( $$, block_n, $2, $3); };
-assignment_statement: variable ASSIGN expression { CN2N( $$, assignment_statement_n, $1, $3); }
-      | variable '[' expression ']' ASSIGN expression { CN3N( $$, assignment_statement_n, $1, $3, $6); }
-    ;
-return_statement: RETURN expression { CN1N ( $$, return_statement_n, $2 ); };
-print_statement:  PRINT print_list { CN1N ( $$, print_statement_n, $2 ); };
-null_statement:   CONTINUE { CN0N ( $$, null_statement_n ); };
+      assignment_statement { CN1N ( $$, STATEMENT, $1 ); }
+    | return_statement     { CN1N ( $$, STATEMENT, $1 ); }
+    | print_statement      { CN1N ( $$, STATEMENT, $1 ); }
+    | null_statement       { CN1N ( $$, STATEMENT, $1 ); }
+    | if_statement         { CN1N ( $$, STATEMENT, $1 ); }
+    | while_statement      { CN1N ( $$, STATEMENT, $1 ); }
+    | block                { CN1N ( $$, STATEMENT, $1 ); }
+    ;
+block: '{' declaration_list statement_list '}' { CN2N( $$, BLOCK, $2, $3); };
+assignment_statement: variable ASSIGN expression { CN2N( $$, ASSIGNMENT_STATEMENT, $1, $3); }
+      | variable '[' expression ']' ASSIGN expression { CN3N( $$, ASSIGNMENT_STATEMENT, $1, $3, $6); }
+    ;
+return_statement: RETURN expression { CN1N ( $$, RETURN_STATEMENT, $2 ); };
+print_statement:  PRINT print_list { CN1N ( $$, PRINT_STATEMENT, $2 ); };
+null_statement:   CONTINUE { CN0N ( $$, NULL_STATEMENT ); };
 if_statement:
       IF expression THEN statement FI
-        { CN2N ( $$, if_statement_n, $2, $4); }
+        { CN2N ( $$, IF_STATEMENT, $2, $4); }
     | IF expression THEN statement ELSE statement FI
-        { CN3N ( $$, if_statement_n, $2, $4, $6 ); }
+        { CN3N ( $$, IF_STATEMENT, $2, $4, $6 ); }
     ;
 while_statement:
       WHILE expression DO statement DONE
-        { CN2N ( $$, while_statement_n, $2, $4 ); }
+        { CN2N ( $$, WHILE_STATEMENT, $2, $4 ); }
     ;
 print_item:
-      expression { CN1N ( $$, print_item_n, $1 ); }
-    | text       { CN1N ( $$, print_item_n, $1 ); }
+      expression { CN1N ( $$, PRINT_ITEM, $1 ); }
+    | text       { CN1N ( $$, PRINT_ITEM, $1 ); }
     ;
 expression:
-      expression '+' expression { CN2D( $$, expression_n, STRDUP("+"),$1,$3 ); }
-    | expression '-' expression { CN2D( $$, expression_n, STRDUP("-"),$1,$3 ); }
-    | expression '*' expression { CN2D( $$, expression_n, STRDUP("*"),$1,$3 ); }
-    | expression '/' expression { CN2D( $$, expression_n, STRDUP("/"),$1,$3 ); }
-    | expression POWER expression { CN2D( $$, expression_n, STRDUP("^"), $1, $3); }
-    | '-' expression %prec UMINUS { CN1D( $$, expression_n, STRDUP("-"), $2); }
-    | '(' expression ')'          { CN1N ( $$, expression_n, $2 ); }
-    | integer                     { CN1N ( $$, expression_n, $1 ); }
-    | variable                    { CN1N ( $$, expression_n, $1 ); }
-    | variable '(' argument_list ')' { CN2D ( $$, expression_n, STRDUP("F"), $1, $3 ); }
-    | variable '[' expression ']' { CN2D ( $$, expression_n, STRDUP("A"), $1, $3 ); }
-    ;
-declaration: VAR variable_list { CN1N ( $$, declaration_n, $2 ); };
-indexed_variable:     variable '[' integer ']' { CN1D ( $$, variable_n, $1->data, $3); free($1);};
-variable:    IDENTIFIER { CN0D ( $$, variable_n, STRDUP(yytext) ); };
-text:        STRING { CN0D ( $$, text_n, STRDUP(yytext) ); };
-integer:
-      NUMBER
-      {
-        CN0D ( $$, integer_n, calloc ( 1, sizeof(int32_t) ) );
-        *((int32_t *)$$->data) = strtol ( yytext, NULL, 10 );
-      }
-    ;
+      expression '+' expression { CN2O ( $$, EXPRESSION, OP_ADD, $1, $3 ); }
+    | expression '-' expression { CN2O ( $$, EXPRESSION, OP_SUB, $1, $3 ); }
+    | expression '*' expression { CN2O ( $$, EXPRESSION, OP_MUL, $1, $3 ); }
+    | expression '/' expression { CN2O ( $$, EXPRESSION, OP_DIV, $1, $3 ); }
+    | expression POWER expression { CN2O ( $$, EXPRESSION, OP_POW, $1, $3 ); }
+    | '-' expression %prec UMINUS { CN1O ( $$, EXPRESSION, OP_NEG, $2 ); }
+    | '(' expression ')'          { CN1N ( $$, EXPRESSION, $2 ); }
+    | integer                     { CN1N ( $$, EXPRESSION, $1 ); }
+    | variable                    { CN1N ( $$, EXPRESSION, $1 ); }
+    | variable '(' argument_list ')' { CN2O ( $$, EXPRESSION, OP_CALL, $1, $3 ); }
+    | variable '[' expression ']' { CN2O ( $$, EXPRESSION, OP_INDEX, $1, $3 ); }
+    ;
+declaration: VAR variable_list { CN1N ( $$, DECLARATION, $2 ); };
+indexed_variable:
+      variable '[' integer ']' { CN1V ( $$, VARIABLE, NODE($1)->value, $3 ); }
+    ;
+variable:    IDENTIFIER { CN0V ( $$, VARIABLE, ident_add ( yytext ) ); };
+text:        STRING { CN0V ( $$, TEXT, strings_add ( tree_strdup ( yytext ) ) ); };
+integer:     NUMBER { CN0V ( $$, INTEGER, strtol ( yytext, NULL, 10 ) ); };
 %%
 
 
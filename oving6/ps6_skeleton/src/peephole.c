@@ -0,0 +1,283 @@
+#include <peephole.h>
+
+
+/*
+ * Peephole optimization of the generated code.
+ * Each rule looks at the instruction at a given position and the ones
+ * around it, and rewrites them if it can. A rule only ever changes the code
+ * by removing at least one instruction (turning it into a NIL), so running
+ * the rules over and over until none of them applies anywhere is bound to
+ * stop.
+ *
+ * The rules rely on one property of the code from the generator: a value
+ * on the stack is only reached through %esp while it is a temporary, never
+ * through %ebp or another register.
+ */
+
+/* How far the rules look for the other end of a pattern */
+#define WINDOW 16
+
+/* The next (or previous) instruction which is still there, if any */
+static int64_t
+live_after(int64_t i) {
+	while (++i < instructions_count)
+		if (instructions[i].op != NIL)
+			return i;
+	return -1;
+}
+
+
+static int64_t
+live_before(int64_t i) {
+	while (--i >= 0)
+		if (instructions[i].op != NIL)
+			return i;
+	return -1;
+}
+
+
+static bool
+same_operand(operand_t *a, operand_t *b) {
+	if (a->kind != b->kind)
+		return false;
+	switch (a->kind) {
+	case O_REGISTER:
+		return a->reg == b->reg;
+	case O_MEMORY:
+	case O_SCALED:
+		return a->reg == b->reg && a->value == b->value;
+	default:
+		return a->value == b->value;
+	}
+}
+
+
+static bool
+writes_memory(instruction_t *instr) {
+	operand_t *d = instruction_destination(instr);
+	return instr->op == PUSH || instr->op == CALL ||
+	       (d != NULL && (d->kind == O_MEMORY || d->kind == O_LABEL));
+}
+
+
+/* Instructions that end a straight line of code */
+static bool
+control_flow(instruction_t *instr) {
+	switch (instr->op) {
+	case LABEL:
+	case CALL:
+	case RET:
+	case JUMP:
+	case JUMPLESS:
+	case JUMPZERO:
+	case JUMPNONZ:
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+static bool
+is_memory(operand_t *o) {
+	return o->kind == O_MEMORY || o->kind == O_LABEL;
+}
+
+
+/*
+ * pushl X ... popl Y, with nothing in between that touches the stack or
+ * changes X, becomes movl X,Y (or nothing at all, when X is Y).
+ */
+static uint32_t
+push_pop(uint32_t i) {
+	instruction_t *push = &instructions[i];
+	if (push->op != PUSH)
+		return 0;
+	operand_t *x = &push->operands[0];
+	uint32_t x_registers = operand_registers(x);
+
+	int64_t j = i;
+	for (uint32_t n = 0; n < WINDOW; n++) {
+		if ((j = live_after(j)) < 0)
+			return 0;
+		instruction_t *instr = &instructions[j];
+		if (instr->op == POP)
+			break;
+		if (control_flow(instr) || (registers_used(instr) & REG(ESP)) ||
+		        (registers_written(instr) & x_registers) ||
+		        (is_memory(x) && writes_memory(instr)))
+			return 0;
+	}
+	if (j < 0 || instructions[j].op != POP)
+		return 0;
+
+	instruction_t *pop = &instructions[j];
+	operand_t *y = &pop->operands[0];
+	if (same_operand(x, y)) {
+		push->op = pop->op = NIL;
+		return 2;
+	}
+	if (is_memory(x) && is_memory(y))
+		return 0;
+	if (y->kind != O_REGISTER && live_after(i) != j)
+		return 0;
+	*pop = (instruction_t) {
+		.op = MOVE, .operands = { *x, *y }
+	};
+	push->op = NIL;
+	return 1;
+}
+
+
+/* movl X,X does nothing */
+static uint32_t
+self_move(uint32_t i) {
+	instruction_t *instr = &instructions[i];
+	if (instr->op != MOVE ||
+	        !same_operand(&instr->operands[0], &instr->operands[1]))
+		return 0;
+	instr->op = NIL;
+	return 1;
+}
+
+
+/*
+ * Adding, subtracting or shifting by 0 does nothing but set the flags, so
+ * it can go as long as no conditional jump comes right after it.
+ */
+static uint32_t
+no_op(uint32_t i) {
+	instruction_t *instr = &instructions[i];
+	if ((instr->op != ADD && instr->op != SUB && instr->op != LSHIFT &&
+	        instr->op != RSHIFT && instr->op != URSHIFT) ||
+	        instr->operands[0].kind != O_IMMEDIATE ||
+	        instr->operands[0].value != 0)
+		return 0;
+	int64_t next = live_after(i);
+	if (next >= 0) {
+		uint8_t op = instructions[next].op;
+		if (op == JUMPZERO || op == JUMPNONZ || op == JUMPLESS)
+			return 0;
+	}
+	instr->op = NIL;
+	return 1;
+}
+
+
+/*
+ * A register to register copy which was already made, with neither
+ * register changed since, is redundant. This takes out the reloads of
+ * %ebp into %ecx before each variable access.
+ */
+static uint32_t
+copied_again(uint32_t i) {
+	instruction_t *copy = &instructions[i];
+	if (copy->op != MOVE || copy->operands[0].kind != O_REGISTER ||
+	        copy->operands[1].kind != O_REGISTER)
+		return 0;
+	uint32_t both = REG(copy->operands[0].reg) | REG(copy->operands[1].reg);
+
+	int64_t j = i;
+	for (uint32_t n = 0; n < WINDOW; n++) {
+		if ((j = live_before(j)) < 0)
+			return 0;
+		instruction_t *instr = &instructions[j];
+		if (instr->op == MOVE &&
+		        same_operand(&instr->operands[0], &copy->operands[0]) &&
+		        same_operand(&instr->operands[1], &copy->operands[1])) {
+			copy->op = NIL;
+			return 1;
+		}
+		if (instr->op == LABEL || (registers_written(instr) & both))
+			return 0;
+	}
+	return 0;
+}
+
+
+/*
+ * A value moved into a register which is overwritten before anything
+ * reads it is never used. Past the end of a straight line of code, the
+ * register is taken to be in use.
+ */
+static uint32_t
+dead_move(uint32_t i) {
+	instruction_t *move = &instructions[i];
+	if (move->op != MOVE || move->operands[1].kind != O_REGISTER)
+		return 0;
+	uint32_t r = REG(move->operands[1].reg);
+	if (r == REG(ESP) || r == REG(EBP))
+		return 0;
+
+	int64_t j = i;
+	for (uint32_t n = 0; n < WINDOW; n++) {
+		if ((j = live_after(j)) < 0)
+			return 0;
+		instruction_t *instr = &instructions[j];
+		if (control_flow(instr) || (registers_read(instr) & r))
+			return 0;
+		if (registers_written(instr) & r) {
+			move->op = NIL;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/* A jump to the label right after it goes where it would go anyway */
+static uint32_t
+jump_to_next(uint32_t i) {
+	instruction_t *jump = &instructions[i];
+	if (jump->op != JUMP && jump->op != JUMPZERO &&
+	        jump->op != JUMPNONZ && jump->op != JUMPLESS)
+		return 0;
+	for (int64_t j = live_after(i); j >= 0; j = live_after(j)) {
+		instruction_t *instr = &instructions[j];
+		if (instr->op != LABEL)
+			return 0;
+		if (instr->operands[0].value == jump->operands[0].value) {
+			jump->op = NIL;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+static const struct {
+	const char *name;
+	uint32_t (*apply)(uint32_t i);
+} rules[] = {
+	{ "push/pop forwarding", push_pop },
+	{ "self move", self_move },
+	{ "no-op arithmetic", no_op },
+	{ "repeated copy", copied_again },
+	{ "dead move", dead_move },
+	{ "jump to next", jump_to_next }
+};
+
+#define N_RULES (sizeof(rules) / sizeof(rules[0]))
+
+
+uint32_t
+peephole_optimize(int32_t verbosity) {
+	uint32_t removed[N_RULES] = { 0 }, total = 0, changed;
+	do {
+		changed = 0;
+		for (uint32_t i = 0; i < instructions_count; i++)
+			for (uint32_t r = 0; r < N_RULES; r++) {
+				if (instructions[i].op == NIL)
+					break;
+				uint32_t n = rules[r].apply(i);
+				removed[r] += n, changed += n;
+			}
+		total += changed;
+	} while (changed > 0);
+
+	if (verbosity > 1)
+		for (uint32_t r = 0; r < N_RULES; r++)
+			fprintf(stderr, "peephole: %s removed %u\n",
+			        rules[r].name, removed[r]);
+	return total;
+}
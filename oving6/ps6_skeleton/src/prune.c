@@ -0,0 +1,77 @@
+#include <prune.h>
+
+
+/*
+ * Dead function elimination. The program starts in the first function,
+ * so any function the call graph doesn't lead to from there never runs.
+ * It is taken out of the list of functions, its calls out of the call
+ * graph, and the strings nothing else prints out of the data segment.
+ * The other functions keep their order, and their strings their numbers.
+ */
+uint32_t
+prune_functions(node_index_t root, int32_t verbosity) {
+	if (root == NO_NODE)
+		return 0;
+	node_t *list = NODE(NODE(root)->children[0]);
+	uint32_t count = list->n_children;
+
+	/* Functions reachable from the first one */
+	uint32_t *first, *callees;
+	call_lists(count, &first, &callees);
+	bool *live = calloc(count, sizeof(bool));
+	uint32_t *stack = malloc(count * sizeof(uint32_t)), height = 0;
+	if (live == NULL || stack == NULL) {
+		fprintf(stderr, "Out of memory for pruning\n");
+		exit(EXIT_FAILURE);
+	}
+	live[0] = true;
+	stack[height++] = 0;
+	while (height > 0) {
+		uint32_t f = stack[--height];
+		for (uint32_t c = first[f]; c < first[f + 1]; c++)
+			if (!live[callees[c]])
+				live[callees[c]] = true, stack[height++] = callees[c];
+	}
+	free(stack);
+	free(first);
+	free(callees);
+
+	for (uint32_t e = 0; e < calls_count; e++)
+		if (!live[calls[e].caller->index])
+			calls[e].call = NO_NODE;
+
+	uint32_t kept = 0;
+	for (uint32_t f = 0; f < count; f++) {
+		node_index_t function = list->children[f];
+		symbol_t *entry = NODE(NODE(function)->children[0])->entry;
+		if (live[f]) {
+			entry->index = kept;
+			list->children[kept++] = function;
+		} else if (verbosity > 0) {
+			fprintf(stderr, "prune: %s is never called\n", entry->label);
+		}
+	}
+	list->n_children = kept;
+	free(live);
+
+	/* Strings printed by what is left */
+	int32_t strings = strings_count();
+	bool *printed = calloc(strings + 1, sizeof(bool));
+	walk_t walk = { NULL, 0, 0 };
+	walk_push(&walk, root);
+	while (walk.height > 0) {
+		node_t *n = NODE(WALK_TOP(&walk)->node);
+		walk.height -= 1;
+		if (n->type == TEXT)
+			printed[n->value] = true;
+		for (uint32_t i = 0; i < n->n_children; i++)
+			if (n->children[i] != NO_NODE)
+				walk_push(&walk, n->children[i]);
+	}
+	walk_finalize(&walk);
+	for (int32_t s = 0; s < strings; s++)
+		if (!printed[s])
+			strings_drop(s);
+	free(printed);
+	return count - kept;
+}
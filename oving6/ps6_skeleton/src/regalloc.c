@@ -0,0 +1,475 @@
+#include <regalloc.h>
+
+
+/*
+ * Live interval of a virtual register: the first and last position (from
+ * the start of the function) where it appears, stretched over any loop it
+ * is live into. Where it ends up is either a physical register, or a word
+ * in the stack frame when it is spilled.
+ */
+typedef struct {
+	uint32_t start, end;
+	int32_t reg, slot;
+	bool fixed;     /* Made by spilling, so it must not be spilled itself */
+} interval_t;
+
+#define UNUSED UINT32_MAX
+#define NO_REGISTER (-1)
+#define SPILLED (-2)
+
+/* The registers up for allocation, in order of preference */
+static const reg_t pool[] = { EAX, ECX, EDX, EBX, ESI, EDI };
+#define POOL_SIZE (sizeof(pool) / sizeof(pool[0]))
+#define CALLEE_SAVED (REG(EBX) | REG(ESI) | REG(EDI))
+
+static interval_t *vregs = NULL;
+static uint32_t vregs_count = 0, vregs_size = 0;
+
+/* Positions of the instructions using each physical register */
+static uint32_t *uses[ESP + 1];
+static uint32_t uses_count[ESP + 1], uses_size[ESP + 1];
+
+/* Loops, as the positions of the label at the top and the jump back */
+typedef struct {
+	uint32_t top, bottom;
+} loop_t;
+
+static loop_t *loops = NULL;
+static uint32_t loops_count = 0, loops_size = 0;
+
+static int64_t *label_positions = NULL;
+static uint32_t label_positions_size = 0;
+
+
+static void *
+grow(void *vector, uint32_t *size, uint32_t count, size_t element) {
+	if (count < *size)
+		return vector;
+	*size = (*size == 0) ? 64 : 2 * *size;
+	vector = realloc(vector, *size * element);
+	if (vector == NULL) {
+		fprintf(stderr, "Out of memory for register allocation\n");
+		exit(EXIT_FAILURE);
+	}
+	return vector;
+}
+
+
+void
+regalloc_begin(void) {
+	vregs_count = 0;
+}
+
+
+int32_t
+vreg_new(void) {
+	vregs = grow(vregs, &vregs_size, vregs_count, sizeof(interval_t));
+	vregs[vregs_count] = (interval_t) {
+		.start = UNUSED, .reg = NO_REGISTER, .fixed = false
+	};
+	return vregs_count++;
+}
+
+
+static void
+touch(uint32_t vreg, uint32_t position) {
+	if (vregs[vreg].start == UNUSED)
+		vregs[vreg].start = position;
+	vregs[vreg].end = position;
+}
+
+
+static int
+loop_order(const void *a, const void *b) {
+	const loop_t *x = a, *y = b;
+	return (x->top > y->top) - (x->top < y->top);
+}
+
+
+/*
+ * Find the intervals, the uses of physical registers, and the loops.
+ * Control flow only goes backwards at the bottom of a loop, so an interval
+ * from the first to the last appearance of a register is right, except
+ * that a register which is live into a loop has to stay live to the end
+ * of it, for the next time around.
+ */
+static void
+find_intervals(uint32_t first) {
+	for (uint32_t v = 0; v < vregs_count; v++)
+		vregs[v].start = UNUSED, vregs[v].reg = NO_REGISTER;
+	for (reg_t r = EAX; r <= ESP; r++)
+		uses_count[r] = 0;
+	loops_count = 0;
+
+	if (label_positions_size < labels_count) {
+		label_positions_size = labels_count;
+		label_positions = realloc(label_positions,
+		                          labels_count * sizeof(int64_t));
+		if (label_positions == NULL) {
+			fprintf(stderr, "Out of memory for register allocation\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (uint32_t i = first; i < instructions_count; i++)
+		if (instructions[i].op == LABEL)
+			label_positions[instructions[i].operands[0].value] = -1;
+
+	for (uint32_t i = first; i < instructions_count; i++) {
+		instruction_t *instr = &instructions[i];
+		uint32_t position = i - first;
+		for (uint8_t o = 0; o < opcode_operands[instr->op]; o++) {
+			operand_t *operand = &instr->operands[o];
+			if (operand->kind == O_VIRTUAL || operand->kind == O_VMEMORY ||
+			        operand->kind == O_VSCALED)
+				touch(operand->reg, position);
+		}
+
+		uint32_t used = registers_used(instr);
+		for (uint32_t p = 0; p < POOL_SIZE; p++)
+			if (used & REG(pool[p])) {
+				reg_t r = pool[p];
+				uses[r] = grow(uses[r], &uses_size[r], uses_count[r],
+				               sizeof(uint32_t));
+				uses[r][uses_count[r]++] = position;
+			}
+
+		switch (instr->op) {
+		case LABEL:
+			label_positions[instr->operands[0].value] = position;
+			break;
+		case JUMP:
+		case JUMPZERO:
+		case JUMPNONZ:
+		case JUMPLESS:
+			if (instr->operands[0].kind == O_LABEL) {
+				int64_t top = label_positions[instr->operands[0].value];
+				if (top >= 0) {
+					loops = grow(loops, &loops_size, loops_count,
+					             sizeof(loop_t));
+					loops[loops_count++] = (loop_t) {
+						.top = top, .bottom = position
+					};
+				}
+			}
+			break;
+		}
+	}
+	for (uint32_t i = first; i < instructions_count; i++)
+		if (instructions[i].op == LABEL)
+			label_positions[instructions[i].operands[0].value] = -1;
+
+	if (loops_count > 1)
+		qsort(loops, loops_count, sizeof(loop_t), loop_order);
+	for (uint32_t v = 0; v < vregs_count; v++) {
+		interval_t *interval = &vregs[v];
+		if (interval->start == UNUSED)
+			continue;
+		/* First loop starting after the interval does */
+		uint32_t low = 0, high = loops_count;
+		while (low < high) {
+			uint32_t middle = (low + high) / 2;
+			if (loops[middle].top <= interval->start)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+		for (uint32_t l = low; l < loops_count; l++) {
+			if (loops[l].top > interval->end)
+				break;
+			if (loops[l].bottom > interval->end)
+				interval->end = loops[l].bottom;
+		}
+	}
+}
+
+
+/* Is the instruction a plain copy between the virtual and the real r? */
+static bool
+copy_with(instruction_t *instr, uint32_t vreg, reg_t r) {
+	if (instr->op != MOVE)
+		return false;
+	operand_t *a = &instr->operands[0], *b = &instr->operands[1];
+	return (a->kind == O_VIRTUAL && a->reg == vreg &&
+	        b->kind == O_REGISTER && b->reg == r) ||
+	       (b->kind == O_VIRTUAL && b->reg == vreg &&
+	        a->kind == O_REGISTER && a->reg == r);
+}
+
+
+/*
+ * A virtual register can't live in a physical one that some instruction
+ * within its interval uses (like %eax and %edx across an idivl, or the
+ * scratch registers across a call), unless that instruction is just a copy
+ * between the two at one end of the interval.
+ */
+static bool
+conflicts(uint32_t first, uint32_t vreg, reg_t r) {
+	interval_t *interval = &vregs[vreg];
+	uint32_t low = 0, high = uses_count[r];
+	while (low < high) {
+		uint32_t middle = (low + high) / 2;
+		if (uses[r][middle] < interval->start)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	for (uint32_t u = low; u < uses_count[r]; u++) {
+		uint32_t position = uses[r][u];
+		if (position > interval->end)
+			return false;
+		if ((position == interval->start || position == interval->end) &&
+		        copy_with(&instructions[first + position], vreg, r))
+			continue;
+		return true;
+	}
+	return false;
+}
+
+
+static int
+start_order(const void *a, const void *b) {
+	const interval_t *x = &vregs[*(const uint32_t *)a];
+	const interval_t *y = &vregs[*(const uint32_t *)b];
+	if (x->start != y->start)
+		return (x->start > y->start) - (x->start < y->start);
+	return (x->end > y->end) - (x->end < y->end);
+}
+
+
+/*
+ * The linear scan proper: hand out registers in order of where intervals
+ * start, freeing them where intervals end. An interval may take over the
+ * register of one that ends where it starts, as the only instructions that
+ * start an interval are moves into it. When no register fits, whichever of
+ * the candidates lasts longer is spilled. Returns the number of spills.
+ */
+static uint32_t
+linear_scan(uint32_t first) {
+	uint32_t *order = malloc((vregs_count + 1) * sizeof(uint32_t));
+	uint32_t n = 0, spilled = 0;
+	for (uint32_t v = 0; v < vregs_count; v++)
+		if (vregs[v].start != UNUSED)
+			order[n++] = v;
+	qsort(order, n, sizeof(uint32_t), start_order);
+
+	int64_t holder[ESP + 1];
+	for (reg_t r = EAX; r <= ESP; r++)
+		holder[r] = -1;
+
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t v = order[i];
+		interval_t *current = &vregs[v];
+
+		uint32_t allowed = 0, free = 0;
+		for (uint32_t p = 0; p < POOL_SIZE; p++) {
+			reg_t r = pool[p];
+			if (holder[r] >= 0 && vregs[holder[r]].end <= current->start)
+				holder[r] = -1;
+			if (!conflicts(first, v, r)) {
+				allowed |= REG(r);
+				if (holder[r] < 0)
+					free |= REG(r);
+			}
+		}
+
+		for (uint32_t p = 0; p < POOL_SIZE && current->reg < 0; p++)
+			if (free & REG(pool[p]))
+				current->reg = pool[p];
+		if (current->reg >= 0) {
+			holder[current->reg] = v;
+			continue;
+		}
+
+		int64_t victim = -1;
+		for (uint32_t p = 0; p < POOL_SIZE; p++) {
+			int64_t h = holder[pool[p]];
+			if ((allowed & REG(pool[p])) && h >= 0 && !vregs[h].fixed &&
+			        (victim < 0 || vregs[h].end > vregs[victim].end))
+				victim = h;
+		}
+		if (victim >= 0 &&
+		        (current->fixed || vregs[victim].end > current->end)) {
+			current->reg = vregs[victim].reg;
+			holder[current->reg] = v;
+			vregs[victim].reg = SPILLED;
+		} else if (!current->fixed) {
+			current->reg = SPILLED;
+		} else {
+			fprintf(stderr, "Register allocation failed\n");
+			exit(EXIT_FAILURE);
+		}
+		spilled += 1;
+	}
+	free(order);
+	return spilled;
+}
+
+
+static bool
+in_memory(operand_t *o) {
+	return o->kind == O_MEMORY || o->kind == O_VMEMORY || o->kind == O_LABEL;
+}
+
+
+/* A fresh register, which must not be spilled */
+static operand_t
+fixed_register(void) {
+	int32_t t = vreg_new();
+	vregs[t].fixed = true;
+	return (operand_t) {
+		.kind = O_VIRTUAL, .reg = t
+	};
+}
+
+
+/* A fresh register, loaded with what an operand holds */
+static operand_t
+load_fixed(operand_t from) {
+	operand_t to = fixed_register();
+	instruction_append((instruction_t) {
+		.op = MOVE, .operands = { from, to }
+	});
+	return to;
+}
+
+
+/*
+ * Move the spilled registers into their frame slots. Where that leaves an
+ * instruction with two memory operands, or a memory address based on a
+ * spilled register, a short-lived register is loaded before it instead,
+ * and a multiplication into a slot goes through one and is stored back.
+ * The function is the last thing in the vector, so it is rebuilt in place
+ * from a copy.
+ */
+static void
+rewrite_spills(uint32_t first) {
+	uint32_t length = instructions_count - first;
+	instruction_t *copy = malloc((length + 1) * sizeof(instruction_t));
+	memcpy(copy, &instructions[first], length * sizeof(instruction_t));
+	instructions_count = first;
+
+	for (uint32_t i = 0; i < length; i++) {
+		instruction_t instr = copy[i];
+		for (uint8_t o = 0; o < opcode_operands[instr.op]; o++) {
+			operand_t *operand = &instr.operands[o];
+			if (operand->kind != O_VIRTUAL && operand->kind != O_VMEMORY &&
+			        operand->kind != O_VSCALED)
+				continue;
+			interval_t *interval = &vregs[operand->reg];
+			if (interval->reg != SPILLED)
+				continue;
+			operand_t slot = {
+				.kind = O_MEMORY, .reg = EBP, .value = -4 * interval->slot
+			};
+			if (operand->kind == O_VIRTUAL)
+				*operand = slot;
+			else
+				operand->reg = load_fixed(slot).reg;
+		}
+		if ((instr.op == IMUL || instr.op == LEA) &&
+		        in_memory(&instr.operands[1])) {
+			/* imull and leal only write to a register */
+			operand_t slot = instr.operands[1];
+			instr.operands[1] = (instr.op == IMUL) ?
+			                    load_fixed(slot) : fixed_register();
+			instruction_append(instr);
+			instruction_append((instruction_t) {
+				.op = MOVE, .operands = { instr.operands[1], slot }
+			});
+			continue;
+		}
+		if (opcode_operands[instr.op] == 2 &&
+		        in_memory(&instr.operands[0]) && in_memory(&instr.operands[1]))
+			instr.operands[0] = load_fixed(instr.operands[0]);
+		instruction_append(instr);
+	}
+	free(copy);
+}
+
+
+/* Turn the virtual registers into the physical ones they were given */
+static void
+assign_registers(uint32_t first) {
+	for (uint32_t i = first; i < instructions_count; i++) {
+		instruction_t *instr = &instructions[i];
+		for (uint8_t o = 0; o < opcode_operands[instr->op]; o++) {
+			operand_t *operand = &instr->operands[o];
+			if (operand->kind == O_VIRTUAL)
+				operand->kind = O_REGISTER;
+			else if (operand->kind == O_VMEMORY)
+				operand->kind = O_MEMORY;
+			else if (operand->kind == O_VSCALED)
+				operand->kind = O_SCALED;
+			else
+				continue;
+			operand->reg = vregs[operand->reg].reg;
+		}
+		if (instr->op == MOVE && instr->operands[0].kind == O_REGISTER &&
+		        instr->operands[1].kind == O_REGISTER &&
+		        instr->operands[0].reg == instr->operands[1].reg)
+			instr->op = NIL;
+	}
+}
+
+
+/* Fill in the frame size and the saving of callee-saved registers */
+static void
+frame(uint32_t first, int32_t frame_words, uint32_t saved) {
+	static const reg_t save_order[] = { EBX, ESI, EDI };
+	if (frame_words > 0)
+		instructions[first + 3].operands[0].value = 4 * frame_words;
+	else
+		instructions[first + 3].op = NIL;
+
+	uint32_t n = 0;
+	for (uint32_t s = 0; s < 3; s++)
+		if (saved & REG(save_order[s]))
+			instructions[first + 4 + n++] = (instruction_t) {
+				.op = PUSH, .operands = {
+					{ .kind = O_REGISTER, .reg = save_order[s] }
+				}
+			};
+
+	for (uint32_t i = first + 7; i < instructions_count; i++) {
+		if (instructions[i].op != RET || instructions[i - 1].op != LEAVE)
+			continue;
+		uint32_t p = 0;
+		for (int32_t s = 2; s >= 0; s--)
+			if (saved & REG(save_order[s]))
+				instructions[i - 4 + p++] = (instruction_t) {
+					.op = POP, .operands = {
+						{ .kind = O_REGISTER, .reg = save_order[s] }
+					}
+				};
+	}
+}
+
+
+int32_t
+regalloc_function(uint32_t first, int32_t frame_words, int32_t verbosity) {
+	uint32_t spilled = 0, n;
+	uint32_t virtuals = vregs_count;
+	for (;;) {
+		find_intervals(first);
+		if ((n = linear_scan(first)) == 0)
+			break;
+		spilled += n;
+		for (uint32_t v = 0; v < vregs_count; v++)
+			if (vregs[v].reg == SPILLED && vregs[v].start != UNUSED)
+				vregs[v].slot = ++frame_words;
+		rewrite_spills(first);
+	}
+	assign_registers(first);
+
+	uint32_t saved = 0;
+	for (uint32_t v = 0; v < vregs_count; v++)
+		if (vregs[v].start != UNUSED && vregs[v].reg >= 0)
+			saved |= REG(vregs[v].reg) & CALLEE_SAVED;
+	frame(first, frame_words, saved);
+
+	if (verbosity > 0)
+		fprintf(stderr, "regalloc: %s: %u virtual registers, %u spilled\n",
+		        labels[instructions[first].operands[0].value].name,
+		        virtuals, spilled);
+	return frame_words;
+}
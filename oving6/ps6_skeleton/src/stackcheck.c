@@ -0,0 +1,196 @@
+#include <stackcheck.h>
+
+
+/*
+ * Static stack heights, counted in words from where %ebp points, for the
+ * functions of the VSL program (main is left alone, since it pushes the
+ * arguments in a loop). A function is recognised by its prologue,
+ *     LABEL, PUSH %ebp, MOVE %esp,%ebp [, SUB $n,%esp]
+ * and runs until the next label that begins a function.
+ * The code is checked in one pass: as it comes from structured statements,
+ * any label is either reached by falling through, or by a jump which has
+ * been seen already, before anything needs its height.
+ */
+#define UNKNOWN INT64_MIN
+
+static int64_t *label_heights = NULL;
+static uint32_t label_heights_size = 0;
+static uint32_t errors = 0;
+
+
+static bool
+is_register(operand_t *o, reg_t r) {
+	return o->kind == O_REGISTER && o->reg == r;
+}
+
+
+/* Position of the next instruction which is still there, or the end */
+static uint32_t
+live_after(uint32_t i) {
+	while (++i < instructions_count && instructions[i].op == NIL)
+		;
+	return i;
+}
+
+
+/* Does a function start with the label at position i? */
+static bool
+function_start(uint32_t i) {
+	if (instructions[i].op != LABEL ||
+	        labels[instructions[i].operands[0].value].global)
+		return false;
+	uint32_t push = live_after(i), move = live_after(push);
+	return move < instructions_count &&
+	       instructions[push].op == PUSH &&
+	       is_register(&instructions[push].operands[0], EBP) &&
+	       instructions[move].op == MOVE &&
+	       is_register(&instructions[move].operands[0], ESP) &&
+	       is_register(&instructions[move].operands[1], EBP);
+}
+
+
+static void
+report(int32_t function, uint32_t position, const char *what,
+       int64_t height, int64_t expected) {
+	label_t *l = &labels[function];
+	fprintf(stderr, "Stack check: %s at instruction %u of %s: "
+	        "height %ld, expected %ld\n", what, position, l->name,
+	        (long) height, (long) expected);
+	errors += 1;
+}
+
+
+/* A jump to a label, or falling through to it, at the given height */
+static void
+arrive(int32_t function, uint32_t position, int32_t label, int64_t height) {
+	if (label_heights[label] == UNKNOWN)
+		label_heights[label] = height;
+	else if (label_heights[label] != height)
+		report(function, position, "paths to a label disagree",
+		       height, label_heights[label]);
+}
+
+
+/* Check one function, from its label; returns where the next one starts */
+static uint32_t
+check_function(uint32_t first) {
+	int32_t function = instructions[first].operands[0].value;
+	uint32_t i = live_after(live_after(live_after(first)));
+	int64_t frame = 0;
+	if (i < instructions_count && instructions[i].op == SUB &&
+	        instructions[i].operands[0].kind == O_IMMEDIATE &&
+	        is_register(&instructions[i].operands[1], ESP)) {
+		frame = instructions[i].operands[0].value / WORD_SIZE;
+		i = live_after(i);
+	}
+
+	int64_t height = frame;
+	bool reachable = true;
+	for (; i < instructions_count; i = live_after(i)) {
+		instruction_t *instr = &instructions[i];
+		if (instr->op == LABEL && (labels[instr->operands[0].value].global ||
+		                           function_start(i)))
+			break;
+
+		operand_t *d = instruction_destination(instr);
+		switch (instr->op) {
+		case LABEL: {
+			int32_t label = instr->operands[0].value;
+			if (reachable)
+				arrive(function, i, label, height);
+			else if (label_heights[label] != UNKNOWN)
+				height = label_heights[label], reachable = true;
+			continue;
+		}
+		case JUMP:
+		case JUMPZERO:
+		case JUMPNONZ:
+		case JUMPLESS:
+			if (reachable && instr->operands[0].kind == O_LABEL)
+				arrive(function, i, instr->operands[0].value, height);
+			if (instr->op == JUMP)
+				reachable = false;
+			continue;
+		case RET:
+			reachable = false;
+			continue;
+		case LEAVE:
+			if (reachable && height != frame)
+				report(function, i, "unbalanced stack at leave",
+				       height, frame);
+			continue;
+		case PUSH:
+			height += 1;
+			break;
+		case POP:
+			height -= 1;
+			break;
+		case ADD:
+		case SUB:
+			if (is_register(d, ESP)) {
+				if (instr->operands[0].kind != O_IMMEDIATE) {
+					report(function, i, "unknown change of %esp", height,
+					       height);
+					continue;
+				}
+				int64_t words = instr->operands[0].value / WORD_SIZE;
+				height += (instr->op == ADD) ? -words : words;
+			}
+			break;
+		case AND:
+			/*
+			 * Rounding %esp down before a call into the C library
+			 * on x86-64, after pushing two copies of it, one of
+			 * which then goes back into %esp (see call_c).
+			 */
+			if (is_register(d, ESP))
+				continue;
+			break;
+		case MOVE:
+			if (is_register(d, ESP) &&
+			        instr->operands[0].kind == O_MEMORY &&
+			        instr->operands[0].reg == ESP &&
+			        instr->operands[0].value == WORD_SIZE) {
+				height -= 2;
+				continue;
+			}
+			/* Fall through */
+		default:
+			if (d != NULL && (is_register(d, ESP) || is_register(d, EBP)))
+				report(function, i, "unknown change of the frame",
+				       height, height);
+			break;
+		}
+		if (reachable && height < frame) {
+			report(function, i, "popped into the frame", height, frame);
+			height = frame;
+		}
+	}
+	return i;
+}
+
+
+uint32_t
+stack_check(void) {
+	if (label_heights_size < labels_count) {
+		label_heights_size = labels_count;
+		label_heights = realloc(label_heights,
+		                        labels_count * sizeof(int64_t));
+		if (label_heights == NULL) {
+			fprintf(stderr, "Out of memory for the stack check\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (uint32_t l = 0; l < labels_count; l++)
+		label_heights[l] = UNKNOWN;
+
+	errors = 0;
+	uint32_t i = 0;
+	while (i < instructions_count) {
+		if (function_start(i))
+			i = check_function(i);
+		else
+			i += 1;
+	}
+	return errors;
+}
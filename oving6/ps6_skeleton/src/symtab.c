@@ -1,21 +1,82 @@
 #include "symtab.h"
+#include "emit.h"
+#include "object.h"
+#include <ctype.h>
 
 
-static hash_t **scopes;
 static symbol_t **values;
 static char **strings;
-static int32_t scopes_size = 16, scopes_index = -1;
 static int32_t values_size = 16, values_index = -1;
 static int32_t strings_size = 16, strings_index = -1;
 
+/*
+ * Scoped symbol table: a single open-addressed table maps each identifier
+ * to its innermost binding, so a lookup is one probe sequence no matter how
+ * deeply scopes are nested. Inserting a symbol logs the binding it shadows
+ * on the undo stack, each scope remembers how high that stack was when it
+ * opened, and closing the scope pops the log back down, reinstating the
+ * shadowed bindings. A slot, once claimed by an identifier, stays with it
+ * (with a NULL value when it is out of scope), so probes never meet holes.
+ */
+typedef struct {
+	int32_t ident;          /* NO_IDENT marks an unused slot */
+	symbol_t *value;
+} binding_t;
+
+typedef struct {
+	int32_t ident;
+	symbol_t *shadowed;
+} undo_t;
+
+#define NO_IDENT (-1)
+
+static binding_t *bindings;
+static undo_t *undo_log;
+static int32_t *scopes;
+static uint32_t bindings_size = 64, bindings_used = 0;
+static int32_t undo_size = 64, undo_index = -1;
+static int32_t scopes_size = 16, scopes_index = -1;
+
+/*
+ * Identifier table: every distinct name is stored once, with its hash, and
+ * is known everywhere else by its index here. The slots array is an
+ * open-addressed index from names to those numbers (0 marks a free slot,
+ * so it holds ident+1), and the text lives in a pool of blocks which never
+ * move, so ident_text pointers stay valid until symtab_finalize.
+ */
+typedef struct {
+	uint32_t hash;
+	char *text;
+} ident_t;
+
+#define IDENT_POOL_BLOCK 4096
+
+static ident_t *idents;
+static int32_t *ident_slots;
+static char **ident_pool;
+static int32_t idents_size = 64, idents_index = -1;
+static uint32_t ident_slots_size = 128;
+static int32_t ident_pool_size = 16, ident_pool_index = -1;
+static char *ident_pool_next = NULL;
+static size_t ident_pool_free = 0;
+
 
 void
 symtab_init(void) {
 	/* String table */
 	strings = malloc(strings_size * sizeof(char *));
 
-	/* Stack of scopes */
-	scopes = (hash_t **) calloc(scopes_size, sizeof(hash_t *));
+	/* Identifier table */
+	idents = malloc(idents_size * sizeof(ident_t));
+	ident_slots = calloc(ident_slots_size, sizeof(int32_t));
+	ident_pool = malloc(ident_pool_size * sizeof(char *));
+
+	/* Bindings, undo log and stack of scopes */
+	bindings = malloc(bindings_size * sizeof(binding_t));
+	for (uint32_t i = 0; i < bindings_size; i++)
+		bindings[i] = (binding_t) { .ident = NO_IDENT, .value = NULL };
+	undo_log = malloc(undo_size * sizeof(undo_t));
+	scopes = malloc(scopes_size * sizeof(int32_t));
 	values = (symbol_t **) calloc(values_size, sizeof(symbol_t *));
 	scope_add();
 }
@@ -23,20 +84,26 @@ symtab_init(void) {
 
 void
 symtab_finalize(void) {
-	/* String table */
-	for (int32_t i = strings_index; i >= 0; i--)
-		free(strings[i]);
+	/* String table (the strings themselves belong to the syntax tree) */
 	free(strings);
 
+	/* Identifier table */
+	for (int32_t i = ident_pool_index; i >= 0; i--)
+		free(ident_pool[i]);
+	free(ident_pool);
+	free(ident_slots);
+	free(idents);
+
 	/* Stack of scopes */
 	while (scopes_index > -1)
 		scope_remove();
 	while (values_index >= 0) {
-		free(values[values_index]->label);
 		free(values[values_index]);
 		values_index -= 1;
 	}
 	free(scopes);
+	free(undo_log);
+	free(bindings);
 	free(values);
 }
 
@@ -44,15 +111,115 @@ symtab_finalize(void) {
 int32_t
 strings_add(char *str) {
 	strings_index += 1;
-	strings[strings_index] = str;
 	if (strings_index == strings_size) {
 		strings_size *= 2;
 		strings = realloc(strings, strings_size * sizeof(char *));
 	}
+	strings[strings_index] = str;
 	return strings_index;
 }
 
 
+char *
+strings_get(int32_t index) {
+	return strings[index];
+}
+
+
+int32_t
+strings_count(void) {
+	return strings_index + 1;
+}
+
+
+/* Leave a string out of the data segment, for when nothing prints it */
+void
+strings_drop(int32_t index) {
+	strings[index] = NULL;
+}
+
+
+/* FNV-1a, which is plenty for short identifiers */
+static uint32_t
+ident_hash_text(const char *name, size_t length) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++)
+		hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+	return hash;
+}
+
+
+static char *
+ident_store(const char *name, size_t length) {
+	if (ident_pool_free < length + 1) {
+		size_t block = (length + 1 > IDENT_POOL_BLOCK) ?
+		               length + 1 : IDENT_POOL_BLOCK;
+		ident_pool_index += 1;
+		if (ident_pool_index == ident_pool_size) {
+			ident_pool_size *= 2;
+			ident_pool = realloc(ident_pool, ident_pool_size * sizeof(char *));
+		}
+		ident_pool_next = ident_pool[ident_pool_index] = malloc(block);
+		ident_pool_free = block;
+	}
+	char *text = memcpy(ident_pool_next, name, length + 1);
+	ident_pool_next += length + 1;
+	ident_pool_free -= length + 1;
+	return text;
+}
+
+
+int32_t
+ident_add(const char *name) {
+	size_t length = strlen(name);
+	uint32_t hash = ident_hash_text(name, length);
+	uint32_t mask = ident_slots_size - 1, slot = hash & mask;
+	while (ident_slots[slot] != 0) {
+		ident_t *known = &idents[ident_slots[slot] - 1];
+		if (known->hash == hash && strcmp(known->text, name) == 0)
+			return ident_slots[slot] - 1;
+		slot = (slot + 1) & mask;
+	}
+
+	idents_index += 1;
+	if (idents_index == idents_size) {
+		idents_size *= 2;
+		idents = realloc(idents, idents_size * sizeof(ident_t));
+	}
+	idents[idents_index] = (ident_t) {
+		.hash = hash, .text = ident_store(name, length)
+	};
+	ident_slots[slot] = idents_index + 1;
+
+	/* Keep the index at most half full, rehashing from the stored hashes */
+	if (2 * (uint32_t)(idents_index + 1) > ident_slots_size) {
+		free(ident_slots);
+		ident_slots_size *= 2;
+		ident_slots = calloc(ident_slots_size, sizeof(int32_t));
+		mask = ident_slots_size - 1;
+		for (int32_t i = 0; i <= idents_index; i++) {
+			slot = idents[i].hash & mask;
+			while (ident_slots[slot] != 0)
+				slot = (slot + 1) & mask;
+			ident_slots[slot] = i + 1;
+		}
+	}
+	return idents_index;
+}
+
+
+char *
+ident_text(int32_t ident) {
+	return idents[ident].text;
+}
+
+
+uint32_t
+ident_hash(int32_t ident) {
+	return idents[ident].hash;
+}
+
+
 void
 strings_output(FILE *stream) {
 	fputs(
@@ -61,38 +228,185 @@ strings_output(FILE *stream) {
 	    stream
 	);
 	for (int i = 0; i <= strings_index; i++)
-		fprintf(stream, ".STRING%d: .string %s\n", i, strings[i]);
+		if (strings[i] != NULL)
+			fprintf(stream, ".STRING%d: .string %s\n", i, strings[i]);
 	fputs(".globl main\n", stream);
 }
 
 
+/* Same as strings_output, through the buffered emitter */
+void
+strings_emit(void) {
+	emit_str(
+	    ".data\n"
+	    ".INTEGER: .string \"%d \"\n"
+	);
+	for (int i = 0; i <= strings_index; i++) {
+		if (strings[i] == NULL)
+			continue;
+		emit_bytes(".STRING", 7);
+		emit_int(i);
+		emit_bytes(": .string ", 10);
+		emit_str(strings[i]);
+		emit_char('\n');
+	}
+	emit_str(".globl main\n");
+}
+
+
+/*
+ * A string, given in quotes as it was written in the source, decoded the
+ * way the assembler's .string does it into 'bytes', which has room for as
+ * many as the text has. Returns the length, not counting the terminating 0.
+ */
+uint32_t
+strings_decode(const char *text, char *bytes) {
+	uint32_t length = 0;
+	const char *end = text + strlen(text) - 1;
+	for (const char *c = text + 1; c < end; c++) {
+		uint8_t byte = *c;
+		if (byte == '\\') {
+			switch (*++c) {
+			case 'b': byte = '\b'; break;
+			case 'f': byte = '\f'; break;
+			case 'n': byte = '\n'; break;
+			case 'r': byte = '\r'; break;
+			case 't': byte = '\t'; break;
+			case 'v': byte = '\v'; break;
+			case '\\':
+			case '"':
+				byte = *c;
+				break;
+			case 'x':
+			case 'X':
+				for (byte = 0; c + 1 < end && isxdigit((uint8_t) c[1]); c++)
+					byte = byte * 16 + (isdigit((uint8_t) c[1]) ?
+					                    c[1] - '0' : tolower((uint8_t) c[1]) - 'a' + 10);
+				break;
+			default:
+				if (!isdigit((uint8_t) *c)) {
+					fprintf(stderr, "Error: bad escaped character in %s\n", text);
+					exit(EXIT_FAILURE);
+				}
+				/* Up to 3 digits of octal */
+				byte = *c - '0';
+				for (int32_t d = 1; d < 3 && c + 1 < end &&
+				        isdigit((uint8_t) c[1]); d++)
+					byte = byte * 8 + *++c - '0';
+				break;
+			}
+		}
+		bytes[length++] = byte;
+	}
+	bytes[length] = '\0';
+	return length;
+}
+
+
+/* Same strings, as data for the object file, under labels of the IR */
+void
+strings_object(void) {
+	object_string(label_new(".INTEGER", -1, true), "\"%d \"");
+	for (int i = 0; i <= strings_index; i++)
+		if (strings[i] != NULL)
+			object_string(label_new(".STRING", i, true), strings[i]);
+	object_global(label_new("main", -1, true));
+}
+
+
 void
 scope_add(void) {
 	scopes_index += 1;
 	if (scopes_index == scopes_size) {
 		scopes_size *= 2;
-		scopes = realloc(scopes, scopes_size * sizeof(hash_t *));
+		scopes = realloc(scopes, scopes_size * sizeof(int32_t));
 	}
-	scopes[scopes_index] = ght_create(HASH_BUCKETS);
+	scopes[scopes_index] = undo_index;
+}
+
+
+/* Find the slot belonging to an identifier, or the free slot it would take */
+static binding_t *
+binding_find(int32_t ident) {
+	uint32_t mask = bindings_size - 1, slot = ident_hash(ident) & mask;
+	while (bindings[slot].ident != ident && bindings[slot].ident != NO_IDENT)
+		slot = (slot + 1) & mask;
+	return &bindings[slot];
+}
+
+
+static binding_t *
+binding_claim(int32_t ident) {
+	binding_t *binding = binding_find(ident);
+	if (binding->ident == ident)
+		return binding;
+
+	/* New identifier: keep the table at most half full */
+	if (2 * (bindings_used + 1) > bindings_size) {
+		binding_t *old = bindings;
+		uint32_t old_size = bindings_size;
+		bindings_size *= 2;
+		bindings = malloc(bindings_size * sizeof(binding_t));
+		for (uint32_t i = 0; i < bindings_size; i++)
+			bindings[i] = (binding_t) { .ident = NO_IDENT, .value = NULL };
+		for (uint32_t i = 0; i < old_size; i++)
+			if (old[i].ident != NO_IDENT)
+				*binding_find(old[i].ident) = old[i];
+		free(old);
+		binding = binding_find(ident);
+	}
+	bindings_used += 1;
+	*binding = (binding_t) { .ident = ident, .value = NULL };
+	return binding;
 }
 
 
 void
 scope_remove(void) {
-	ght_finalize(scopes[scopes_index]);
+	while (undo_index > scopes[scopes_index]) {
+		binding_find(undo_log[undo_index].ident)->value =
+		    undo_log[undo_index].shadowed;
+		undo_index -= 1;
+	}
 	scopes_index -= 1;
 }
 
 
 void
-symbol_insert(char *key, symbol_t *value) {
+symbol_insert(int32_t ident, symbol_t *value) {
 #ifdef DUMP_SYMTAB
-	fprintf(stderr, "Inserting (%s,%d)\n", key, value->stack_offset);
+	fprintf(stderr,
+	        "Inserting (%s,%d)\n", ident_text(ident), value->stack_offset
+	       );
 #endif
 
 	value->depth = scopes_index;
+	value->ident = ident;
 
-	ght_insert(scopes[scopes_index], value, strlen(key) + 1, key);
+	/* The first declaration of a name in a scope is the one that counts */
+	binding_t *binding = binding_claim(ident);
+	if (binding->value == NULL || binding->value->depth != scopes_index) {
+		undo_index += 1;
+		if (undo_index == undo_size) {
+			undo_size *= 2;
+			undo_log = realloc(undo_log, undo_size * sizeof(undo_t));
+		}
+		undo_log[undo_index] = (undo_t) {
+			.ident = ident, .shadowed = binding->value
+		};
+		binding->value = value;
+	}
+	symbol_keep(value);
+}
+
+
+/*
+ * Take charge of a symbol, to be freed by symtab_finalize. Symbols made
+ * after names are bound (by the inliner) come here directly, since they
+ * are never looked up by name.
+ */
+void
+symbol_keep(symbol_t *value) {
 	values_index += 1;
 	if (values_index == values_size) {
 		values_size *= 2;
@@ -103,16 +417,13 @@ symbol_insert(char *key, symbol_t *value) {
 
 
 void
-symbol_get(symbol_t **value, char *key) {
-	int32_t d = scopes_index;
-	symbol_t *result = NULL;
-	while (result == NULL && d > -1) {
-		result = (symbol_t *) ght_get(scopes[d], strlen(key) + 1, key);
-		d -= 1;
-	}
+symbol_get(symbol_t **value, int32_t ident) {
+	symbol_t *result = binding_find(ident)->value;
 #ifdef DUMP_SYMTAB
 	if (result != NULL)
-		fprintf(stderr, "Retrieving (%s,%d)\n", key, result->stack_offset);
+		fprintf(stderr,
+		        "Retrieving (%s,%d)\n", ident_text(ident), result->stack_offset
+		       );
 #endif
 	*value = result;
 }
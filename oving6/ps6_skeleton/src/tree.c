@@ -3,323 +3,681 @@
 
 #define NO_ARGS (-1)
 
+/* The node vector, see node_new */
+node_t *nodes = NULL;
+static uint32_t nodes_size = 0, nodes_count = 0;
+
+/* The call graph, see call_add */
+call_t *calls = NULL;
+uint32_t calls_count = 0;
+static uint32_t calls_size = 0;
+
 #ifdef DUMP_TREES
 void
-node_print(FILE *output, node_t *root, uint32_t nesting) {
-	if (root != NULL) {
-		fprintf(output, "%*c%s", nesting, ' ', root->type.text);
-		if (root->type.index == INTEGER)
-			fprintf(output, "(%d)", *((int32_t *)root->data));
-		if (root->type.index == VARIABLE || root->type.index == EXPRESSION || root->type.index == TEXT) {
-			if (root->data != NULL)
-				fprintf(output, "(\"%s\")", (char *)root->data);
-			else
-				fprintf(output, "%p", root->data);
+node_print(FILE *output, node_index_t root, uint32_t nesting) {
+	/* Pre-order, so the visit's step is free to carry the nesting level */
+	walk_t walk = { NULL, 0, 0 };
+	walk_push(&walk, root);
+	WALK_TOP(&walk)->step = nesting;
+	while (walk.height > 0) {
+		visit_t v = *WALK_TOP(&walk);
+		walk.height -= 1;
+		if (v.node == NO_NODE) {
+			fprintf(output, "%*c%p\n", v.step, ' ', NULL);
+			continue;
 		}
+		node_t *n = NODE(v.node);
+		fprintf(output, "%*c%s", v.step, ' ', nodetype_names[n->type]);
+		if (n->type == INTEGER)
+			fprintf(output, "(%d)", n->value);
+		if (n->type == VARIABLE)
+			fprintf(output, "(\"%s\")", ident_text(n->value));
+		if (n->type == TEXT)
+			fprintf(output, "(%s)", strings_get(n->value));
+		if (n->type == EXPRESSION && n->op != OP_NONE)
+			fprintf(output, "(\"%s\")", operator_names[n->op]);
 		fputc('\n', output);
-		for (int32_t i = 0; i < root->n_children; i++)
-			node_print(output, root->children[i], nesting + 1);
-	} else
-		fprintf(output, "%*c%p\n", nesting, ' ', root);
+		for (uint32_t i = n->n_children; i > 0; i--) {
+			walk_push(&walk, n->children[i - 1]);
+			WALK_TOP(&walk)->step = v.step + 1;
+		}
+	}
+	walk_finalize(&walk);
 }
 #endif
 
 
+/*
+ * Region allocator for the syntax tree.
+ * Nodes, child arrays and label data are carved out of large blocks which
+ * are only ever released together, so building the tree costs a pointer
+ * bump per allocation instead of a malloc, and tearing it down costs one
+ * free per block instead of a walk over every node.
+ */
+#define ARENA_BLOCK (64 * 1024)
+#define ARENA_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+typedef struct arena_block {
+	struct arena_block *next;
+	size_t size, used;
+	char data[];
+} arena_block_t;
+
+static arena_block_t *arena = NULL;
+static void *arena_last = NULL;     /* Most recent allocation, for resizes */
+
+
+void *
+tree_alloc(size_t size) {
+	size = ARENA_ALIGN(size);
+	if (arena == NULL || arena->size - arena->used < size) {
+		size_t block_size = (size > ARENA_BLOCK) ? size : ARENA_BLOCK;
+		arena_block_t *block = malloc(sizeof(arena_block_t) + block_size);
+		if (block == NULL) {
+			fprintf(stderr, "Out of memory for syntax tree\n");
+			exit(EXIT_FAILURE);
+		}
+		*block = (arena_block_t) {
+			.next = arena, .size = block_size, .used = 0
+		};
+		arena = block;
+	}
+	arena_last = arena->data + arena->used;
+	arena->used += size;
+	return arena_last;
+}
+
+
+/*
+ * Arena memory can't be resized by the C library, so growing a block means
+ * copying it - unless it was the last thing allocated, and there is room to
+ * extend it where it lies.
+ */
+void *
+tree_realloc(void *old, size_t old_size, size_t new_size) {
+	if (old != NULL && old == arena_last) {
+		size_t start = (char *)old - arena->data;
+		if (start + ARENA_ALIGN(new_size) <= arena->size) {
+			arena->used = start + ARENA_ALIGN(new_size);
+			return old;
+		}
+	}
+	void *result = tree_alloc(new_size);
+	if (old != NULL)
+		memcpy(result, old, (old_size < new_size) ? old_size : new_size);
+	return result;
+}
+
+
+char *
+tree_strdup(const char *s) {
+	size_t length = strlen(s) + 1;
+	return memcpy(tree_alloc(length), s, length);
+}
+
+
 void
-node_init(node_t *nd, nodetype_t type, void *data, uint32_t n_children, ...) {
-	va_list child_list;
+destroy_tree(void) {
+	free(calls);
+	calls = NULL, calls_size = calls_count = 0;
+	free(nodes);
+	nodes = NULL, nodes_size = nodes_count = 0;
+	while (arena != NULL) {
+		arena_block_t *next = arena->next;
+		free(arena);
+		arena = next;
+	}
+	arena_last = NULL;
+}
+
+
+/*
+ * Create a node at the end of the node vector, and return its index.
+ * The vector doubles when it is full; slot 0 is burned on the first call,
+ * so that no real node has the index NO_NODE.
+ */
+node_index_t
+node_new(nt_number type, operator_t op, int32_t value, uint32_t n_children, ...) {
+	if (nodes_count == nodes_size) {
+		nodes_size = (nodes_size == 0) ? 1024 : 2 * nodes_size;
+		nodes = realloc(nodes, nodes_size * sizeof(node_t));
+		if (nodes == NULL) {
+			fprintf(stderr, "Out of memory for syntax tree\n");
+			exit(EXIT_FAILURE);
+		}
+		if (nodes_count == 0)
+			nodes[nodes_count++] = (node_t) { .type = PROGRAM };
+	}
+	node_index_t index = nodes_count++;
+	node_t *nd = NODE(index);
 	*nd = (node_t) {
-		type, data, NULL, n_children,
-		      (node_t **) malloc(n_children * sizeof(node_t *))
+		.type = type, .op = op, .value = value, .entry = NULL,
+		 .n_children = n_children,
+		  .children = tree_alloc(n_children * sizeof(node_index_t))
 	};
+	va_list child_list;
 	va_start(child_list, n_children);
 	for (uint32_t i = 0; i < n_children; i++)
-		nd->children[i] = va_arg(child_list, node_t *);
+		nd->children[i] = va_arg(child_list, node_index_t);
 	va_end(child_list);
+	return index;
 }
 
 
+/*
+ * Append a child to a list node. Lists start out with one child, and their
+ * child arrays double whenever the count reaches a power of two, so a list
+ * of n elements costs O(n) time and at most 2n slots of arena space to
+ * build, however long it gets.
+ */
 void
-node_finalize(node_t *discard) {
-	if (discard != NULL) {
-		free(discard->data), free(discard->children);
-		free(discard);
-	}
+node_append(node_index_t list, node_index_t child) {
+	node_t *l = NODE(list);
+	uint32_t n = l->n_children;
+	if ((n & (n - 1)) == 0)
+		l->children = tree_realloc(
+		                  l->children,
+		                  n * sizeof(node_index_t), 2 * n * sizeof(node_index_t)
+		              );
+	l->children[n] = child;
+	l->n_children = n + 1;
 }
 
 
 void
-destroy_subtree(node_t *discard) {
-	if (discard != NULL) {
-		for (uint32_t i = 0; i < discard->n_children; i++)
-			destroy_subtree(discard->children[i]);
-		node_finalize(discard);
+walk_push(walk_t *walk, node_index_t node) {
+	if (walk->height == walk->size) {
+		walk->size = (walk->size == 0) ? 256 : 2 * walk->size;
+		walk->visits = realloc(walk->visits, walk->size * sizeof(visit_t));
+		if (walk->visits == NULL) {
+			fprintf(stderr, "Out of memory for tree traversal\n");
+			exit(EXIT_FAILURE);
+		}
 	}
+	walk->visits[walk->height++] = (visit_t) {
+		.node = node, .step = 0, .aux = 0
+	};
 }
 
 
 void
-simplify_tree(node_t **simplified, node_t *root) {
-	node_t *result = root;
+walk_finalize(walk_t *walk) {
+	free(walk->visits);
+	*walk = (walk_t) { NULL, 0, 0 };
+}
 
-	/*
-	 * First, we ensure that we have a node to look at. This has the
-	 * convenient side-effect that optional elements in the syntax
-	 * remain marked by a NULL placeholder in the tree, keeping it simple
-	 * to recognize the structures imposed by the grammar.
-	 */
-	if (root != NULL) {
-		/* Recur before treating any single node: depth-first traversal */
-		for (uint32_t i = 0; i < root->n_children; i++)
-			simplify_tree(&root->children[i], root->children[i]);
-
-		/* Here is where we do something to the lowest nodes in the tree */
-		switch (root->type.index) {
-			/*
-			 * These types have only syntactic value, so we can throw
-			 * them out now:
-			 * STATEMENT always has one child, which can identify itself
-			 * PARAMETER_LIST only serves to make variable lists optional
-			 *                in function declarations
-			 * ARGUMENT_LIST does the same thing for function calls
-			 */
-		case STATEMENT:
-		case PRINT_ITEM:
-		case PARAMETER_LIST:
-		case ARGUMENT_LIST:
-			result = root->children[0];
-			node_finalize(root);
-			break;
 
-			/*
-			 * Print statements always have exactly one PRINT_LIST child.
-			 * Since we are done with the recursive list definition,
-			 * its descendants may instead be children of the print statement
-			 * itself now. (Quick hack - it's easier to rename the list node
-			 * and eliminate the old statement than to copy/move all children.)
-			 */
-		case PRINT_STATEMENT:
-			result = root->children[0];
-			result->type = root->type;
-			node_finalize(root);
-			break;
+/*
+ * Constant powers, by squaring and multiplying (wrapping around like the
+ * machine does). A negative exponent means dividing 1 by the base that
+ * many times, which leaves 0 unless the base is 1 or -1, or 0, which is
+ * never divided by and leaves the 1.
+ */
+static int32_t
+power(int32_t base, int32_t exponent) {
+	if (exponent < 0) {
+		if (base == 0 || base == 1)
+			return 1;
+		if (base == -1)
+			return (exponent % 2 == 0) ? 1 : -1;
+		return 0;
+	}
+	uint32_t result = 1, square = (uint32_t) base;
+	for (uint32_t e = (uint32_t) exponent; e > 0; e >>= 1) {
+		if (e & 1)
+			result *= square;
+		square *= square;
+	}
+	return (int32_t) result;
+}
 
-			/*
-			 * DECLARATION_LIST can be NULL altogether, but we preserved
-			 * that at the beginning of the function. This has a somewhat
-			 * nasty side-effect in the grammar, however, as it gets a
-			 * different structure from the other lists when it DOES exist
-			 * (such as here). Other lists have a single-element list with
-			 * the last list item at the bottom of the tree, whereas
-			 * declaration lists have a 2-element list with NULL and the
-			 * last item. The code that follows molds the bottom of a
-			 * declaration list into the same form as the other lists, so
-			 * the rest can be handled by the otherwise standard
-			 * list-flattening code.
-			 */
-		case DECLARATION_LIST:
-			if (root->children[0] == NULL) {
-				root->children[0] = root->children[1];
-				root->n_children--;
-				root->children = realloc(
-				                     root->children, root->n_children * sizeof(node_t *)
-				                 );
-			}
-			/* NB! There is no 'break' here on purpose - since the
-			 * declaration list is now in the standard form, we WANT
-			 * control to fall through to the standard list-handling
-			 * code below.
-			 */
-
-			/*
-			 * All these lists have the same structure, so general flattening
-			 * is quite simple: extend the left child's list with the right
-			 * child, and substitute the parent.
-			 */
-		case FUNCTION_LIST:
-		case STATEMENT_LIST:
-		case PRINT_LIST:
-		case EXPRESSION_LIST:
-		case VARIABLE_LIST:
-			if (root->n_children >= 2) {
-				result = root->children[0];
-				uint32_t n = (result->n_children += 1);
-				result->children =
-				    realloc(result->children, n * sizeof(node_t *));
-				result->children[n - 1] = root->children[1];
-				node_finalize(root);
+
+/*
+ * Simplify a single node whose children are already simplified, and return
+ * what should take its place in the tree.
+ */
+static node_index_t
+simplify_node(node_index_t root) {
+	node_index_t result = root;
+	node_t *n = NODE(root);
+
+	/* Here is where we do something to the lowest nodes in the tree */
+	switch (n->type) {
+		/*
+		 * These types have only syntactic value, so we can throw
+		 * them out now:
+		 * STATEMENT always has one child, which can identify itself
+		 * PARAMETER_LIST only serves to make variable lists optional
+		 *                in function declarations
+		 * ARGUMENT_LIST does the same thing for function calls
+		 */
+	case STATEMENT:
+	case PRINT_ITEM:
+	case PARAMETER_LIST:
+	case ARGUMENT_LIST:
+		result = n->children[0];
+		break;
+
+		/*
+		 * Print statements always have exactly one PRINT_LIST child.
+		 * Since we are done with the recursive list definition,
+		 * its descendants may instead be children of the print statement
+		 * itself now. (Quick hack - it's easier to rename the list node
+		 * and eliminate the old statement than to copy/move all children.)
+		 */
+	case PRINT_STATEMENT:
+		result = n->children[0];
+		NODE(result)->type = PRINT_STATEMENT;
+		break;
+
+		/*
+		 * The lists (FUNCTION_LIST, STATEMENT_LIST, ..., and
+		 * DECLARATION_LIST, when there is one) arrive here flat,
+		 * since the parser appends to them as it goes (node_append),
+		 * so there is nothing left to do for them.
+		 */
+
+	case EXPRESSION:
+		switch (n->n_children) {
+		case 1:
+			if (NODE(n->children[0])->type == INTEGER) {
+				/* Single integers */
+				result = n->children[0];
+				if (n->op == OP_NEG)    /* Negative constants */
+					NODE(result)->value *= -1;
+			} else if (n->op == OP_NONE) {
+				/* Single variables, parentheses, etc. */
+				result = n->children[0];
 			}
 			break;
-
-		case EXPRESSION:
-			switch (root->n_children) {
-			case 1:
-				if (root->children[0]->type.index == INTEGER) {
-					/* Single integers */
-					result = root->children[0];
-					if (root->data != NULL)     /* Negative constants */
-						*((int32_t *)result->data) *= -1;
-					node_finalize(root);
-				} else if (root->data == NULL) {
-					/* Single variables, parentheses, etc. */
-					result = root->children[0];
-					node_finalize(root);
+		case 2:     /* Constant binary expressions */
+			if (NODE(n->children[0])->type == INTEGER &&
+			        NODE(n->children[1])->type == INTEGER &&
+			        n->op != OP_NONE
+			   ) {
+				result = n->children[0];
+				int32_t
+				*a = &NODE(result)->value,
+				 b = NODE(n->children[1])->value;
+				switch (n->op) {
+				case OP_ADD:
+					*a += b;
+					break;
+				case OP_SUB:
+					*a -= b;
+					break;
+				case OP_MUL:
+					*a *= b;
+					break;
+				case OP_DIV:
+					/* Dividing by 0 has to trap at run time */
+					if (b == 0 || (*a == INT32_MIN && b == -1))
+						result = root;
+					else
+						*a /= b;
+					break;
+				case OP_POW:
+					*a = power(*a, b);
+					break;
 				}
-				break;
-			case 2:     /* Constant binary expressions */
-				if (root->children[0]->type.index == INTEGER &&
-				        root->children[1]->type.index == INTEGER &&
-				        root->data != NULL
-				   ) {
-					result = root->children[0];
-					int32_t
-					*a = result->data,
-					 *b = root->children[1]->data;
-					switch (*((char *)root->data)) {
-					case '+':
-						*a += *b;
-						break;
-					case '-':
-						*a -= *b;
-						break;
-					case '*':
-						*a *= *b;
-						break;
-					case '/':
-						*a /= *b;
-						break;
-					case '^':
-						if (*b == 0)
-							*a = 1;
-						else {
-							int32_t c = *a;
-							*a = 1;
-							if (*b > 0) {
-								for (int32_t i = 0; i < *b; i++) {
-									*a *= c;
-								}
-							} else if (*b < 0 && c != 0) {
-								for (int32_t i = *b; i < 0; i++) {
-									*a /= c;
-								}
-							}
-						}
-						break;
-					}
-					node_finalize(root->children[1]);
-					node_finalize(root);
-				}
-				break;
 			}
 			break;
 		}
+		break;
 	}
-	*simplified = result;
+	return result;
 }
 
 
 void
-bind_names(node_t *root) {
-	if (root != NULL) {
-		switch (root->type.index) {
-		case FUNCTION_LIST:
-			/*
-			* Here we need to initialize tables for all the functions in
-			* the program, in order to resolve forward references later
-			*/
-			scope_add();
-			for (uint32_t i = 0; i < root->n_children; i++) {
-				/* Create a symbol for the function */
-				/* Duplicating label data here, but never mind... */
-				node_t
-				*funname = root->children[i]->children[0],
-				 *arglist = root->children[i]->children[1];
-				funname->entry = malloc(sizeof(symbol_t));
-				*(funname->entry) = (symbol_t) {
-					.label = STRDUP(funname->data), .stack_offset = 0,
-					 .n_args = (arglist != NULL) ? arglist->n_children : 0
+simplify_tree(node_index_t *simplified, node_index_t root) {
+	/*
+	 * Depth-first traversal: the children of a node are visited one by
+	 * one (a visit's step is the number of children handed out so far),
+	 * and when they are all done, the simplified node takes its place in
+	 * its parent's list of children.
+	 * Optional elements in the syntax are never visited, so they remain
+	 * marked by a NO_NODE placeholder in the tree, keeping it simple to
+	 * recognize the structures imposed by the grammar.
+	 */
+	walk_t walk = { NULL, 0, 0 };
+	*simplified = root;
+	if (root != NO_NODE)
+		walk_push(&walk, root);
+	while (walk.height > 0) {
+		visit_t *v = WALK_TOP(&walk);
+		node_t *n = NODE(v->node);
+		if (v->step < n->n_children) {
+			node_index_t child = n->children[v->step++];
+			if (child != NO_NODE)
+				walk_push(&walk, child);
+		} else {
+			node_index_t result = simplify_node(v->node);
+			walk.height -= 1;
+			if (walk.height > 0) {
+				visit_t *parent = WALK_TOP(&walk);
+				NODE(parent->node)->children[parent->step - 1] = result;
+			} else
+				*simplified = result;
+		}
+	}
+	walk_finalize(&walk);
+}
+
+
+/*
+ * Locals of all the blocks in a function share its frame: frame_bottom is
+ * the lowest offset from %ebp in use at the current point of the function,
+ * and the function's symbol keeps track of the largest frame it needs.
+ * Blocks which are done with give their space back, so that blocks side
+ * by side can use the same slots.
+ */
+static int32_t frame_bottom = 0;
+static symbol_t *frame_function = NULL;
+
+/* Names of the functions to memoize, see bind_names */
+static char **memo_names = NULL;
+static uint32_t memo_names_count = 0;
+
+
+/* Add an edge to the call graph (see tree.h), numbering the call */
+void
+call_add(symbol_t *caller, node_index_t call) {
+	if (calls_count == calls_size) {
+		calls_size = (calls_size == 0) ? 64 : 2 * calls_size;
+		calls = realloc(calls, calls_size * sizeof(call_t));
+		if (calls == NULL) {
+			fprintf(stderr, "Out of memory for the call graph\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	NODE(call)->value = calls_count;
+	calls[calls_count++] = (call_t) {
+		.caller = caller, .call = call
+	};
+}
+
+
+/* The function a call names, or NULL if it names something else */
+symbol_t *
+call_callee(node_index_t call) {
+	symbol_t *entry = NODE(NODE(call)->children[0])->entry;
+	return (entry->label != NULL) ? entry : NULL;
+}
+
+
+/*
+ * The call graph as lists of callees, by index in the list of functions:
+ * function f calls (*callees)[(*first)[f]] to (*callees)[(*first)[f+1]-1].
+ * Both vectors are for the caller to free.
+ */
+void
+call_lists(uint32_t functions_count, uint32_t **first, uint32_t **callees) {
+	uint32_t *f = calloc(functions_count + 1, sizeof(uint32_t));
+	uint32_t *c = malloc((calls_count + 1) * sizeof(uint32_t));
+	uint32_t *next = malloc((functions_count + 1) * sizeof(uint32_t));
+	if (f == NULL || c == NULL || next == NULL) {
+		fprintf(stderr, "Out of memory for the call graph\n");
+		exit(EXIT_FAILURE);
+	}
+	for (uint32_t e = 0; e < calls_count; e++)
+		if (calls[e].call != NO_NODE && call_callee(calls[e].call) != NULL)
+			f[calls[e].caller->index + 1] += 1;
+	for (uint32_t i = 0; i < functions_count; i++)
+		f[i + 1] += f[i];
+	memcpy(next, f, (functions_count + 1) * sizeof(uint32_t));
+	for (uint32_t e = 0; e < calls_count; e++)
+		if (calls[e].call != NO_NODE && call_callee(calls[e].call) != NULL)
+			c[next[calls[e].caller->index]++] =
+			    call_callee(calls[e].call)->index;
+	free(next);
+	*first = f, *callees = c;
+}
+
+
+/*
+ * First visit to a node during name binding: open scopes and declare the
+ * names the node introduces, or look up the name it uses.
+ */
+static void
+bind_enter(node_index_t index) {
+	node_t *n = NODE(index);
+	switch (n->type) {
+	case FUNCTION_LIST:
+		/*
+		* Here we need to initialize tables for all the functions in
+		* the program, in order to resolve forward references later
+		*/
+		scope_add();
+		for (uint32_t i = 0; i < n->n_children; i++) {
+			/* Create a symbol for the function, labelled by its name */
+			node_t *funname = NODE(NODE(n->children[i])->children[0]);
+			node_index_t arglist = NODE(n->children[i])->children[1];
+			funname->entry = malloc(sizeof(symbol_t));
+			*(funname->entry) = (symbol_t) {
+				.label = ident_text(funname->value), .stack_offset = 0,
+				 .n_args = (arglist != NO_NODE) ? NODE(arglist)->n_children : 0,
+				  .index = i
+			};
+			for (uint32_t m = 0; m < memo_names_count; m++)
+				if (strcmp(memo_names[m], funname->entry->label) == 0)
+					funname->entry->memoized = true;
+			symbol_insert(funname->value, funname->entry);
+		}
+		break;
+
+	case FUNCTION:
+		/* Skip the name of the function - done in FUNCTION_LIST */
+		/* Declare the formal parameter variables */
+		scope_add();
+		frame_bottom = 0;
+		frame_function = NODE(n->children[0])->entry;
+		if (n->children[1] != NO_NODE) {
+			node_t *paramlist = NODE(n->children[1]);
+			int32_t offset = 4 + 4 * paramlist->n_children;
+			for (uint32_t i = 0; i < paramlist->n_children; i++) {
+				node_t *param = NODE(paramlist->children[i]);
+				param->entry = (symbol_t *)malloc(sizeof(symbol_t));
+				*(param->entry) = (symbol_t) {
+					.stack_offset = offset, .label = NULL,
+					 .n_args = NO_ARGS
 				};
-				symbol_insert(funname->data, funname->entry);
+				symbol_insert(param->value, param->entry);
+				offset -= 4;
 			}
-			for (uint32_t i = 0; i < root->n_children; i++)
-				bind_names(root->children[i]);
-			scope_remove();
-			break;
+		}
+		break;
+
+	case BLOCK:
+		scope_add();
+		break;
 
-		case FUNCTION: {
-			/* Skip the name of the function - done in FUNCTION_LIST */
-			/* Declare the formal parameter variables */
-			scope_add();
-			node_t *paramlist = root->children[1];
-			if (paramlist != NULL) {
-				int32_t offset = 4 + 4 * paramlist->n_children;
-				for (uint32_t i = 0; i < paramlist->n_children; i++) {
-					node_t *param = paramlist->children[i];
-					param->entry = (symbol_t *)malloc(sizeof(symbol_t));
-					*(param->entry) = (symbol_t) {
-						.stack_offset = offset, .label = NULL,
-						 .n_args = NO_ARGS
-					};
-					symbol_insert(param->data, param->entry);
+	case DECLARATION_LIST: {
+		int32_t offset = frame_bottom - 4;
+		for (uint32_t d = 0; d < n->n_children; d++) {
+			node_t *dnode = NODE(n->children[d]);
+			node_t *varlist = NODE(dnode->children[0]);
+			for (uint32_t i = 0; i < varlist->n_children; i++) {
+				node_t *var = NODE(varlist->children[i]);
+				var->entry = (symbol_t *) malloc(sizeof(symbol_t));
+				*(var->entry) = (symbol_t) {
+					.label = NULL, .stack_offset = offset,
+					 .n_args = NO_ARGS
+				};
+				symbol_insert(var->value, var->entry);
+				if (var->n_children == 0) {
 					offset -= 4;
+				} else {
+					offset -= (NODE(var->children[0])->value * 4) + 4;
 				}
 			}
-			bind_names(root->children[2]);
-			scope_remove();
 		}
-		break;
+		frame_bottom = offset + 4;
+		if (frame_function->frame_size < -frame_bottom)
+			frame_function->frame_size = -frame_bottom;
+	}
+	break;
 
-		case BLOCK:
-			scope_add();
-			for (uint32_t i = 0; i < root->n_children; i++)
-				bind_names(root->children[i]);
-			scope_remove();
-			break;
+	case EXPRESSION:
+		if (n->op == OP_CALL)
+			call_add(frame_function, index);
+		break;
 
-		case DECLARATION_LIST: {
-			int32_t offset = -4;
-			for (uint32_t d = 0; d < root->n_children; d++) {
-				node_t *dnode = root->children[d];
-				node_t *varlist = dnode->children[0];
-				for (uint32_t i = 0; i < varlist->n_children; i++) {
-					node_t *var = varlist->children[i];
-					var->entry = (symbol_t *) malloc(sizeof(symbol_t));
-					*(var->entry) = (symbol_t) {
-						.label = NULL, .stack_offset = offset,
-						 .n_args = NO_ARGS
-					};
-					symbol_insert(var->data, var->entry);
-					if (varlist->children[i]->n_children == 0) {
-						offset -= 4;
-					} else {
-						offset -= ((*(int *)varlist->children[i]->children[0]->data) * 4) + 4;
-					}
-				}
-			}
+	case VARIABLE:
+		symbol_get(&n->entry, n->value);
+		if (n->entry == NULL) {
+			fprintf(stderr,
+			        "Unknown identifier '%s'\n", ident_text(n->value)
+			       );
+			exit(EXIT_FAILURE);
 		}
 		break;
+	}
+}
 
-		case VARIABLE:
-			symbol_get(&root->entry, root->data);
-			if (root->entry == NULL) {
-				fprintf(stderr,
-				        "Unknown identifier '%s'\n", (char *)root->data
-				       );
-				exit(EXIT_FAILURE);
-			}
-			break;
 
-		case TEXT: {
-			int32_t i = strings_add(root->data);
-			root->data = malloc(sizeof(int32_t));
-			*((int32_t *)root->data) = i;
+/*
+ * Why a function can't be memoized, as far as its own body goes, or NULL
+ * if it can. Printing has to happen every time, and writing to an array
+ * could matter to the caller. Reading one is out too, as the array could
+ * have been passed in, and be different from one call to the next.
+ */
+static const char *
+memo_obstacle(node_index_t function) {
+	const char *obstacle = NULL;
+	walk_t walk = { NULL, 0, 0 };
+	walk_push(&walk, NODE(function)->children[2]);
+	while (walk.height > 0 && obstacle == NULL) {
+		node_t *n = NODE(WALK_TOP(&walk)->node);
+		walk.height -= 1;
+		if (n->type == PRINT_STATEMENT)
+			obstacle = "prints";
+		else if (n->type == ASSIGNMENT_STATEMENT && n->n_children == 3)
+			obstacle = "writes to an array";
+		else if (n->type == EXPRESSION && n->op == OP_INDEX)
+			obstacle = "reads from an array";
+		for (uint32_t i = 0; i < n->n_children; i++)
+			if (n->children[i] != NO_NODE)
+				walk_push(&walk, n->children[i]);
+	}
+	walk_finalize(&walk);
+	return obstacle;
+}
+
+
+/*
+ * Memoized functions must give the same result for the same arguments, and
+ * do nothing else, so neither must any function they lead to through calls.
+ */
+static void
+check_memoized(node_index_t root) {
+	node_t *list = NODE(NODE(root)->children[0]);
+	uint32_t count = list->n_children;
+	for (uint32_t m = 0; m < memo_names_count; m++) {
+		bool found = false;
+		for (uint32_t f = 0; f < count && !found; f++)
+			found = (strcmp(memo_names[m],
+			                NODE(NODE(list->children[f])->children[0])->entry->label)
+			         == 0);
+		if (!found) {
+			fprintf(stderr, "No function '%s' to memoize\n", memo_names[m]);
+			exit(EXIT_FAILURE);
 		}
-		break;
+	}
+	if (memo_names_count == 0)
+		return;
 
-		default:
-			for (uint32_t i = 0; i < root->n_children; i++)
-				bind_names(root->children[i]);
-			break;
+	/* Functions with side effects, and those which call one (through) */
+	const char **obstacle = malloc(count * sizeof(char *));
+	int32_t *through = malloc(count * sizeof(int32_t));
+	uint32_t *first, *callees;
+	call_lists(count, &first, &callees);
+	for (uint32_t f = 0; f < count; f++) {
+		obstacle[f] = memo_obstacle(list->children[f]);
+		through[f] = -1;
+	}
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (uint32_t f = 0; f < count; f++)
+			for (uint32_t c = first[f]; obstacle[f] == NULL && c < first[f + 1]; c++)
+				if (obstacle[callees[c]] != NULL) {
+					obstacle[f] = "has side effects";
+					through[f] = callees[c];
+					changed = true;
+				}
+	}
+
+	for (uint32_t f = 0; f < count; f++) {
+		symbol_t *entry = NODE(NODE(list->children[f])->children[0])->entry;
+		if (!entry->memoized || obstacle[f] == NULL)
+			continue;
+		if (through[f] < 0)
+			fprintf(stderr, "Can't memoize '%s', since it %s\n",
+			        entry->label, obstacle[f]);
+		else
+			fprintf(stderr, "Can't memoize '%s', since it calls '%s', which %s\n",
+			        entry->label,
+			        NODE(NODE(list->children[through[f]])->children[0])->entry->label,
+			        obstacle[through[f]]);
+		exit(EXIT_FAILURE);
+	}
+	free(obstacle);
+	free(through);
+	free(first);
+	free(callees);
+}
+
+
+/*
+ * Bind names to symbols, laying out the frames of the functions, and mark
+ * the functions named in 'memoized' to have their results memoized.
+ */
+void
+bind_names(node_index_t root, char **memoized, uint32_t n_memoized) {
+	memo_names = memoized;
+	memo_names_count = n_memoized;
+
+	/*
+	 * Pre-order traversal, since declarations must be seen before the
+	 * uses that follow them. A visit's step counts the children handed
+	 * out so far, so the node itself is entered while it is still 0.
+	 * Functions only have their body left to look at after that, while
+	 * declarations and variables are done as soon as they are entered.
+	 * Scopes opened on entry are closed when the visit is over, and a
+	 * block hands back the frame space of its locals (kept in aux).
+	 */
+	walk_t walk = { NULL, 0, 0 };
+	if (root != NO_NODE)
+		walk_push(&walk, root);
+	while (walk.height > 0) {
+		visit_t *v = WALK_TOP(&walk);
+		node_t *n = NODE(v->node);
+		if (v->step == 0) {
+			bind_enter(v->node);
+			v->aux = frame_bottom;
+		}
+
+		uint32_t first = 0, end = n->n_children;
+		if (n->type == FUNCTION)
+			first = 2;
+		else if (n->type == DECLARATION_LIST || n->type == VARIABLE)
+			end = 0;
+
+		if (first + v->step < end) {
+			node_index_t child = n->children[first + v->step++];
+			if (child != NO_NODE)
+				walk_push(&walk, child);
+		} else {
+			if (n->type == FUNCTION_LIST || n->type == FUNCTION ||
+			        n->type == BLOCK)
+				scope_remove();
+			if (n->type == BLOCK)
+				frame_bottom = v->aux;
+			walk.height -= 1;
 		}
 	}
+	walk_finalize(&walk);
+	if (root != NO_NODE)
+		check_memoized(root);
 }
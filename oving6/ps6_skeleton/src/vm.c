@@ -0,0 +1,618 @@
+#include <vm.h>
+#include <signal.h>
+
+
+/*
+ * A bytecode machine, to run programs without going through an assembler
+ * and a linker. The code is a vector of words, each instruction an opcode
+ * followed by its operands:
+ *
+ *   EXIT              exit with the value on top of the stack
+ *   CALL entry        call the function whose code starts at 'entry'
+ *   ENTER words room  make room for 'words' of locals, and 'room' in all
+ *   RETURN n          return the value on top, from a function of n params
+ *   END n             return the result, falling off the end of a function
+ *   CONSTANT c        push c
+ *   LOAD slot         push the word at 'slot' from the frame pointer
+ *   STORE slot        pop into the word at 'slot'
+ *   CLEAR slot        set the word at 'slot' to 0
+ *   ARRAY slot size   set up the array at 'slot', with 'size' elements
+ *   LOAD_INDEX        pop an index and an array, push the element
+ *   STORE_INDEX       pop a value, an index and an array, store the value
+ *   ADD ... POW       pop two values, push the result of the operation
+ *   NEG               negate the value on top
+ *   JUMP to           go on at 'to'
+ *   JUMPZERO to       pop a value, and go on at 'to' if it is 0
+ *   PRINT_TEXT s      print string number s, and a space
+ *   PRINT_INTEGER     pop a value, and print it and a space
+ *   PRINT_END         end the line
+ *
+ * Values go through a stack, as in the generated code, and it is the one
+ * vector for frames and arrays too. A call leaves its arguments on the
+ * stack, the word of the code to return to and the frame it is made from,
+ * and the frame pointer points at the last of these. Around that, a frame
+ * is laid out the way bind_names did it, upside down: the word at an
+ * offset from %ebp is the one at -offset / 4 from the frame pointer, so
+ * the parameters are below and the locals above, with the values of
+ * expressions on top of them. An array's elements are in the words after
+ * the one which names it, and hold the position of the first, and that
+ * position is what is passed for an array. Since the stack moves when it
+ * grows, it is all positions and no pointers.
+ *
+ * The result is what the native code has in %eax at the end of a
+ * statement: the value last assigned or tested, what putchar returned for
+ * the end of a line, or what the last call returned. It is what a function
+ * which runs off its end returns there.
+ */
+typedef enum {
+	VM_EXIT, VM_CALL, VM_ENTER, VM_RETURN, VM_END,
+	VM_CONSTANT, VM_LOAD, VM_STORE, VM_CLEAR, VM_ARRAY,
+	VM_LOAD_INDEX, VM_STORE_INDEX,
+	VM_ADD, VM_SUB, VM_MUL, VM_DIV, VM_POW, VM_NEG,
+	VM_JUMP, VM_JUMPZERO,
+	VM_PRINT_TEXT, VM_PRINT_INTEGER, VM_PRINT_END
+} vm_opcode_t;
+
+/* Instructions for the operators of binary expressions */
+static const vm_opcode_t operations[] = {
+	[OP_ADD] = VM_ADD, [OP_SUB] = VM_SUB, [OP_MUL] = VM_MUL,
+	[OP_DIV] = VM_DIV, [OP_POW] = VM_POW, [OP_INDEX] = VM_LOAD_INDEX
+};
+
+#define VISIT_DONE UINT32_MAX
+
+static int32_t *code = NULL;
+static uint32_t code_count = 0, code_size = 0;
+
+/* Where each function starts, by index, and the calls to point there */
+static uint32_t *entries = NULL;
+static uint32_t *links = NULL;
+static uint32_t links_count = 0, links_size = 0;
+
+/* The function being compiled, and the words of values it stacks */
+static symbol_t *function = NULL;
+static int32_t depth = 0, depth_max = 0;
+
+/*
+ * Where the loop started last in the code begins. As in the generated
+ * code, that is where CONTINUE goes.
+ */
+static int32_t loop_start = -1;
+
+/* The strings, decoded, by number */
+static char **texts = NULL;
+
+static int32_t *stack = NULL;
+static uint32_t stack_size = 0;
+
+
+static void *
+grow(void *vector, uint32_t *size, uint32_t count, size_t element) {
+	if (count < *size)
+		return vector;
+	*size = (*size == 0) ? 256 : 2 * *size;
+	vector = realloc(vector, *size * element);
+	if (vector == NULL) {
+		fprintf(stderr, "Out of memory for bytecode\n");
+		exit(EXIT_FAILURE);
+	}
+	return vector;
+}
+
+
+static void
+emit(int32_t word) {
+	code = grow(code, &code_size, code_count, sizeof(int32_t));
+	code[code_count++] = word;
+}
+
+
+/* An instruction which leaves 'change' more values on the stack */
+static void
+instruction(vm_opcode_t op, int32_t change) {
+	emit(op);
+	depth += change;
+	if (depth > depth_max)
+		depth_max = depth;
+}
+
+
+/* The slot of a variable in the frame */
+static int32_t
+slot(node_index_t variable) {
+	node_t *n = NODE(variable);
+	if (n->entry->label != NULL) {
+		fprintf(stderr, "Error: function '%s' is used as a variable\n",
+		        n->entry->label);
+		exit(EXIT_FAILURE);
+	}
+	return -n->entry->stack_offset / 4;
+}
+
+
+static void
+call(node_t *n) {
+	symbol_t *callee = NODE(n->children[0])->entry;
+	int32_t args = (n->children[1] == NO_NODE) ?
+	               0 : NODE(n->children[1])->n_children;
+	if (callee->label == NULL) {
+		fprintf(stderr, "Error: '%s' is not a function\n",
+		        ident_text(NODE(n->children[0])->value));
+		exit(EXIT_FAILURE);
+	}
+	if (callee->n_args != args) {
+		fprintf(stderr,
+		        "Error: function '%s' expects %d arguments, "
+		        "but is called with %d.\n",
+		        callee->label, callee->n_args, args);
+		exit(EXIT_FAILURE);
+	}
+
+	/* The link to the caller goes on top of the arguments */
+	if (depth + 2 > depth_max)
+		depth_max = depth + 2;
+	instruction(VM_CALL, 1 - args);
+	links = grow(links, &links_size, links_count, sizeof(uint32_t));
+	links[links_count++] = code_count;
+	emit(callee->index);
+}
+
+
+/*
+ * Compile the next step of a visit to a node, and return the child to
+ * compile before the step after that (if any).
+ */
+static node_index_t
+compile_node(visit_t *v) {
+	node_t *n = NODE(v->node);
+	uint32_t step = v->step++;
+	switch (n->type) {
+	case FUNCTION:
+		if (step == 0) {
+			function = NODE(n->children[0])->entry;
+			entries[function->index] = code_count;
+			depth = depth_max = 0;
+			instruction(VM_ENTER, 0);
+			emit(function->frame_size / 4);
+			emit(0);
+			v->aux = code_count - 1;
+			return n->children[2];
+		}
+		instruction(VM_END, 0);
+		emit(function->n_args);
+		code[v->aux] = function->frame_size / 4 + depth_max;
+		break;
+
+	case PRINT_STATEMENT:
+		/* Two steps per item: compute it, then print it */
+		if (step / 2 < n->n_children) {
+			node_index_t item = n->children[step / 2];
+			if (NODE(item)->type == TEXT) {
+				instruction(VM_PRINT_TEXT, 0);
+				emit(NODE(item)->value);
+				v->step += 1;
+			} else if (step % 2 == 0) {
+				return item;
+			} else {
+				instruction(VM_PRINT_INTEGER, -1);
+			}
+			return NO_NODE;
+		}
+		instruction(VM_PRINT_END, 0);
+		break;
+
+	case DECLARATION: {
+		node_t *names = NODE(n->children[0]);
+		for (uint32_t i = 0; i < names->n_children; i++) {
+			node_t *var = NODE(names->children[i]);
+			if (var->n_children == 0) {
+				instruction(VM_CLEAR, 0);
+				emit(slot(names->children[i]));
+			} else {
+				instruction(VM_ARRAY, 0);
+				emit(slot(names->children[i]));
+				emit(NODE(var->children[0])->value);
+			}
+		}
+		break;
+	}
+
+	case EXPRESSION:
+		if (n->op == OP_CALL) {
+			if (step == 0 && n->children[1] != NO_NODE)
+				return n->children[1];
+			call(n);
+			break;
+		}
+		if (step < n->n_children)
+			return n->children[step];
+		if (n->op == OP_NEG)
+			instruction(VM_NEG, 0);
+		else if (n->op != OP_NONE)
+			instruction(operations[n->op], -1);
+		break;
+
+	case VARIABLE:
+		instruction(VM_LOAD, 1);
+		emit(slot(v->node));
+		break;
+
+	case INTEGER:
+		instruction(VM_CONSTANT, 1);
+		emit(n->value);
+		break;
+
+	case ASSIGNMENT_STATEMENT:
+		if (n->n_children == 3) {
+			/* The array, the index and the value */
+			if (step < 3)
+				return n->children[step];
+			instruction(VM_STORE_INDEX, -3);
+			break;
+		}
+		if (step == 0)
+			return n->children[1];
+		instruction(VM_STORE, -1);
+		emit(slot(n->children[0]));
+		break;
+
+	case RETURN_STATEMENT:
+		if (step == 0)
+			return n->children[0];
+		instruction(VM_RETURN, -1);
+		emit(function->n_args);
+		break;
+
+	case IF_STATEMENT:
+		/* The visit keeps where the jump to patch next is */
+		switch (step) {
+		case 0:
+			return n->children[0];
+		case 1:
+			instruction(VM_JUMPZERO, -1);
+			emit(0);
+			v->aux = code_count - 1;
+			return n->children[1];
+		case 2:
+			if (n->n_children == 3) {
+				instruction(VM_JUMP, 0);
+				emit(0);
+				code[v->aux] = code_count;
+				v->aux = code_count - 1;
+				return n->children[2];
+			}
+			code[v->aux] = code_count;
+			break;
+		default:
+			code[v->aux] = code_count;
+			break;
+		}
+		break;
+
+	case WHILE_STATEMENT:
+		/* The jump out of the loop keeps its start until it is patched */
+		switch (step) {
+		case 0:
+			v->aux = loop_start = code_count;
+			return n->children[0];
+		case 1:
+			instruction(VM_JUMPZERO, -1);
+			emit(v->aux);
+			v->aux = code_count - 1;
+			return n->children[1];
+		default:
+			instruction(VM_JUMP, 0);
+			emit(code[v->aux]);
+			code[v->aux] = code_count;
+			break;
+		}
+		break;
+
+	case NULL_STATEMENT:
+		if (loop_start < 0) {
+			fprintf(stderr, "Error: CONTINUE outside of a loop\n");
+			exit(EXIT_FAILURE);
+		}
+		instruction(VM_JUMP, 0);
+		emit(loop_start);
+		break;
+
+	default:
+		if (step < n->n_children)
+			return n->children[step];
+		break;
+	}
+	v->step = VISIT_DONE;
+	return NO_NODE;
+}
+
+
+/*
+ * The code for a program: a call to the first function, which exits with
+ * what it returns, followed by the functions.
+ */
+static void
+compile(node_index_t root) {
+	node_t *list = NODE(NODE(root)->children[0]);
+	entries = malloc(list->n_children * sizeof(uint32_t));
+	if (entries == NULL) {
+		fprintf(stderr, "Out of memory for bytecode\n");
+		exit(EXIT_FAILURE);
+	}
+	emit(VM_CALL);
+	links = grow(links, &links_size, links_count, sizeof(uint32_t));
+	links[links_count++] = code_count;
+	emit(0);
+	emit(VM_EXIT);
+
+	walk_t walk = { NULL, 0, 0 };
+	walk_push(&walk, root);
+	while (walk.height > 0) {
+		visit_t *v = WALK_TOP(&walk);
+		if (v->step == VISIT_DONE) {
+			walk.height -= 1;
+			continue;
+		}
+		node_index_t next = compile_node(v);
+		if (next != NO_NODE)
+			walk_push(&walk, next);
+	}
+	walk_finalize(&walk);
+
+	for (uint32_t l = 0; l < links_count; l++)
+		code[links[l]] = entries[code[links[l]]];
+
+	int32_t count = strings_count();
+	texts = calloc(count + 1, sizeof(char *));
+	for (int32_t s = 0; s < count; s++) {
+		char *text = strings_get(s);
+		if (text != NULL) {
+			texts[s] = malloc(strlen(text));
+			strings_decode(text, texts[s]);
+		}
+	}
+}
+
+
+/* Make the stack at least 'needed' words, zeroing what is new */
+static void
+stack_grow(uint32_t needed) {
+	if (needed > VM_STACK_LIMIT) {
+		fprintf(stderr, "Error: out of stack, %u words deep\n", needed);
+		exit(EXIT_FAILURE);
+	}
+	uint32_t size = (stack_size == 0) ? 4096 : stack_size;
+	while (size < needed)
+		size *= 2;
+	if (size > VM_STACK_LIMIT)
+		size = VM_STACK_LIMIT;
+	stack = realloc(stack, size * sizeof(int32_t));
+	if (stack == NULL) {
+		fprintf(stderr, "Out of memory for the stack\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(stack + stack_size, 0, (size - stack_size) * sizeof(int32_t));
+	stack_size = size;
+}
+
+
+/* Dividing by 0 or overflowing traps, as idiv does */
+static void
+divide_trap(void) {
+	raise(SIGFPE);
+	fprintf(stderr, "Error: division overflow\n");
+	exit(EXIT_FAILURE);
+}
+
+
+static void
+out_of_bounds(int64_t at) {
+	fprintf(stderr, "Error: array element at %lld is outside the stack\n",
+	        (long long) at);
+	exit(EXIT_FAILURE);
+}
+
+
+static int32_t
+power(int32_t base, int32_t exponent) {
+	if (base == 1)
+		return 1;
+	if (exponent < 0)
+		return 0;
+	uint32_t result = 1, square = (uint32_t) base;
+	for (uint32_t e = (uint32_t) exponent; e > 0; e >>= 1) {
+		if (e & 1)
+			result *= square;
+		square *= square;
+	}
+	return (int32_t) result;
+}
+
+
+/*
+ * Run the code, from the start, on a stack with 'height' words of
+ * arguments. Dispatch is threaded: each instruction ends by jumping
+ * straight to the one after it, through a table of label addresses
+ * (computed goto, as GCC and Clang have it), instead of going back to
+ * one switch at the top for every instruction.
+ */
+static int32_t
+execute(uint32_t height) {
+	static void *dispatch[] = {
+		[VM_EXIT] = &&do_EXIT, [VM_CALL] = &&do_CALL,
+		[VM_ENTER] = &&do_ENTER, [VM_RETURN] = &&do_RETURN,
+		[VM_END] = &&do_END, [VM_CONSTANT] = &&do_CONSTANT,
+		[VM_LOAD] = &&do_LOAD, [VM_STORE] = &&do_STORE,
+		[VM_CLEAR] = &&do_CLEAR, [VM_ARRAY] = &&do_ARRAY,
+		[VM_LOAD_INDEX] = &&do_LOAD_INDEX,
+		[VM_STORE_INDEX] = &&do_STORE_INDEX,
+		[VM_ADD] = &&do_ADD, [VM_SUB] = &&do_SUB, [VM_MUL] = &&do_MUL,
+		[VM_DIV] = &&do_DIV, [VM_POW] = &&do_POW, [VM_NEG] = &&do_NEG,
+		[VM_JUMP] = &&do_JUMP, [VM_JUMPZERO] = &&do_JUMPZERO,
+		[VM_PRINT_TEXT] = &&do_PRINT_TEXT,
+		[VM_PRINT_INTEGER] = &&do_PRINT_INTEGER,
+		[VM_PRINT_END] = &&do_PRINT_END
+	};
+#define DISPATCH() goto *dispatch[*ip++]
+
+	const int32_t *ip = code;
+	int32_t *fp = stack, *sp = stack + height;
+	int32_t result = 0, a, b;
+	int64_t at;
+	DISPATCH();
+
+do_EXIT:
+	return sp[-1];
+
+do_CALL:
+	sp[0] = ip + 1 - code;
+	sp[1] = fp - stack;
+	fp = sp + 1;
+	ip = code + ip[0];
+	DISPATCH();
+
+do_ENTER:
+	if (fp + 1 + ip[1] > stack + stack_size) {
+		uint32_t at_fp = fp - stack;
+		stack_grow(at_fp + 1 + ip[1]);
+		fp = stack + at_fp;
+	}
+	sp = fp + 1 + ip[0];
+	ip += 2;
+	DISPATCH();
+
+do_RETURN:
+	result = sp[-1];
+do_END:
+	sp = fp - 1 - ip[0];
+	ip = code + fp[-1];
+	fp = stack + fp[0];
+	*sp++ = result;
+	DISPATCH();
+
+do_CONSTANT:
+	*sp++ = *ip++;
+	DISPATCH();
+
+do_LOAD:
+	*sp++ = fp[*ip++];
+	DISPATCH();
+
+do_STORE:
+	result = fp[*ip++] = *--sp;
+	DISPATCH();
+
+do_CLEAR:
+	fp[*ip++] = 0;
+	DISPATCH();
+
+do_ARRAY:
+	fp[ip[0]] = fp + ip[0] + 1 - stack;
+	memset(fp + ip[0] + 1, 0, ip[1] * sizeof(int32_t));
+	ip += 2;
+	DISPATCH();
+
+do_LOAD_INDEX:
+	b = *--sp;
+	at = (int64_t) sp[-1] + b;
+	if (at < 0 || at >= sp - stack)
+		out_of_bounds(at);
+	sp[-1] = stack[at];
+	DISPATCH();
+
+do_STORE_INDEX:
+	sp -= 3;
+	at = (int64_t) sp[0] + sp[1];
+	if (at < 0 || at >= sp - stack)
+		out_of_bounds(at);
+	result = stack[at] = sp[2];
+	DISPATCH();
+
+do_ADD:
+	b = *--sp;
+	sp[-1] = (int32_t) ((uint32_t) sp[-1] + (uint32_t) b);
+	DISPATCH();
+
+do_SUB:
+	b = *--sp;
+	sp[-1] = (int32_t) ((uint32_t) sp[-1] - (uint32_t) b);
+	DISPATCH();
+
+do_MUL:
+	b = *--sp;
+	sp[-1] = (int32_t) ((uint32_t) sp[-1] * (uint32_t) b);
+	DISPATCH();
+
+do_DIV:
+	b = *--sp;
+	a = sp[-1];
+	if (b == 0 || (a == INT32_MIN && b == -1))
+		divide_trap();
+	sp[-1] = a / b;
+	DISPATCH();
+
+do_POW:
+	b = *--sp;
+	sp[-1] = power(sp[-1], b);
+	DISPATCH();
+
+do_NEG:
+	sp[-1] = (int32_t) (0u - (uint32_t) sp[-1]);
+	DISPATCH();
+
+do_JUMP:
+	ip = code + ip[0];
+	DISPATCH();
+
+do_JUMPZERO:
+	result = *--sp;
+	ip = (result == 0) ? code + ip[0] : ip + 1;
+	DISPATCH();
+
+do_PRINT_TEXT:
+	fputs(texts[*ip++], stdout);
+	putchar(' ');
+	DISPATCH();
+
+do_PRINT_INTEGER:
+	printf("%d ", *--sp);
+	DISPATCH();
+
+do_PRINT_END:
+	result = putchar('\n');
+	DISPATCH();
+
+#undef DISPATCH
+}
+
+
+void
+vm_run(node_index_t root, int argc, char **argv, int32_t verbosity) {
+	if (root == NO_NODE)
+		exit(EXIT_SUCCESS);
+	compile(root);
+	if (verbosity > 0)
+		fprintf(stderr, "vm: %u words of bytecode\n", code_count);
+
+	/*
+	 * The arguments go on the stack in order, and the parameters are
+	 * the last of them, as in the native code. Missing ones are 0.
+	 */
+	node_t *first = NODE(NODE(NODE(root)->children[0])->children[0]);
+	uint32_t n_args = NODE(first->children[0])->entry->n_args;
+	uint32_t given = (argc > 1) ? argc - 1 : 0;
+	stack_grow(n_args + 2);
+	for (uint32_t i = 0; i < n_args; i++)
+		if (given + i >= n_args)
+			stack[i] = (int32_t) strtol(argv[1 + given - n_args + i], NULL, 10);
+	int32_t status = execute(n_args);
+
+	for (int32_t s = 0; s < strings_count(); s++)
+		free(texts[s]);
+	free(texts);
+	free(code);
+	free(entries);
+	free(links);
+	free(stack);
+	exit(status);
+}
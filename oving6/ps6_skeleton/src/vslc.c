@@ -1,13 +1,21 @@
 #include "vslc.h"
 
 static char *outfile = NULL;
+static int32_t inline_budget = INLINE_BUDGET;
+static char **memoized = NULL;
+static uint32_t memoized_count = 0;
+static int32_t machine = 0;
+static bool interpret = false;
+static bool csource = false;
+static int run_argc = 0;
+static char **run_argv = NULL;
 
 
 static void
 options(int argc, char **argv) {
 	int32_t opt = 0;
 	while (opt != -1) {
-		opt = getopt(argc, argv, "f:o:p");
+		opt = getopt(argc, argv, "cCf:ijl:m:M:o:prsv:");
 		switch (opt) {
 		case -1:    /* No more options */
 			break;
@@ -16,6 +24,52 @@ options(int argc, char **argv) {
 			peephole = true;
 			break;
 
+		case 'r':   /* Keep values in registers, not on the stack */
+			registers = true;
+			break;
+
+		case 'l':   /* Largest function to inline, in nodes (0 for none) */
+			inline_budget = strtol(optarg, NULL, 10);
+			break;
+
+		case 'm':   /* Machine to generate code for: 32 (x86) or 64 (x86-64) */
+			if (strcmp(optarg, "32") != 0 && strcmp(optarg, "64") != 0) {
+				fprintf(stderr, "Unknown machine '%s'\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			machine = strtol(optarg, NULL, 10);
+			x86_64 = (machine == 64);
+			break;
+
+		case 'M':   /* Memoize the results of a function */
+			memoized = realloc(memoized, (memoized_count + 1) * sizeof(char *));
+			memoized[memoized_count++] = optarg;
+			break;
+
+		case 'v':   /* Report on what the passes did, on stderr */
+			verbosity = strtol(optarg, NULL, 10);
+			break;
+
+		case 'c':   /* Write an object file to link, instead of assembly */
+			object_file = true;
+			break;
+
+		case 'C':   /* Write the program as C99 source, instead of assembly */
+			csource = true;
+			break;
+
+		case 'i':   /* Interpret bytecode for the program, like -j */
+			interpret = true;
+			break;
+
+		case 'j':   /* Run the program right away, with the arguments left */
+			jit = true;
+			break;
+
+		case 's':   /* Print the output through stdio (for comparison) */
+			stdio_emitter = true;
+			break;
+
 		case 'f':   /* Redirect input stream from file */
 			if (freopen(optarg, "r", stdin) == NULL) {
 				fprintf(
@@ -31,12 +85,37 @@ options(int argc, char **argv) {
 
 		default:    /* Got some option we don't recognize */
 			fprintf(stderr,
-			        "Usage: %s [-p] [-v #] [-f infile] [-o] outfile\n", argv[0]
+			        "Usage: %s [-c] [-C] [-i] [-j] [-p] [-r] [-s] [-l #] [-m 32|64] [-M function] [-v #] [-f infile] [-o] outfile [-- arguments for -i/-j]\n", argv[0]
 			       );
 			exit(EXIT_FAILURE);
 		}
 
 	}
+	if (jit) {
+		/* The code is for the machine this runs on */
+#if defined(__x86_64__) || defined(__i386__)
+		int32_t host = (sizeof(void *) == 8) ? 64 : 32;
+#else
+		int32_t host = 0;
+#endif
+		if (host == 0 || (machine != 0 && machine != host)) {
+			fprintf(stderr, "Programs run (-j) on this machine only\n");
+			exit(EXIT_FAILURE);
+		}
+		x86_64 = (host == 64);
+	}
+	if (jit || interpret) {
+		/* What is left of the command line is for the program */
+		run_argc = argc - optind + 1;
+		run_argv = argv + optind - 1;
+		run_argv[0] = argv[0];
+		jit_argc = run_argc;
+		jit_argv = run_argv;
+	}
+	if (registers && x86_64) {
+		fprintf(stderr, "Registers (-r) are only allocated for 32-bit code\n");
+		exit(EXIT_FAILURE);
+	}
 }
 
 
@@ -59,7 +138,20 @@ main(int argc, char **argv) {
 		node_print(stderr, root, 0);
 #endif
 
-	bind_names(root);
+	bind_names(root, memoized, memoized_count);
+	simplify_expressions(root);
+	if (verbosity > 0)
+		fprintf(stderr, "simplify: %u algebraic rewrites\n",
+		        algebra_rewrites(verbosity));
+	uint32_t folded = fold_calls(root, verbosity);
+	if (verbosity > 0)
+		fprintf(stderr, "fold: %u calls evaluated\n", folded);
+	uint32_t inlined = inline_calls(root, inline_budget, verbosity);
+	if (verbosity > 0)
+		fprintf(stderr, "inline: %u calls inlined\n", inlined);
+	uint32_t pruned = prune_functions(root, verbosity);
+	if (verbosity > 0)
+		fprintf(stderr, "prune: %u functions dropped\n", pruned);
 
 	/* Parsing and semantics are ok, redirect stdout to file (if requested) */
 	if (outfile != NULL) {
@@ -70,10 +162,16 @@ main(int argc, char **argv) {
 		free(outfile);
 	}
 
-	generate(stdout, root);
+	if (interpret)
+		vm_run(root, run_argc, run_argv, verbosity);
+	if (csource)
+		csource_write(stdout, root);
+	else
+		generate(stdout, root);
 
-	destroy_subtree(root);
+	destroy_tree();
 	symtab_finalize();
+	free(memoized);
 
 	exit(EXIT_SUCCESS);
 }
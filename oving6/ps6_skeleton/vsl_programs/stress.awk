@@ -0,0 +1,23 @@
+# Generates a VSL program with two expression chains of depth n: a left-
+# leaning one (a+a+...+a) and a right-leaning, parenthesized one
+# (a-(a-(...(a)...))), which nest the syntax tree n levels deep.
+# Prints n, and then 0 for even n or 1 for odd n.
+BEGIN {
+	print "FUNC main ()"
+	print "{"
+	print "    VAR a, b"
+	print "    a := 1"
+	printf "    b := a"
+	for (i = 1; i < n; i++)
+		printf "+a"
+	printf "\n    PRINT b\n"
+	printf "    b := "
+	for (i = 1; i < n; i++)
+		printf "a-("
+	printf "a"
+	for (i = 1; i < n; i++)
+		printf ")"
+	printf "\n    PRINT b\n"
+	print "    RETURN 0"
+	print "}"
+}